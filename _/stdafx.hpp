@@ -48,11 +48,20 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <iconv.h>
+#include <linux/futex.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <ucontext.h>
 #include <uuid/uuid.h>
 
@@ -63,7 +72,9 @@
 #endif
 
 // c headers
+#include <cassert>
 #include <cctype>
+#include <cstddef>
 #include <cerrno>
 #include <csetjmp>
 #include <cstdarg>
@@ -86,6 +97,7 @@
 #include <ios>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <list>
 #include <map>
 #include <set>
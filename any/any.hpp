@@ -83,7 +83,7 @@ inline Any &Any::operator=(const Any &a) {
   if (ptr_ == a.ptr_)
     return *this;
   auto old = ptr_;
-  ptr_ = a.ptr_->clone();
+  ptr_ = a.clone();
   if (old)
     delete old;
   return *this;
@@ -92,8 +92,7 @@ inline Any &Any::operator=(const Any &a) {
 inline Any &Any::operator=(Any &&a) {
   if (ptr_ == a.ptr_)
     return *this;
-  ptr_ = a.ptr_;
-  a.ptr_ = nullptr;
+  std::swap(ptr_, a.ptr_);
   return *this;
 }
 
@@ -101,7 +100,7 @@ template <class X, typename std::enable_if<
                        !std::is_same<typename std::decay<X>::type, Any>::value,
                        int>::type>
 inline Any &Any::operator=(const X &x) {
-  this->operator=(std::move(Any(x)));
+  return this->operator=(std::move(Any(x)));
 }
 
 inline Any::~Any() { delete ptr_; }
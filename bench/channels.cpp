@@ -0,0 +1,176 @@
+// messages/sec through the pipeline channels against concurrency::Deque,
+// the Container most stages use today. one consumer, one or more producers,
+// each message a long, one by one or in batches of 64
+//
+// build, with this repo reachable as myspace/ under <inc>:
+//   g++ -std=c++14 -O2 -pthread -I<inc> bench/channels.cpp
+// run: ./a.out [messages=2097152] [producers=4]
+
+// defer.hpp first, it pulls in exception.hpp and logger.hpp in an order
+// that compiles
+#include "myspace/defer/defer.hpp"
+#include "myspace/concurrency/factory.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace myspace;
+
+namespace {
+
+enum { BATCH = 64, CAPACITY = 1024 };
+
+struct Message : concurrency::MpscNode {
+  long v_ = 0;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+void report(const char *name, size_t n, Clock::time_point t0) {
+  auto secs = std::chrono::duration<double>(Clock::now() - t0).count();
+  ::printf("%-28s %8.1fM msg/s\n", name, n / secs / 1e6);
+}
+
+// producers push n in total, the calling thread pops them
+template <class Produce, class Consume>
+void run(const char *name, size_t n, size_t producers, Produce produce,
+         Consume consume) {
+  std::vector<std::thread> threads;
+  auto t0 = Clock::now();
+  for (size_t p = 0; p < producers; ++p)
+    threads.emplace_back([&, p]() {
+      produce(p * (n / producers), (p + 1) * (n / producers));
+    });
+  consume(n / producers * producers);
+  for (auto &thr : threads)
+    thr.join();
+  report(name, n / producers * producers, t0);
+}
+
+void spsc(size_t n) {
+  auto deque = concurrency::Factory::createDeque<long>(CAPACITY);
+  run("deque 1p", n, 1,
+      [&](size_t from, size_t to) {
+        for (auto i = from; i < to; ++i)
+          deque->pushBack((long)i);
+      },
+      [&](size_t total) {
+        for (size_t i = 0; i < total; ++i)
+          deque->popFront();
+      });
+
+  std::vector<long> out;
+  run("deque 1p drainTo", n, 1,
+      [&](size_t from, size_t to) {
+        for (auto i = from; i < to; ++i)
+          deque->pushBack((long)i);
+      },
+      [&](size_t total) {
+        for (size_t got = 0; got < total;) {
+          out.clear();
+          got += deque->drainTo(std::back_inserter(out));
+          if (out.empty())
+            std::this_thread::yield();
+        }
+      });
+
+  auto ring = concurrency::Factory::createSpscRing<long>(CAPACITY);
+  run("spsc ring", n, 1,
+      [&](size_t from, size_t to) {
+        for (auto i = from; i < to; ++i)
+          ring->pushBack((long)i);
+      },
+      [&](size_t total) {
+        for (size_t i = 0; i < total; ++i)
+          ring->popFront();
+      });
+
+  run("spsc ring batch", n, 1,
+      [&](size_t from, size_t to) {
+        long batch[BATCH];
+        for (auto i = from; i < to;) {
+          size_t k = 0;
+          for (; k < BATCH && i < to; ++k, ++i)
+            batch[k] = (long)i;
+          ring->pushN(batch, k);
+        }
+      },
+      [&](size_t total) {
+        long batch[BATCH];
+        for (size_t got = 0; got < total;)
+          got += ring->popN(batch, BATCH);
+      });
+}
+
+void mpsc(size_t n, size_t producers) {
+  char name[64];
+
+  auto deque = concurrency::Factory::createDeque<long>(CAPACITY);
+  ::snprintf(name, sizeof(name), "deque %zup", producers);
+  run(name, n, producers,
+      [&](size_t from, size_t to) {
+        for (auto i = from; i < to; ++i)
+          deque->pushBack((long)i);
+      },
+      [&](size_t total) {
+        for (size_t i = 0; i < total; ++i)
+          deque->popFront();
+      });
+
+  auto ring = concurrency::Factory::createRing<long>(CAPACITY);
+  ::snprintf(name, sizeof(name), "mpmc ring %zup", producers);
+  run(name, n, producers,
+      [&](size_t from, size_t to) {
+        for (auto i = from; i < to; ++i)
+          ring->pushBack((long)i);
+      },
+      [&](size_t total) {
+        for (size_t i = 0; i < total; ++i)
+          ring->popFront();
+      });
+
+  // intrusive, the nodes belong to the producers
+  std::vector<Message> messages(n);
+  auto queue = concurrency::Factory::createMpscQueue<Message>();
+  ::snprintf(name, sizeof(name), "mpsc queue %zup", producers);
+  run(name, n, producers,
+      [&](size_t from, size_t to) {
+        for (auto i = from; i < to; ++i)
+          queue->pushBack(&messages[i]);
+      },
+      [&](size_t total) {
+        for (size_t i = 0; i < total; ++i)
+          queue->popFront();
+      });
+
+  ::snprintf(name, sizeof(name), "mpsc queue %zup batch", producers);
+  run(name, n, producers,
+      [&](size_t from, size_t to) {
+        Message *batch[BATCH];
+        for (auto i = from; i < to;) {
+          size_t k = 0;
+          for (; k < BATCH && i < to; ++k, ++i)
+            batch[k] = &messages[i];
+          queue->pushN(batch, k);
+        }
+      },
+      [&](size_t total) {
+        Message *batch[BATCH];
+        for (size_t got = 0; got < total;)
+          got += queue->popN(batch, BATCH);
+      });
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? ::strtoul(argv[1], nullptr, 10) : 1 << 21;
+  size_t producers = argc > 2 ? ::strtoul(argv[2], nullptr, 10) : 4;
+  producers = std::max<size_t>(producers, 1);
+
+  ::printf("%zu messages, capacity %d, batch %d\n", n, (int)CAPACITY,
+           (int)BATCH);
+  spsc(n);
+  mpsc(n, producers);
+  return 0;
+}
@@ -0,0 +1,62 @@
+// ns per context switch, Ucontext (glibc swapcontext, which saves and
+// restores the signal mask with a syscall) against Context (the assembly
+// switch). the caller resumes the coroutine, which resumes it straight
+// back, so every round trip is two switches
+//
+// build, with this repo reachable as myspace/ under <inc>:
+//   g++ -std=c++14 -O2 -pthread -I<inc> bench/context_switch.cpp
+// run: ./a.out [round_trips=10000000]
+
+// defer.hpp first, it pulls in exception.hpp and logger.hpp in an order
+// that compiles
+#include "myspace/defer/defer.hpp"
+#include "myspace/coroutine/coroutine.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace myspace;
+
+namespace {
+
+template <class C> void pingpong(const char *name, size_t n) {
+  size_t bounced = 0;
+  C *self = nullptr;
+  C co(typename C::Stack(64 * 1024), [&]() {
+    for (;;) {
+      ++bounced;
+      self->resume();
+      if (bounced == n)
+        return;
+    }
+  });
+  self = &co;
+  // the first resume starts the coroutine, left out of the timing
+  co.resume();
+  auto t0 = std::chrono::steady_clock::now();
+  while (co)
+    co.resume();
+  auto ns = std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now() - t0)
+                .count();
+  ::printf("%-10s %10zu round trips %8.1f ns/switch\n", name, n,
+           ns / (bounced - 1) / 2);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? ::strtoul(argv[1], nullptr, 10) : 10000000;
+  n = std::max<size_t>(n, 2);
+
+#if defined(MYSPACE_LINUX)
+  // a syscall per switch, a tenth of the trips is plenty
+  pingpong<Ucontext>("Ucontext", std::max<size_t>(n / 10, 2));
+#endif
+#if defined(MYSPACE_HAS_ASM_CONTEXT)
+  pingpong<Context>("Context", n);
+#else
+  ::printf("no assembly Context on this platform\n");
+#endif
+  return 0;
+}
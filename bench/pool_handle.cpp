@@ -0,0 +1,89 @@
+// checkout/return latency of Pool, get() wrapping the object in a
+// std::shared_ptr against getHandle() returning a Pool::Handle, on one
+// thread and on several sharing the pool, plus heap allocations per
+// checkout counted through operator new
+//
+// build, with this repo reachable as myspace/ under <inc>:
+//   g++ -std=c++14 -O2 -pthread -I<inc> bench/pool_handle.cpp
+// run: ./a.out [checkouts=5000000] [threads=4]
+
+// defer.hpp first, it pulls in exception.hpp and logger.hpp in an order
+// that compiles
+#include "myspace/defer/defer.hpp"
+#include "myspace/pool/pool.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+static std::atomic<uint64_t> allocs{ 0 };
+
+void *operator new(size_t n) {
+  allocs.fetch_add(1, std::memory_order_relaxed);
+  if (auto p = ::malloc(n))
+    return p;
+  throw std::bad_alloc();
+}
+
+// out of line, or gcc sees the free of an inlined new and warns
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+  ::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept {
+  ::free(p);
+}
+
+using namespace myspace;
+
+// threads run n checkouts each, prints ns per checkout and return
+template <class Checkout>
+static void run(const char *name, size_t n, size_t threads,
+                Checkout checkout) {
+  auto a0 = allocs.load();
+  auto t0 = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads; ++t)
+    workers.emplace_back([&]() {
+      for (size_t i = 0; i < n; ++i)
+        checkout();
+    });
+  for (auto &thr : workers)
+    thr.join();
+  auto ns = std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now() - t0)
+                .count();
+  auto total = (double)(n * threads);
+  ::printf("%-22s %zu thread(s) %8.1f ns %8.3f allocs\n", name, threads,
+           ns / total, (allocs.load() - a0) / total);
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? ::strtoul(argv[1], nullptr, 10) : 5000000;
+  size_t threads = argc > 2 ? ::strtoul(argv[2], nullptr, 10) : 4;
+  threads = std::max<size_t>(threads, 1);
+
+  auto pool = PoolFactory::create<long>(
+      0, []() { return new long(0); }, [](long *x) { delete x; }, nullptr,
+      nullptr);
+
+  // warms the magazines
+  for (size_t t : { (size_t)1, threads }) {
+    run("shared_ptr get", n / 10, t, [&]() { pool->get(); });
+    run("Handle getHandle", n / 10, t, [&]() { pool->getHandle(); });
+  }
+
+  ::printf("%zu checkouts per thread\n", n);
+  for (size_t t : { (size_t)1, threads }) {
+    for (int round = 0; round < 2; ++round) {
+      run("shared_ptr get", n, t, [&]() {
+        auto x = pool->get();
+        ++*x;
+      });
+      run("Handle getHandle", n, t, [&]() {
+        auto x = pool->getHandle();
+        ++*x;
+      });
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,69 @@
+// jobs/sec of ThreadPool::pushBack, which pays a packaged_task and a future
+// per job, against post, which is fire and forget, plus heap allocations
+// per job counted through operator new
+//
+// build, with this repo reachable as myspace/ under <inc>:
+//   g++ -std=c++14 -O2 -pthread -I<inc> bench/threadpool_post.cpp
+// run: ./a.out [jobs=1000000] [threads=4]
+
+#include "myspace/threadpool/threadpool.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+static std::atomic<uint64_t> allocs{ 0 };
+
+void *operator new(size_t n) {
+  allocs.fetch_add(1, std::memory_order_relaxed);
+  if (auto p = ::malloc(n))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { ::free(p); }
+
+void operator delete(void *p, size_t) noexcept { ::free(p); }
+
+using namespace myspace;
+
+template <class Submit>
+static void run(const char *name, size_t jobs, Submit submit) {
+  std::atomic<size_t> done{ 0 };
+  auto job = [&done]() { done.fetch_add(1, std::memory_order_relaxed); };
+  auto a0 = allocs.load();
+  auto t0 = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < jobs; ++i)
+    submit(job);
+  while (done.load() < jobs)
+    std::this_thread::yield();
+  auto t1 = std::chrono::steady_clock::now();
+  auto secs = std::chrono::duration<double>(t1 - t0).count();
+  ::printf("%-10s %12.0f jobs/s %8.3f allocs/job\n", name, jobs / secs,
+           (allocs.load() - a0) / (double)jobs);
+}
+
+int main(int argc, char **argv) {
+  size_t jobs = argc > 1 ? ::strtoul(argv[1], nullptr, 10) : 1000000;
+  size_t threads = argc > 2 ? ::strtoul(argv[2], nullptr, 10) : 4;
+
+  for (auto schedule : { ThreadPool::SHARED, ThreadPool::STEALING }) {
+    ::printf("%s, %zu threads, %zu jobs\n",
+             schedule == ThreadPool::SHARED ? "SHARED" : "STEALING", threads,
+             jobs);
+    ThreadPool pool(threads, schedule);
+    // timing costs two clock reads a job, measured apart
+    for (auto timing : { true, false }) {
+      pool.setTiming(timing);
+      ::printf(" timing %s\n", timing ? "on" : "off");
+      run("pushBack", jobs, [&](const auto &f) {
+        pool.pushBack(f);
+      });
+      // the first round warms the job nodes
+      for (int round = 0; round < 2; ++round)
+        run("post", jobs, [&](const auto &f) {
+          pool.post(f);
+        });
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,92 @@
+// datagrams/sec over loopback, one syscall per datagram (send, recvfrom)
+// against one per batch (sendBatch on sendmmsg, recvBatch on recvmmsg).
+// each round queues the datagrams into a large receive buffer, then drains
+// it, so sending and receiving are timed apart
+//
+// build, with this repo reachable as myspace/ under <inc>:
+//   g++ -std=c++14 -O2 -pthread -I<inc> bench/udp_batch.cpp
+// run: ./a.out [bytes=100] [per_round=8000] [rounds=50] [batch=64]
+// SO_RCVBUFFORCE needs CAP_NET_ADMIN, without it net.core.rmem_max caps the
+// buffer and datagrams past it are dropped, lower per_round then
+
+// defer.hpp first, it pulls in exception.hpp and logger.hpp in an order
+// that compiles
+#include "myspace/defer/defer.hpp"
+#include "myspace/net/udp/socket.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace myspace;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double since(Clock::time_point t0) {
+  return std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  size_t bytes = argc > 1 ? ::strtoul(argv[1], nullptr, 10) : 100;
+  size_t per_round = argc > 2 ? ::strtoul(argv[2], nullptr, 10) : 8000;
+  size_t rounds = argc > 3 ? ::strtoul(argv[3], nullptr, 10) : 50;
+  size_t count = argc > 4 ? ::strtoul(argv[4], nullptr, 10) : 64;
+
+  udp::Socket rx((uint16_t)0);
+  int rcvbuf = 32 << 20;
+  if (0 != ::setsockopt(rx, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf,
+                        sizeof(rcvbuf)))
+    ::setsockopt(rx, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  Addr to("127.0.0.1", ntohs(rx.local().addr().sin_port));
+  udp::Socket tx(to);
+
+  std::string data(bytes, 'd');
+  udp::Batch out(count, std::max<size_t>(bytes, 1));
+  udp::Batch in(count);
+
+  double send_secs = 0, batch_send_secs = 0;
+  double recv_secs = 0, batch_recv_secs = 0;
+  size_t received = 0, batch_received = 0;
+  for (size_t round = 0; round < rounds; ++round) {
+    auto t0 = Clock::now();
+    for (size_t i = 0; i < per_round; ++i)
+      tx.send(data);
+    send_secs += since(t0);
+
+    t0 = Clock::now();
+    for (Addr from;; ++received) {
+      if (rx.recvfrom(from, std::chrono::milliseconds(0)).empty())
+        break;
+    }
+    recv_secs += since(t0);
+
+    t0 = Clock::now();
+    for (size_t i = 0; i < per_round;) {
+      out.clear();
+      for (; !out.full() && i < per_round; ++i)
+        out.push(data.data(), data.size());
+      tx.sendBatch(out);
+    }
+    batch_send_secs += since(t0);
+
+    t0 = Clock::now();
+    while (auto n = rx.recvBatch(in, std::chrono::milliseconds(0)))
+      batch_received += n;
+    batch_recv_secs += since(t0);
+  }
+
+  auto sent = (double)(rounds * per_round);
+  ::printf("%zu byte datagrams, %zu rounds of %zu, batch %zu\n", bytes, rounds,
+           per_round, count);
+  ::printf("send       %8.2fM/s   sendBatch  %8.2fM/s\n",
+           sent / send_secs / 1e6, sent / batch_send_secs / 1e6);
+  ::printf("recvfrom   %8.2fM/s   recvBatch  %8.2fM/s\n",
+           received / recv_secs / 1e6, batch_received / batch_recv_secs / 1e6);
+  if (received < sent || batch_received < sent)
+    ::printf("dropped    %8zu            %8zu\n", (size_t)sent - received,
+             (size_t)sent - batch_received);
+  return 0;
+}
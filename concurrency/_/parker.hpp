@@ -0,0 +1,281 @@
+
+#pragma once
+
+#include "myspace/_/stdafx.hpp"
+#include "myspace/mutex/mutex.hpp"
+
+MYSPACE_BEGIN
+
+namespace parkerimpl {
+
+// hint the cpu that we are busy waiting
+inline void relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#elif defined(MYSPACE_WINDOWS)
+  YieldProcessor();
+#endif
+}
+
+// exponential backoff, pause 1, 2, 4 ... times, then give up the time slice
+class Backoff {
+public:
+  enum { SPIN_LIMIT = 6, YIELD_LIMIT = 10 };
+
+  void snooze() {
+    if (step_ <= SPIN_LIMIT) {
+      for (unsigned i = 0; i < (1u << step_); ++i)
+        relax();
+    } else {
+      std::this_thread::yield();
+    }
+    if (step_ <= YIELD_LIMIT)
+      ++step_;
+  }
+
+  bool completed() const { return step_ > YIELD_LIMIT; }
+
+  void reset() { step_ = 0; }
+
+private:
+  unsigned step_ = 0;
+};
+
+// one permit semaphore owned by one thread,
+// unpark before park makes the next park return at once
+class Parker {
+public:
+  Parker() {}
+
+  Parker(const Parker &) = delete;
+  Parker &operator=(const Parker &) = delete;
+
+  // owner only
+  void park();
+
+  // owner only, false on timeout
+  template <class Rep, class Period>
+  bool parkFor(const std::chrono::duration<Rep, Period> &timeout);
+
+  // any thread
+  void unpark();
+
+private:
+  enum { PARKED = -1, EMPTY = 0, NOTIFIED = 1 };
+
+  bool wait(const std::chrono::nanoseconds *timeout);
+
+#if defined(MYSPACE_LINUX)
+  std::atomic<int> state_{ EMPTY };
+#else
+  int state_ = EMPTY;
+  std::mutex mtx_;
+  std::condition_variable cond_;
+#endif
+};
+
+inline void Parker::park() { wait(nullptr); }
+
+template <class Rep, class Period>
+inline bool Parker::parkFor(const std::chrono::duration<Rep, Period> &timeout) {
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout);
+  return wait(&ns);
+}
+
+#if defined(MYSPACE_LINUX)
+
+inline bool Parker::wait(const std::chrono::nanoseconds *timeout) {
+  // NOTIFIED -> EMPTY, consume the permit, or EMPTY -> PARKED
+  if (state_.fetch_sub(1, std::memory_order_acquire) == NOTIFIED)
+    return true;
+  auto deadline = std::chrono::steady_clock::now();
+  if (timeout)
+    deadline += *timeout;
+  for (;;) {
+    timespec ts, *pts = nullptr;
+    if (timeout) {
+      auto left = deadline - std::chrono::steady_clock::now();
+      if (left <= std::chrono::nanoseconds(0))
+        break;
+      auto ns =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+      ts.tv_sec = (time_t)(ns / 1000000000);
+      ts.tv_nsec = (long)(ns % 1000000000);
+      pts = &ts;
+    }
+    ::syscall(SYS_futex, reinterpret_cast<int *>(&state_), FUTEX_WAIT_PRIVATE,
+              (int)PARKED, pts, nullptr, 0);
+    int expected = NOTIFIED;
+    if (state_.compare_exchange_strong(expected, EMPTY,
+                                       std::memory_order_acquire))
+      return true;
+    // spurious wakeup or EINTR
+  }
+  int expected = PARKED;
+  if (state_.compare_exchange_strong(expected, EMPTY,
+                                     std::memory_order_acquire))
+    return false;
+  // unparked right after the timeout
+  state_.store(EMPTY, std::memory_order_relaxed);
+  return true;
+}
+
+inline void Parker::unpark() {
+  if (state_.exchange(NOTIFIED, std::memory_order_release) == PARKED) {
+    ::syscall(SYS_futex, reinterpret_cast<int *>(&state_), FUTEX_WAKE_PRIVATE,
+              1, nullptr, nullptr, 0);
+  }
+}
+
+#else
+
+inline bool Parker::wait(const std::chrono::nanoseconds *timeout) {
+  auto ul = std::unique_lock<std::mutex>(mtx_);
+  auto notified = [this]() { return state_ == NOTIFIED; };
+  bool ret = true;
+  if (timeout)
+    ret = cond_.wait_for(ul, *timeout, notified);
+  else
+    cond_.wait(ul, notified);
+  state_ = EMPTY;
+  return ret;
+}
+
+inline void Parker::unpark() {
+  MYSPACE_IF_LOCK(mtx_) { state_ = NOTIFIED; }
+  cond_.notify_one();
+}
+
+#endif
+
+// lets any number of threads sleep until a condition they poll may have
+// changed. a waiter calls prepare(), checks the condition once more, then
+// wait() or cancel(). a changer makes its change, then calls notify()
+class EventCount {
+public:
+  typedef uint32_t Key;
+
+  EventCount() {}
+
+  EventCount(const EventCount &) = delete;
+  EventCount &operator=(const EventCount &) = delete;
+
+  Key prepare();
+
+  void cancel();
+
+  void wait(Key key);
+
+  // false on timeout
+  template <class Rep, class Period>
+  bool waitFor(Key key, const std::chrono::duration<Rep, Period> &timeout);
+
+  void notifyOne() { notify(false); }
+
+  void notifyAll() { notify(true); }
+
+private:
+  bool wait(Key key, const std::chrono::nanoseconds *timeout);
+
+  void notify(bool all);
+
+  std::atomic<uint32_t> epoch_{ 0 };
+
+  std::atomic<uint32_t> waiters_{ 0 };
+
+#if !defined(MYSPACE_LINUX)
+  std::mutex mtx_;
+  std::condition_variable cond_;
+#endif
+};
+
+inline EventCount::Key EventCount::prepare() {
+  waiters_.fetch_add(1, std::memory_order_seq_cst);
+  // pairs with the fence in notify(), the caller's check that follows
+  // sees the change, or the changer sees us waiting
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  return epoch_.load(std::memory_order_acquire);
+}
+
+inline void EventCount::cancel() {
+  waiters_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+inline void EventCount::wait(Key key) { wait(key, nullptr); }
+
+template <class Rep, class Period>
+inline bool
+EventCount::waitFor(Key key, const std::chrono::duration<Rep, Period> &timeout) {
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout);
+  return wait(key, &ns);
+}
+
+#if defined(MYSPACE_LINUX)
+
+inline bool EventCount::wait(Key key, const std::chrono::nanoseconds *timeout) {
+  auto deadline = std::chrono::steady_clock::now();
+  if (timeout)
+    deadline += *timeout;
+  bool ret = true;
+  while (epoch_.load(std::memory_order_acquire) == key) {
+    timespec ts, *pts = nullptr;
+    if (timeout) {
+      auto left = deadline - std::chrono::steady_clock::now();
+      if (left <= std::chrono::nanoseconds(0)) {
+        ret = false;
+        break;
+      }
+      auto ns =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+      ts.tv_sec = (time_t)(ns / 1000000000);
+      ts.tv_nsec = (long)(ns % 1000000000);
+      pts = &ts;
+    }
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&epoch_),
+              FUTEX_WAIT_PRIVATE, key, pts, nullptr, 0);
+  }
+  waiters_.fetch_sub(1, std::memory_order_relaxed);
+  return ret;
+}
+
+inline void EventCount::notify(bool all) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiters_.load(std::memory_order_relaxed) == 0)
+    return;
+  epoch_.fetch_add(1, std::memory_order_release);
+  ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&epoch_),
+            FUTEX_WAKE_PRIVATE, all ? std::numeric_limits<int>::max() : 1, nullptr, nullptr, 0);
+}
+
+#else
+
+inline bool EventCount::wait(Key key, const std::chrono::nanoseconds *timeout) {
+  auto ul = std::unique_lock<std::mutex>(mtx_);
+  auto changed = [&]() { return epoch_.load() != key; };
+  bool ret = true;
+  if (timeout)
+    ret = cond_.wait_for(ul, *timeout, changed);
+  else
+    cond_.wait(ul, changed);
+  waiters_.fetch_sub(1, std::memory_order_relaxed);
+  return ret;
+}
+
+inline void EventCount::notify(bool all) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiters_.load(std::memory_order_relaxed) == 0)
+    return;
+  MYSPACE_IF_LOCK(mtx_) { epoch_.fetch_add(1); }
+  if (all)
+    cond_.notify_all();
+  else
+    cond_.notify_one();
+}
+
+#endif
+
+} // namespace parkerimpl
+
+MYSPACE_END
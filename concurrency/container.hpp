@@ -13,32 +13,65 @@ public:
 
   void pushFront(const X &x);
 
+  void pushFront(X &&x);
+
+  // pushes and pops taking pred treat it as a stop flag, it is checked
+  // before waiting and after each wakeup, and once it holds they throw
+  // PredicateMeet, even if there is room or an item
   template <class Predicate> void pushFront(const X &x, Predicate pred);
 
+  template <class Predicate> void pushFront(X &&x, Predicate pred);
+
   template <class Rep, class Period>
   void pushFrontFor(
       const X &x,
       const std::chrono::duration<Rep, Period> &timeout) noexcept(false);
 
+  template <class Rep, class Period>
+  void pushFrontFor(
+      X &&x, const std::chrono::duration<Rep, Period> &timeout) noexcept(false);
+
   template <class Rep, class Period, class Predicate>
   void pushFrontFor(const X &x,
                     const std::chrono::duration<Rep, Period> &timeout,
                     Predicate pred) noexcept(false);
 
+  template <class Rep, class Period, class Predicate>
+  void pushFrontFor(X &&x, const std::chrono::duration<Rep, Period> &timeout,
+                    Predicate pred) noexcept(false);
+
   void pushBack(const X &x);
 
+  void pushBack(X &&x);
+
   template <class Predicate> void pushBack(const X &x, Predicate pred);
 
+  template <class Predicate> void pushBack(X &&x, Predicate pred);
+
   template <class Rep, class Period>
   void pushBackFor(
       const X &x,
       const std::chrono::duration<Rep, Period> &timeout) noexcept(false);
 
+  template <class Rep, class Period>
+  void pushBackFor(
+      X &&x, const std::chrono::duration<Rep, Period> &timeout) noexcept(false);
+
   template <class Rep, class Period, class Predicate>
   void pushBackFor(const X &x,
                    const std::chrono::duration<Rep, Period> &timeout,
                    Predicate pred) noexcept(false);
 
+  template <class Rep, class Period, class Predicate>
+  void pushBackFor(X &&x, const std::chrono::duration<Rep, Period> &timeout,
+                   Predicate pred) noexcept(false);
+
+  // construct X from args in place, under the lock
+  template <class... Arguments> void emplaceFront(Arguments &&... args);
+
+  template <class... Arguments> void emplaceBack(Arguments &&... args);
+
+  // the pops move the value out, a std::set can only copy it
   X popFront();
 
   template <class Predicate> X popFront(Predicate pred);
@@ -63,21 +96,29 @@ public:
   X popBackFor(const std::chrono::duration<Rep, Period> &timeout,
                Predicate pred) noexcept(false);
 
+  // everything, in one lock, without waiting, empty if there is nothing
+  Cont<X> popAll();
+
+  // moves everything to out in order, the buffer is swapped out in one lock,
+  // returns how many
+  template <class OutputIterator> size_t drainTo(OutputIterator out);
+
   bool empty();
   size_t size();
   size_t maxSize() const;
 
 private:
-  void push(bool front, const X &);
+  template <class... Arguments> void emplace(bool front, Arguments &&... args);
 
-  template <class Predicate> void push(bool front, const X &x, Predicate pred);
+  template <class Y, class Predicate>
+  void push(bool front, Y &&y, Predicate pred);
 
-  template <class Rep, class Period>
-  void pushFor(bool front, const X &x,
+  template <class Y, class Rep, class Period>
+  void pushFor(bool front, Y &&y,
                const std::chrono::duration<Rep, Period> &timeout);
 
-  template <class Rep, class Period, class Predicate>
-  void pushFor(bool front, const X &x,
+  template <class Y, class Rep, class Period, class Predicate>
+  void pushFor(bool front, Y &&y,
                const std::chrono::duration<Rep, Period> &timeout,
                Predicate pred);
 
@@ -92,6 +133,8 @@ private:
   X popFor(bool front, const std::chrono::duration<Rep, Period> &timeout,
            Predicate pred);
 
+  bool full() const;
+
 private:
   Container(size_t max_size);
   size_t max_size_ = 0;
@@ -104,36 +147,149 @@ private:
 
 namespace contimpl {
 template <class X, template <class...> class C> X pop(bool front, C<X> &c) {
-  MYSPACE_DEFER(if (front) c.pop_front(); else c.pop_back(););
-  return (front ? c.front() : c.back());
+  X x(std::move(front ? c.front() : c.back()));
+  if (front)
+    c.pop_front();
+  else
+    c.pop_back();
+  return x;
 }
+// set elements are const, copy
 template <class X> X pop(bool front, std::set<X> &c) {
-  MYSPACE_DEFER(if (front) c.erase(c.begin());
-                else c.erase(std::prev(c.end())););
-  return (front ? *c.begin() : *c.rbegin());
+  auto itr = front ? c.begin() : std::prev(c.end());
+  X x(*itr);
+  c.erase(itr);
+  return x;
 }
-template <class X, template <class...> class C>
-void push(bool front, C<X> &c, const X &x) {
+template <class X, template <class...> class C, class... Arguments>
+void emplace(bool front, C<X> &c, Arguments &&... args) {
   if (front)
-    c.push_front(x);
+    c.emplace_front(std::forward<Arguments>(args)...);
   else
-    c.push_back(x);
+    c.emplace_back(std::forward<Arguments>(args)...);
 }
-template <class X> void push(bool front, std::set<X> &c, const X &x) {
-  c.insert(x);
+template <class X, class... Arguments>
+void emplace(bool front, std::set<X> &c, Arguments &&... args) {
+  c.emplace(std::forward<Arguments>(args)...);
 }
 } // namespace contimpl
 
+template <class X, template <class...> class Cont>
+inline void Container<X, Cont>::pushFront(const X &x) {
+  emplace(true, x);
+}
+
+template <class X, template <class...> class Cont>
+inline void Container<X, Cont>::pushFront(X &&x) {
+  emplace(true, std::move(x));
+}
+
 template <class X, template <class...> class Cont>
 template <class Predicate>
 inline void Container<X, Cont>::pushFront(const X &x, Predicate pred) {
   push(true, x, pred);
 }
 
+template <class X, template <class...> class Cont>
+template <class Predicate>
+inline void Container<X, Cont>::pushFront(X &&x, Predicate pred) {
+  push(true, std::move(x), pred);
+}
+
+template <class X, template <class...> class Cont>
+template <class Rep, class Period>
+inline void Container<X, Cont>::pushFrontFor(
+    const X &x,
+    const std::chrono::duration<Rep, Period> &timeout) noexcept(false) {
+  pushFor(true, x, timeout);
+}
+
+template <class X, template <class...> class Cont>
+template <class Rep, class Period>
+inline void Container<X, Cont>::pushFrontFor(
+    X &&x, const std::chrono::duration<Rep, Period> &timeout) noexcept(false) {
+  pushFor(true, std::move(x), timeout);
+}
+
+template <class X, template <class...> class Cont>
+template <class Rep, class Period, class Predicate>
+inline void Container<X, Cont>::pushFrontFor(
+    const X &x, const std::chrono::duration<Rep, Period> &timeout,
+    Predicate pred) noexcept(false) {
+  pushFor(true, x, timeout, pred);
+}
+
+template <class X, template <class...> class Cont>
+template <class Rep, class Period, class Predicate>
+inline void Container<X, Cont>::pushFrontFor(
+    X &&x, const std::chrono::duration<Rep, Period> &timeout,
+    Predicate pred) noexcept(false) {
+  pushFor(true, std::move(x), timeout, pred);
+}
+
+template <class X, template <class...> class Cont>
+inline void Container<X, Cont>::pushBack(const X &x) {
+  emplace(false, x);
+}
+
+template <class X, template <class...> class Cont>
+inline void Container<X, Cont>::pushBack(X &&x) {
+  emplace(false, std::move(x));
+}
+
 template <class X, template <class...> class Cont>
 template <class Predicate>
 inline void Container<X, Cont>::pushBack(const X &x, Predicate pred) {
-  pop(false, x, pred);
+  push(false, x, pred);
+}
+
+template <class X, template <class...> class Cont>
+template <class Predicate>
+inline void Container<X, Cont>::pushBack(X &&x, Predicate pred) {
+  push(false, std::move(x), pred);
+}
+
+template <class X, template <class...> class Cont>
+template <class Rep, class Period>
+inline void Container<X, Cont>::pushBackFor(
+    const X &x,
+    const std::chrono::duration<Rep, Period> &timeout) noexcept(false) {
+  pushFor(false, x, timeout);
+}
+
+template <class X, template <class...> class Cont>
+template <class Rep, class Period>
+inline void Container<X, Cont>::pushBackFor(
+    X &&x, const std::chrono::duration<Rep, Period> &timeout) noexcept(false) {
+  pushFor(false, std::move(x), timeout);
+}
+
+template <class X, template <class...> class Cont>
+template <class Rep, class Period, class Predicate>
+inline void Container<X, Cont>::pushBackFor(
+    const X &x, const std::chrono::duration<Rep, Period> &timeout,
+    Predicate pred) noexcept(false) {
+  pushFor(false, x, timeout, pred);
+}
+
+template <class X, template <class...> class Cont>
+template <class Rep, class Period, class Predicate>
+inline void Container<X, Cont>::pushBackFor(
+    X &&x, const std::chrono::duration<Rep, Period> &timeout,
+    Predicate pred) noexcept(false) {
+  pushFor(false, std::move(x), timeout, pred);
+}
+
+template <class X, template <class...> class Cont>
+template <class... Arguments>
+inline void Container<X, Cont>::emplaceFront(Arguments &&... args) {
+  emplace(true, std::forward<Arguments>(args)...);
+}
+
+template <class X, template <class...> class Cont>
+template <class... Arguments>
+inline void Container<X, Cont>::emplaceBack(Arguments &&... args) {
+  emplace(false, std::forward<Arguments>(args)...);
 }
 
 template <class X, template <class...> class Cont>
@@ -189,126 +345,89 @@ inline X Container<X, Cont>::popBackFor(
 }
 
 template <class X, template <class...> class Cont>
-inline void Container<X, Cont>::pushFront(const X &x) {
-  push(true, x);
-}
-
-template <class X, template <class...> class Cont>
-template <class Rep, class Period>
-inline void Container<X, Cont>::pushFrontFor(
-    const X &x,
-    const std::chrono::duration<Rep, Period> &timeout) noexcept(false) {
-  pushFor(true, x, timeout);
-}
-
-template <class X, template <class...> class Cont>
-template <class Rep, class Period, class Predicate>
-inline void Container<X, Cont>::pushFrontFor(
-    const X &x, const std::chrono::duration<Rep, Period> &timeout,
-    Predicate pred) noexcept(false) {
-  pushFor(true, x, timeout, pred);
+inline Cont<X> Container<X, Cont>::popAll() {
+  Cont<X> ret;
+  {
+    auto ul = std::unique_lock<std::recursive_mutex>(mtx_);
+    if (cont_.empty())
+      return ret;
+    ret.swap(cont_);
+  }
+  cond_.notify_all();
+  return ret;
 }
 
 template <class X, template <class...> class Cont>
-inline void Container<X, Cont>::pushBack(const X &x) {
-  push(false, x);
+template <class OutputIterator>
+inline size_t Container<X, Cont>::drainTo(OutputIterator out) {
+  auto all = popAll();
+  std::move(all.begin(), all.end(), out);
+  return all.size();
 }
 
 template <class X, template <class...> class Cont>
-template <class Rep, class Period>
-inline void Container<X, Cont>::pushBackFor(
-    const X &x,
-    const std::chrono::duration<Rep, Period> &timeout) noexcept(false) {
-  pushFor(false, x, timeout);
-}
+inline Container<X, Cont>::Container(size_t max_size)
+    : max_size_(max_size) {}
 
 template <class X, template <class...> class Cont>
-template <class Rep, class Period, class Predicate>
-inline void Container<X, Cont>::pushBackFor(
-    const X &x, const std::chrono::duration<Rep, Period> &timeout,
-    Predicate pred) noexcept(false) {
-  push(false, x, timeout, pred);
+inline bool Container<X, Cont>::full() const {
+  return cont_.size() >= maxSize();
 }
 
 template <class X, template <class...> class Cont>
-inline Container<X, Cont>::Container(size_t max_size)
-    : max_size_(max_size) {}
-
-template <class X, template <class...> class Cont>
-inline void Container<X, Cont>::push(bool front, const X &x) {
-  for (auto ul = std::unique_lock<std::recursive_mutex>(mtx_);;) {
-    if (cont_.size() < maxSize()) {
-      contimpl::push(front, cont_, x);
-      break;
-    } else {
-      cond_.wait(ul, [&]() { return cont_.size() < maxSize(); });
-    }
+template <class... Arguments>
+inline void Container<X, Cont>::emplace(bool front, Arguments &&... args) {
+  {
+    auto ul = std::unique_lock<std::recursive_mutex>(mtx_);
+    cond_.wait(ul, [&]() { return !full(); });
+    contimpl::emplace(front, cont_, std::forward<Arguments>(args)...);
   }
   cond_.notify_one();
 }
 
 template <class X, template <class...> class Cont>
-template <class Predicate>
-inline void Container<X, Cont>::push(bool front, const X &x, Predicate pred) {
-  for (auto ul = std::unique_lock<std::recursive_mutex>(mtx_); !pred();) {
-    if (cont_.size() < maxSize()) {
-      MYSPACE_DEFER(cond_.notify_one());
-      if (front)
-        cont_.push_front(x);
-      else
-        cont_.push_back(x);
-      return;
-    } else {
-      cond_.wait(ul, [&]() { return cont_.size() < maxSize() || pred(); });
-    }
+template <class Y, class Predicate>
+inline void Container<X, Cont>::push(bool front, Y &&y, Predicate pred) {
+  {
+    auto ul = std::unique_lock<std::recursive_mutex>(mtx_);
+    bool met = false;
+    cond_.wait(ul, [&]() { return (met = pred()) || !full(); });
+    MYSPACE_THROW_IF_EX(PredicateMeet, met);
+    contimpl::emplace(front, cont_, std::forward<Y>(y));
   }
-  MYSPACE_THROW_EX(PredicateMeet);
+  cond_.notify_one();
 }
 
 template <class X, template <class...> class Cont>
-template <class Rep, class Period>
-void
-Container<X, Cont>::pushFor(bool front, const X &x,
+template <class Y, class Rep, class Period>
+inline void
+Container<X, Cont>::pushFor(bool front, Y &&y,
                             const std::chrono::duration<Rep, Period> &timeout) {
-  auto begin_time = std::chrono::high_resolution_clock::now();
-  for (auto ul = std::unique_lock<std::recursive_mutex>(mtx_);;) {
-    if (cont_.size() < maxSize()) {
-      if (front)
-        cont_.push_front(x);
-      else
-        cont_.push_back(x);
-      ul.unlock();
-      break;
-    } else {
-      auto now = std::chrono::high_resolution_clock::now();
-      MYSPACE_THROW_IF_EX(concurrency::TimeOut, now - begin_time > timeout);
-      cond_.wait_for(ul, now - begin_time,
-                     [&]() { return cont_.size() < maxSize(); });
-    }
+  {
+    auto ul = std::unique_lock<std::recursive_mutex>(mtx_);
+    MYSPACE_THROW_IF_EX(concurrency::TimeOut,
+                        !cond_.wait_for(ul, timeout,
+                                        [&]() { return !full(); }));
+    contimpl::emplace(front, cont_, std::forward<Y>(y));
   }
   cond_.notify_one();
 }
+
 template <class X, template <class...> class Cont>
-template <class Rep, class Period, class Predicate>
-void
-Container<X, Cont>::pushFor(bool front, const X &x,
+template <class Y, class Rep, class Period, class Predicate>
+inline void
+Container<X, Cont>::pushFor(bool front, Y &&y,
                             const std::chrono::duration<Rep, Period> &timeout,
                             Predicate pred) {
-  auto begin_time = std::chrono::high_resolution_clock::now();
-  for (auto ul = std::unique_lock<std::recursive_mutex>(mtx_); !pred();) {
-    if (cont_.size() < maxSize()) {
-      if (front)
-        cont_.push_front(x);
-      else
-        cont_.push_back(x);
-      ul.unlock();
-      break;
-    } else {
-      auto now = std::chrono::high_resolution_clock::now();
-      MYSPACE_THROW_IF_EX(concurrency::TimeOut, now - begin_time > timeout);
-      cond_.wait_for(ul, now - begin_time,
-                     [&]() { return cont_.size() < maxSize() || pred(); });
-    }
+  {
+    auto ul = std::unique_lock<std::recursive_mutex>(mtx_);
+    bool met = false;
+    MYSPACE_THROW_IF_EX(concurrency::TimeOut,
+                        !cond_.wait_for(ul, timeout, [&]() {
+                          return (met = pred()) || !full();
+                        }));
+    MYSPACE_THROW_IF_EX(PredicateMeet, met);
+    contimpl::emplace(front, cont_, std::forward<Y>(y));
   }
   cond_.notify_one();
 }
@@ -316,32 +435,22 @@ Container<X, Cont>::pushFor(bool front, const X &x,
 template <class X, template <class...> class Cont>
 inline X Container<X, Cont>::pop(bool front) {
   MYSPACE_DEFER(cond_.notify_one());
-  for (auto ul = std::unique_lock<std::recursive_mutex>(mtx_);;) {
-    if (!cont_.empty()) {
-      MYSPACE_DEFER(if (front) cont_.pop_front(); else cont_.pop_back(););
-      return (front ? cont_.front() : cont_.back());
-    } else {
-      cond_.wait_for(ul, [&]() { return !cont_.empty(); });
-    }
-  }
-  throw; // not reached
+  auto ul = std::unique_lock<std::recursive_mutex>(mtx_);
+  cond_.wait(ul, [&]() { return !cont_.empty(); });
+  return contimpl::pop(front, cont_);
 }
 
 template <class X, template <class...> class Cont>
 template <class Predicate>
 inline X Container<X, Cont>::pop(bool front, Predicate pred) {
   MYSPACE_DEFER(cond_.notify_one());
-  for (auto ul = std::unique_lock<std::recursive_mutex>(mtx_); !pred();) {
-    if (!cont_.empty()) {
-      MYSPACE_DEFER(if (front) cont_.pop_front(); else cont_.pop_back(););
-      return (front ? cont_.front() : cont_.back());
-    } else {
-      cond_.wait(ul, [&]() { return !cont_.empty() || pred(); });
-    }
-  }
-  MYSPACE_THROW_EX(PredicateMeet);
-  throw; // not reached
+  auto ul = std::unique_lock<std::recursive_mutex>(mtx_);
+  bool met = false;
+  cond_.wait(ul, [&]() { return (met = pred()) || !cont_.empty(); });
+  MYSPACE_THROW_IF_EX(PredicateMeet, met);
+  return contimpl::pop(front, cont_);
 }
+
 template <class X, template <class...> class Cont>
 inline void Container<X, Cont>::notifyAll() {
   cond_.notify_all();
@@ -356,41 +465,29 @@ template <class Rep, class Period>
 inline X
 Container<X, Cont>::popFor(bool front,
                            const std::chrono::duration<Rep, Period> &timeout) {
-  auto begin_time = std::chrono::high_resolution_clock::now();
-  for (auto ul = std::unique_lock<std::recursive_mutex>(mtx_);;) {
-    if (!cont_.empty()) {
-      MYSPACE_DEFER(cond_.notify_one());
-      return contimpl::pop(front, cont_);
-    } else {
-      auto now = std::chrono::high_resolution_clock::now();
-      MYSPACE_THROW_IF_EX(concurrency::TimeOut, now - begin_time > timeout);
-      cond_.wait_for(ul, now - begin_time, [&]() { return !cont_.empty(); });
-    }
-  }
-  MYSPACE_THROW_EX(concurrency::TimeOut);
-  throw;
+  MYSPACE_DEFER(cond_.notify_one());
+  auto ul = std::unique_lock<std::recursive_mutex>(mtx_);
+  MYSPACE_THROW_IF_EX(
+      concurrency::TimeOut,
+      !cond_.wait_for(ul, timeout, [&]() { return !cont_.empty(); }));
+  return contimpl::pop(front, cont_);
 }
+
 template <class X, template <class...> class Cont>
 template <class Rep, class Period, class Predicate>
 inline X
 Container<X, Cont>::popFor(bool front,
                            const std::chrono::duration<Rep, Period> &timeout,
                            Predicate pred) {
-  auto begin_time = std::chrono::high_resolution_clock::now();
-  for (auto ul = std::unique_lock<std::recursive_mutex>(mtx_); !pred();) {
-    if (!cont_.empty()) {
-      MYSPACE_DEFER(cond_.notify_one());
-      MYSPACE_DEFER(if (front) cont_.pop_front(); else cont_.pop_back(););
-      return (front ? cont_.front() : cont_.back());
-    } else {
-      auto now = std::chrono::high_resolution_clock::now();
-      MYSPACE_THROW_IF_EX(concurrency::TimeOut, now - begin_time > timeout);
-      cond_.wait_for(ul, now - begin_time,
-                     [&]() { return !cont_.empty() || pred(); });
-    }
-  }
-  MYSPACE_THROW_EX(concurrency::TimeOut);
-  throw;
+  MYSPACE_DEFER(cond_.notify_one());
+  auto ul = std::unique_lock<std::recursive_mutex>(mtx_);
+  bool met = false;
+  MYSPACE_THROW_IF_EX(concurrency::TimeOut,
+                      !cond_.wait_for(ul, timeout, [&]() {
+                        return (met = pred()) || !cont_.empty();
+                      }));
+  MYSPACE_THROW_IF_EX(PredicateMeet, met);
+  return contimpl::pop(front, cont_);
 }
 
 template <class X, template <class...> class Cont>
@@ -7,6 +7,7 @@ MYSPACE_EXCEPTION_DEFINE(ConcurrencyError, myspace::Exception)
 MYSPACE_EXCEPTION_DEFINE(ContainerDestroyed, ConcurrencyError)
 MYSPACE_EXCEPTION_DEFINE(TimeOut, ConcurrencyError)
 MYSPACE_EXCEPTION_DEFINE(PredicateMeet, ConcurrencyError)
+MYSPACE_EXCEPTION_DEFINE(Closed, ConcurrencyError)
 
 class Factory;
 } // namespace concurrency
@@ -2,7 +2,10 @@
 
 #include "myspace/_/stdafx.hpp"
 #include "myspace/concurrency/deque.hpp"
+#include "myspace/concurrency/mpsc.hpp"
+#include "myspace/concurrency/ring.hpp"
 #include "myspace/concurrency/set.hpp"
+#include "myspace/concurrency/spsc.hpp"
 
 MYSPACE_BEGIN
 
@@ -16,6 +19,22 @@ public:
   template <class X>
   static std::shared_ptr<myspace::concurrency::Set<X> >
   createSet(size_t max_size = std::set<X>().max_size());
+
+  // capacity is rounded up to a power of two
+  template <class X>
+  static std::shared_ptr<myspace::concurrency::Ring<X> >
+  createRing(size_t capacity);
+
+  // one producer thread, one consumer thread,
+  // capacity is rounded up to a power of two
+  template <class X>
+  static std::shared_ptr<myspace::concurrency::SpscRing<X> >
+  createSpscRing(size_t capacity);
+
+  // any producer threads, one consumer thread, X derives from MpscNode
+  template <class X>
+  static std::shared_ptr<myspace::concurrency::MpscQueue<X> >
+  createMpscQueue();
 };
 
 template <class X>
@@ -31,6 +50,27 @@ Factory::createSet(size_t max_size) {
   return std::shared_ptr<concurrency::Set<X> >(
       new concurrency::Set<X>(max_size));
 }
+
+template <class X>
+inline std::shared_ptr<myspace::concurrency::Ring<X> >
+Factory::createRing(size_t capacity) {
+  return std::shared_ptr<concurrency::Ring<X> >(
+      new concurrency::Ring<X>(capacity));
+}
+
+template <class X>
+inline std::shared_ptr<myspace::concurrency::SpscRing<X> >
+Factory::createSpscRing(size_t capacity) {
+  return std::shared_ptr<concurrency::SpscRing<X> >(
+      new concurrency::SpscRing<X>(capacity));
+}
+
+template <class X>
+inline std::shared_ptr<myspace::concurrency::MpscQueue<X> >
+Factory::createMpscQueue() {
+  return std::shared_ptr<concurrency::MpscQueue<X> >(
+      new concurrency::MpscQueue<X>());
+}
 } // namespace concurrency
 
 MYSPACE_END
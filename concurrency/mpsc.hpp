@@ -0,0 +1,241 @@
+#pragma once
+#include "myspace/_/stdafx.hpp"
+#include "myspace/concurrency/_/parker.hpp"
+#include "myspace/concurrency/exception.hpp"
+MYSPACE_BEGIN
+
+namespace concurrency {
+
+// hook for MpscQueue, derive the queued type from it
+class MpscNode {
+public:
+  MpscNode() {}
+
+  MpscNode(const MpscNode &) {}
+
+  MpscNode &operator=(const MpscNode &) { return *this; }
+
+private:
+  std::atomic<MpscNode *> next_{ nullptr };
+
+  template <class X> friend class MpscQueue;
+};
+
+// unbounded intrusive fifo for any number of producer threads and exactly
+// one consumer thread (Dmitry Vyukov's). X derives from MpscNode, the queue
+// only links nodes, it never copies, allocates or frees them, and a node
+// sits in at most one queue at a time.
+// a push is one atomic exchange, a blocked pop spins a little, then sleeps.
+// after close() every push throws Closed, pops drain what is left,
+// then the blocking ones throw Closed
+template <class X> class MpscQueue {
+public:
+  MpscQueue(const MpscQueue &) = delete;
+  MpscQueue &operator=(const MpscQueue &) = delete;
+
+  // producer side
+
+  void pushBack(X *x);
+
+  // links xs[0, n) in order and publishes them at once
+  void pushN(X *const *xs, size_t n);
+
+  // consumer side
+
+  X *popFront();
+
+  template <class Rep, class Period>
+  X *popFrontFor(const std::chrono::duration<Rep, Period> &timeout) noexcept(
+      false);
+
+  // nullptr if empty, or if a producer is half way through a push
+  X *tryPopFront();
+
+  // waits for at least one, then takes up to max, returns how many
+  size_t popN(X **out, size_t max);
+
+  size_t tryPopN(X **out, size_t max);
+
+  // either side
+
+  void close();
+
+  bool closed() const;
+
+  // consumer only
+  bool empty() const;
+
+private:
+  MpscQueue();
+
+  // links first .. last after head_
+  void publish(MpscNode *first, MpscNode *last);
+
+  // nullptr if it had to wait, or if closed and drained
+  template <class Rep, class Period>
+  X *wait(const std::chrono::duration<Rep, Period> *timeout);
+
+  char pad0_[64];
+  // last pushed, producers swap themselves in here
+  std::atomic<MpscNode *> head_;
+  char pad1_[64];
+  // next to pop, consumer only
+  MpscNode *tail_;
+  char pad2_[64];
+
+  // keeps the list non empty
+  MpscNode stub_;
+
+  std::atomic<bool> closed_{ false };
+
+  parkerimpl::EventCount not_empty_;
+
+  friend class concurrency::Factory;
+};
+
+template <class X>
+inline MpscQueue<X>::MpscQueue() : head_(&stub_), tail_(&stub_) {
+  static_assert(std::is_base_of<MpscNode, X>::value,
+                "X must derive from concurrency::MpscNode");
+}
+
+template <class X>
+inline void MpscQueue<X>::publish(MpscNode *first, MpscNode *last) {
+  last->next_.store(nullptr, std::memory_order_relaxed);
+  auto prev = head_.exchange(last, std::memory_order_acq_rel);
+  // consumers see nothing past prev until this store
+  prev->next_.store(first, std::memory_order_release);
+}
+
+template <class X> inline void MpscQueue<X>::pushBack(X *x) {
+  MYSPACE_THROW_IF_EX(concurrency::Closed, closed());
+  publish(x, x);
+  not_empty_.notifyOne();
+}
+
+template <class X> inline void MpscQueue<X>::pushN(X *const *xs, size_t n) {
+  MYSPACE_THROW_IF_EX(concurrency::Closed, closed());
+  if (n == 0)
+    return;
+  for (size_t i = 0; i + 1 < n; ++i)
+    static_cast<MpscNode *>(xs[i])->next_.store(xs[i + 1],
+                                                std::memory_order_relaxed);
+  publish(xs[0], xs[n - 1]);
+  not_empty_.notifyOne();
+}
+
+template <class X> inline X *MpscQueue<X>::tryPopFront() {
+  auto tail = tail_;
+  auto next = tail->next_.load(std::memory_order_acquire);
+  if (tail == &stub_) {
+    if (!next)
+      return nullptr;
+    tail_ = tail = next;
+    next = next->next_.load(std::memory_order_acquire);
+  }
+  if (next) {
+    tail_ = next;
+    return static_cast<X *>(tail);
+  }
+  if (tail != head_.load(std::memory_order_acquire))
+    return nullptr;
+  // tail is the last one, put the stub behind it so it can leave
+  publish(&stub_, &stub_);
+  next = tail->next_.load(std::memory_order_acquire);
+  if (next) {
+    tail_ = next;
+    return static_cast<X *>(tail);
+  }
+  return nullptr;
+}
+
+template <class X> inline size_t MpscQueue<X>::tryPopN(X **out, size_t max) {
+  size_t n = 0;
+  while (n < max) {
+    auto x = tryPopFront();
+    if (!x)
+      break;
+    out[n++] = x;
+  }
+  return n;
+}
+
+template <class X>
+template <class Rep, class Period>
+inline X *
+MpscQueue<X>::wait(const std::chrono::duration<Rep, Period> *timeout) {
+  auto deadline = std::chrono::steady_clock::now();
+  if (timeout)
+    deadline += *timeout;
+  for (parkerimpl::Backoff backoff;;) {
+    if (auto x = tryPopFront())
+      return x;
+    if (!empty()) {
+      // a push caught half way is done in a moment, don't sleep on it
+      parkerimpl::relax();
+      continue;
+    }
+    if (closed())
+      return nullptr;
+    auto now = std::chrono::steady_clock::now();
+    if (timeout && now >= deadline)
+      return nullptr;
+    if (!backoff.completed()) {
+      backoff.snooze();
+      continue;
+    }
+    auto key = not_empty_.prepare();
+    if (auto x = tryPopFront()) {
+      not_empty_.cancel();
+      return x;
+    }
+    if (!empty() || closed()) {
+      not_empty_.cancel();
+      continue;
+    }
+    if (timeout)
+      not_empty_.waitFor(key, deadline - now);
+    else
+      not_empty_.wait(key);
+  }
+}
+
+template <class X> inline X *MpscQueue<X>::popFront() {
+  auto x = wait<int64_t, std::nano>(nullptr);
+  MYSPACE_THROW_IF_EX(concurrency::Closed, !x);
+  return x;
+}
+
+template <class X>
+template <class Rep, class Period>
+inline X *MpscQueue<X>::popFrontFor(
+    const std::chrono::duration<Rep, Period> &timeout) noexcept(false) {
+  auto x = wait(&timeout);
+  MYSPACE_THROW_IF_EX(concurrency::Closed, !x && closed());
+  MYSPACE_THROW_IF_EX(concurrency::TimeOut, !x);
+  return x;
+}
+
+template <class X> inline size_t MpscQueue<X>::popN(X **out, size_t max) {
+  if (max == 0)
+    return 0;
+  out[0] = popFront();
+  return 1 + tryPopN(out + 1, max - 1);
+}
+
+template <class X> inline void MpscQueue<X>::close() {
+  closed_.store(true);
+  not_empty_.notifyAll();
+}
+
+template <class X> inline bool MpscQueue<X>::closed() const {
+  return closed_.load(std::memory_order_acquire);
+}
+
+template <class X> inline bool MpscQueue<X>::empty() const {
+  // every node popped, the stub alone is left
+  return tail_ == &stub_ && head_.load(std::memory_order_acquire) == &stub_;
+}
+} // namespace concurrency
+
+MYSPACE_END
@@ -0,0 +1,278 @@
+#pragma once
+#include "myspace/_/stdafx.hpp"
+#include "myspace/concurrency/_/parker.hpp"
+#include "myspace/concurrency/exception.hpp"
+MYSPACE_BEGIN
+
+namespace concurrency {
+
+// bounded lock free multi producer multi consumer fifo (Dmitry Vyukov's),
+// capacity is rounded up to a power of two.
+// a blocked call spins a little, then sleeps until the other side moves
+template <class X> class Ring {
+public:
+  Ring(const Ring &) = delete;
+  Ring &operator=(const Ring &) = delete;
+
+  ~Ring();
+
+  void pushBack(const X &x);
+
+  void pushBack(X &&x);
+
+  template <class Rep, class Period>
+  void pushBackFor(
+      const X &x,
+      const std::chrono::duration<Rep, Period> &timeout) noexcept(false);
+
+  template <class Rep, class Period>
+  void pushBackFor(
+      X &&x, const std::chrono::duration<Rep, Period> &timeout) noexcept(false);
+
+  // false if full, x is left untouched
+  bool tryPushBack(const X &x);
+
+  bool tryPushBack(X &&x);
+
+  X popFront();
+
+  template <class Rep, class Period>
+  X popFrontFor(const std::chrono::duration<Rep, Period> &timeout) noexcept(
+      false);
+
+  // false if empty
+  bool tryPopFront(X &x);
+
+  bool empty() const;
+
+  // may be off while others push or pop
+  size_t size() const;
+
+  size_t maxSize() const;
+
+private:
+  Ring(size_t capacity);
+
+  template <class Y> bool tryPush(Y &&y);
+
+  template <class Y> void push(Y &&y);
+
+  template <class Y, class Rep, class Period>
+  void pushFor(Y &&y, const std::chrono::duration<Rep, Period> &timeout);
+
+  struct Cell {
+    // pos when free for the push at pos, pos + 1 when the value is ready
+    // for the pop at pos
+    std::atomic<size_t> seq_;
+    typename std::aligned_storage<sizeof(X), alignof(X)>::type storage_;
+  };
+
+  char pad0_[64];
+  // next push
+  std::atomic<size_t> tail_{ 0 };
+  char pad1_[64];
+  // next pop
+  std::atomic<size_t> head_{ 0 };
+  char pad2_[64];
+
+  size_t mask_;
+
+  std::unique_ptr<Cell[]> cells_;
+
+  parkerimpl::EventCount not_full_;
+
+  parkerimpl::EventCount not_empty_;
+
+  friend class concurrency::Factory;
+};
+
+template <class X> inline Ring<X>::Ring(size_t capacity) {
+  size_t n = 2;
+  while (n < capacity)
+    n <<= 1;
+  mask_ = n - 1;
+  cells_.reset(new Cell[n]);
+  for (size_t i = 0; i < n; ++i)
+    cells_[i].seq_.store(i, std::memory_order_relaxed);
+}
+
+template <class X> inline Ring<X>::~Ring() {
+  X x;
+  while (tryPopFront(x))
+    ;
+}
+
+template <class X>
+template <class Y>
+inline bool Ring<X>::tryPush(Y &&y) {
+  auto pos = tail_.load(std::memory_order_relaxed);
+  for (;;) {
+    auto &cell = cells_[pos & mask_];
+    auto seq = cell.seq_.load(std::memory_order_acquire);
+    auto diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0) {
+      if (tail_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        new (&cell.storage_) X(std::forward<Y>(y));
+        cell.seq_.store(pos + 1, std::memory_order_release);
+        not_empty_.notifyOne();
+        return true;
+      }
+    } else if (diff < 0) {
+      // the cell still holds the value of the last round
+      return false;
+    } else {
+      pos = tail_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+template <class X> inline bool Ring<X>::tryPopFront(X &x) {
+  auto pos = head_.load(std::memory_order_relaxed);
+  for (;;) {
+    auto &cell = cells_[pos & mask_];
+    auto seq = cell.seq_.load(std::memory_order_acquire);
+    auto diff = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (diff == 0) {
+      if (head_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        auto value = reinterpret_cast<X *>(&cell.storage_);
+        x = std::move(*value);
+        value->~X();
+        cell.seq_.store(pos + mask_ + 1, std::memory_order_release);
+        not_full_.notifyOne();
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = head_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+template <class X>
+template <class Y>
+inline void Ring<X>::push(Y &&y) {
+  for (parkerimpl::Backoff backoff;;) {
+    if (tryPush(std::forward<Y>(y)))
+      return;
+    if (!backoff.completed()) {
+      backoff.snooze();
+      continue;
+    }
+    auto key = not_full_.prepare();
+    if (tryPush(std::forward<Y>(y))) {
+      not_full_.cancel();
+      return;
+    }
+    not_full_.wait(key);
+  }
+}
+
+template <class X>
+template <class Y, class Rep, class Period>
+inline void
+Ring<X>::pushFor(Y &&y, const std::chrono::duration<Rep, Period> &timeout) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  for (parkerimpl::Backoff backoff;;) {
+    if (tryPush(std::forward<Y>(y)))
+      return;
+    auto now = std::chrono::steady_clock::now();
+    MYSPACE_THROW_IF_EX(concurrency::TimeOut, now >= deadline);
+    if (!backoff.completed()) {
+      backoff.snooze();
+      continue;
+    }
+    auto key = not_full_.prepare();
+    if (tryPush(std::forward<Y>(y))) {
+      not_full_.cancel();
+      return;
+    }
+    not_full_.waitFor(key, deadline - now);
+  }
+}
+
+template <class X> inline void Ring<X>::pushBack(const X &x) { push(x); }
+
+template <class X> inline void Ring<X>::pushBack(X &&x) { push(std::move(x)); }
+
+template <class X>
+template <class Rep, class Period>
+inline void Ring<X>::pushBackFor(
+    const X &x,
+    const std::chrono::duration<Rep, Period> &timeout) noexcept(false) {
+  pushFor(x, timeout);
+}
+
+template <class X>
+template <class Rep, class Period>
+inline void Ring<X>::pushBackFor(
+    X &&x, const std::chrono::duration<Rep, Period> &timeout) noexcept(false) {
+  pushFor(std::move(x), timeout);
+}
+
+template <class X> inline bool Ring<X>::tryPushBack(const X &x) {
+  return tryPush(x);
+}
+
+template <class X> inline bool Ring<X>::tryPushBack(X &&x) {
+  return tryPush(std::move(x));
+}
+
+template <class X> inline X Ring<X>::popFront() {
+  X x;
+  for (parkerimpl::Backoff backoff;;) {
+    if (tryPopFront(x))
+      return x;
+    if (!backoff.completed()) {
+      backoff.snooze();
+      continue;
+    }
+    auto key = not_empty_.prepare();
+    if (tryPopFront(x)) {
+      not_empty_.cancel();
+      return x;
+    }
+    not_empty_.wait(key);
+  }
+}
+
+template <class X>
+template <class Rep, class Period>
+inline X Ring<X>::popFrontFor(
+    const std::chrono::duration<Rep, Period> &timeout) noexcept(false) {
+  X x;
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  for (parkerimpl::Backoff backoff;;) {
+    if (tryPopFront(x))
+      return x;
+    auto now = std::chrono::steady_clock::now();
+    MYSPACE_THROW_IF_EX(concurrency::TimeOut, now >= deadline);
+    if (!backoff.completed()) {
+      backoff.snooze();
+      continue;
+    }
+    auto key = not_empty_.prepare();
+    if (tryPopFront(x)) {
+      not_empty_.cancel();
+      return x;
+    }
+    not_empty_.waitFor(key, deadline - now);
+  }
+}
+
+template <class X> inline bool Ring<X>::empty() const { return size() == 0; }
+
+template <class X> inline size_t Ring<X>::size() const {
+  auto head = head_.load(std::memory_order_acquire);
+  auto tail = tail_.load(std::memory_order_acquire);
+  return tail > head ? std::min(tail - head, maxSize()) : 0;
+}
+
+template <class X> inline size_t Ring<X>::maxSize() const {
+  return mask_ + 1;
+}
+} // namespace concurrency
+
+MYSPACE_END
@@ -0,0 +1,327 @@
+#pragma once
+#include "myspace/_/stdafx.hpp"
+#include "myspace/concurrency/_/parker.hpp"
+#include "myspace/concurrency/exception.hpp"
+MYSPACE_BEGIN
+
+namespace concurrency {
+
+// bounded fifo for exactly one producer thread and one consumer thread,
+// the try calls are wait free, a blocked call spins a little, then sleeps.
+// capacity is rounded up to a power of two.
+// after close() every push throws Closed, pops drain what is left,
+// then the blocking ones throw Closed
+template <class X> class SpscRing {
+public:
+  SpscRing(const SpscRing &) = delete;
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  // producer side
+
+  void pushBack(const X &x);
+
+  void pushBack(X &&x);
+
+  template <class Rep, class Period>
+  void pushBackFor(
+      const X &x,
+      const std::chrono::duration<Rep, Period> &timeout) noexcept(false);
+
+  bool tryPushBack(const X &x);
+
+  bool tryPushBack(X &&x);
+
+  // all of xs[0, n), waits for room as needed
+  void pushN(const X *xs, size_t n);
+
+  // as many of xs[0, n) as fit, returns how many
+  size_t tryPushN(const X *xs, size_t n);
+
+  // consumer side
+
+  X popFront();
+
+  template <class Rep, class Period>
+  X popFrontFor(const std::chrono::duration<Rep, Period> &timeout) noexcept(
+      false);
+
+  bool tryPopFront(X &x);
+
+  // waits for at least one, then moves up to max into out, returns how many
+  size_t popN(X *out, size_t max);
+
+  size_t tryPopN(X *out, size_t max);
+
+  // either side
+
+  void close();
+
+  bool closed() const;
+
+  bool empty() const;
+
+  size_t size() const;
+
+  size_t maxSize() const;
+
+private:
+  SpscRing(size_t capacity);
+
+  // room for the producer, refreshes the cached head when it looks full
+  size_t room();
+
+  // values for the consumer, refreshes the cached tail when it looks empty
+  size_t ready();
+
+  template <class Y> bool tryPush(Y &&y);
+
+  // f once more after event.prepare(), cancels the wait if f succeeds or
+  // throws
+  template <class Try> bool retry(parkerimpl::EventCount &event, Try &f);
+
+  template <class Try> void waitFor(parkerimpl::EventCount &event, Try f);
+
+  template <class Try, class Rep, class Period>
+  bool waitFor(parkerimpl::EventCount &event, Try f,
+               const std::chrono::duration<Rep, Period> &timeout);
+
+  char pad0_[64];
+  // written by the producer
+  std::atomic<size_t> tail_{ 0 };
+  // the producer's last look at head_
+  size_t head_cache_ = 0;
+  char pad1_[64];
+  // written by the consumer
+  std::atomic<size_t> head_{ 0 };
+  // the consumer's last look at tail_
+  size_t tail_cache_ = 0;
+  char pad2_[64];
+
+  std::atomic<bool> closed_{ false };
+
+  size_t mask_;
+
+  std::unique_ptr<X[]> cells_;
+
+  parkerimpl::EventCount not_full_;
+
+  parkerimpl::EventCount not_empty_;
+
+  friend class concurrency::Factory;
+};
+
+template <class X> inline SpscRing<X>::SpscRing(size_t capacity) {
+  size_t n = 1;
+  while (n < capacity)
+    n <<= 1;
+  mask_ = n - 1;
+  cells_.reset(new X[n]);
+}
+
+template <class X> inline size_t SpscRing<X>::room() {
+  auto tail = tail_.load(std::memory_order_relaxed);
+  if (tail - head_cache_ > mask_)
+    head_cache_ = head_.load(std::memory_order_acquire);
+  return mask_ + 1 - (tail - head_cache_);
+}
+
+template <class X> inline size_t SpscRing<X>::ready() {
+  auto head = head_.load(std::memory_order_relaxed);
+  if (tail_cache_ == head)
+    tail_cache_ = tail_.load(std::memory_order_acquire);
+  return tail_cache_ - head;
+}
+
+template <class X>
+template <class Y>
+inline bool SpscRing<X>::tryPush(Y &&y) {
+  MYSPACE_THROW_IF_EX(concurrency::Closed, closed());
+  if (room() == 0)
+    return false;
+  auto tail = tail_.load(std::memory_order_relaxed);
+  cells_[tail & mask_] = std::forward<Y>(y);
+  tail_.store(tail + 1, std::memory_order_release);
+  not_empty_.notifyOne();
+  return true;
+}
+
+template <class X> inline bool SpscRing<X>::tryPushBack(const X &x) {
+  return tryPush(x);
+}
+
+template <class X> inline bool SpscRing<X>::tryPushBack(X &&x) {
+  return tryPush(std::move(x));
+}
+
+template <class X> inline size_t SpscRing<X>::tryPushN(const X *xs, size_t n) {
+  MYSPACE_THROW_IF_EX(concurrency::Closed, closed());
+  n = std::min(n, room());
+  if (n == 0)
+    return 0;
+  auto tail = tail_.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < n; ++i)
+    cells_[(tail + i) & mask_] = xs[i];
+  tail_.store(tail + n, std::memory_order_release);
+  not_empty_.notifyOne();
+  return n;
+}
+
+template <class X> inline bool SpscRing<X>::tryPopFront(X &x) {
+  return tryPopN(&x, 1) == 1;
+}
+
+template <class X> inline size_t SpscRing<X>::tryPopN(X *out, size_t max) {
+  auto n = std::min(max, ready());
+  if (n == 0)
+    return 0;
+  auto head = head_.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < n; ++i)
+    out[i] = std::move(cells_[(head + i) & mask_]);
+  head_.store(head + n, std::memory_order_release);
+  not_full_.notifyOne();
+  return n;
+}
+
+template <class X>
+template <class Try>
+inline bool SpscRing<X>::retry(parkerimpl::EventCount &event, Try &f) {
+  bool ok = false;
+  try {
+    ok = f();
+  }
+  catch (...) {
+    event.cancel();
+    throw;
+  }
+  if (ok)
+    event.cancel();
+  return ok;
+}
+
+template <class X>
+template <class Try>
+inline void SpscRing<X>::waitFor(parkerimpl::EventCount &event, Try f) {
+  for (parkerimpl::Backoff backoff;;) {
+    if (f())
+      return;
+    if (!backoff.completed()) {
+      backoff.snooze();
+      continue;
+    }
+    auto key = event.prepare();
+    if (retry(event, f))
+      return;
+    event.wait(key);
+  }
+}
+
+template <class X>
+template <class Try, class Rep, class Period>
+inline bool
+SpscRing<X>::waitFor(parkerimpl::EventCount &event, Try f,
+                     const std::chrono::duration<Rep, Period> &timeout) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  for (parkerimpl::Backoff backoff;;) {
+    if (f())
+      return true;
+    auto now = std::chrono::steady_clock::now();
+    if (now >= deadline)
+      return false;
+    if (!backoff.completed()) {
+      backoff.snooze();
+      continue;
+    }
+    auto key = event.prepare();
+    if (retry(event, f))
+      return true;
+    event.waitFor(key, deadline - now);
+  }
+}
+
+template <class X> inline void SpscRing<X>::pushBack(const X &x) {
+  waitFor(not_full_, [&]() { return tryPush(x); });
+}
+
+template <class X> inline void SpscRing<X>::pushBack(X &&x) {
+  waitFor(not_full_, [&]() { return tryPush(std::move(x)); });
+}
+
+template <class X>
+template <class Rep, class Period>
+inline void SpscRing<X>::pushBackFor(
+    const X &x,
+    const std::chrono::duration<Rep, Period> &timeout) noexcept(false) {
+  MYSPACE_THROW_IF_EX(concurrency::TimeOut,
+                      !waitFor(not_full_, [&]() { return tryPush(x); },
+                               timeout));
+}
+
+template <class X> inline void SpscRing<X>::pushN(const X *xs, size_t n) {
+  while (n > 0) {
+    size_t pushed = 0;
+    waitFor(not_full_, [&]() { return (pushed = tryPushN(xs, n)) > 0; });
+    xs += pushed;
+    n -= pushed;
+  }
+}
+
+template <class X> inline X SpscRing<X>::popFront() {
+  X x;
+  popN(&x, 1);
+  return x;
+}
+
+template <class X>
+template <class Rep, class Period>
+inline X SpscRing<X>::popFrontFor(
+    const std::chrono::duration<Rep, Period> &timeout) noexcept(false) {
+  X x;
+  bool done = false;
+  auto got = waitFor(not_empty_, [&]() {
+    return (done = tryPopFront(x)) || closed();
+  }, timeout);
+  // a value pushed before close() still comes out
+  if (got && !done)
+    done = tryPopFront(x);
+  MYSPACE_THROW_IF_EX(concurrency::TimeOut, !got);
+  MYSPACE_THROW_IF_EX(concurrency::Closed, !done);
+  return x;
+}
+
+template <class X> inline size_t SpscRing<X>::popN(X *out, size_t max) {
+  if (max == 0)
+    return 0;
+  size_t n = 0;
+  waitFor(not_empty_, [&]() { return (n = tryPopN(out, max)) > 0 || closed(); });
+  if (n == 0)
+    n = tryPopN(out, max);
+  MYSPACE_THROW_IF_EX(concurrency::Closed, n == 0);
+  return n;
+}
+
+template <class X> inline void SpscRing<X>::close() {
+  closed_.store(true);
+  not_full_.notifyAll();
+  not_empty_.notifyAll();
+}
+
+template <class X> inline bool SpscRing<X>::closed() const {
+  return closed_.load(std::memory_order_acquire);
+}
+
+template <class X> inline bool SpscRing<X>::empty() const {
+  return size() == 0;
+}
+
+template <class X> inline size_t SpscRing<X>::size() const {
+  auto head = head_.load(std::memory_order_acquire);
+  auto tail = tail_.load(std::memory_order_acquire);
+  return tail > head ? tail - head : 0;
+}
+
+template <class X> inline size_t SpscRing<X>::maxSize() const {
+  return mask_ + 1;
+}
+} // namespace concurrency
+
+MYSPACE_END
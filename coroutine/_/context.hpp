@@ -0,0 +1,262 @@
+#pragma once
+
+#include "myspace/_/stdafx.hpp"
+
+#if defined(MYSPACE_LINUX) && (defined(__x86_64__) || defined(__aarch64__))
+
+#define MYSPACE_HAS_ASM_CONTEXT
+
+#include "myspace/coroutine/_/stack.hpp"
+#include "myspace/exception/exception.hpp"
+#include "myspace/logger/logger.hpp"
+
+MYSPACE_BEGIN
+
+namespace contextimpl {
+extern "C" {
+// saves the callee saved registers on the current stack, stores its top
+// in *from, then restores the registers saved on to and returns there
+void myspace_context_switch(void **from, void *to);
+
+// first return of a new context, calls fn(arg) on its own stack
+void myspace_context_entry();
+}
+
+// the symbols go in comdat groups, one copy survives however many
+// translation units include this
+#if defined(__x86_64__)
+asm(R"(
+.pushsection .text.myspace_context_switch,"axG",@progbits,myspace_context_switch,comdat
+.globl myspace_context_switch
+.hidden myspace_context_switch
+.type myspace_context_switch,@function
+.p2align 4
+myspace_context_switch:
+  pushq %rbp
+  pushq %rbx
+  pushq %r12
+  pushq %r13
+  pushq %r14
+  pushq %r15
+  subq $8, %rsp
+  stmxcsr (%rsp)
+  fnstcw 4(%rsp)
+  movq %rsp, (%rdi)
+  movq %rsi, %rsp
+  ldmxcsr (%rsp)
+  fldcw 4(%rsp)
+  addq $8, %rsp
+  popq %r15
+  popq %r14
+  popq %r13
+  popq %r12
+  popq %rbx
+  popq %rbp
+  ret
+.size myspace_context_switch,.-myspace_context_switch
+.popsection
+
+.pushsection .text.myspace_context_entry,"axG",@progbits,myspace_context_entry,comdat
+.globl myspace_context_entry
+.hidden myspace_context_entry
+.type myspace_context_entry,@function
+.p2align 4
+myspace_context_entry:
+  .cfi_startproc
+  .cfi_undefined rip
+  movq %r12, %rdi
+  callq *%r13
+  ud2
+  .cfi_endproc
+.size myspace_context_entry,.-myspace_context_entry
+.popsection
+)");
+#elif defined(__aarch64__)
+asm(R"(
+.pushsection .text.myspace_context_switch,"axG",%progbits,myspace_context_switch,comdat
+.globl myspace_context_switch
+.hidden myspace_context_switch
+.type myspace_context_switch,%function
+.p2align 4
+myspace_context_switch:
+  sub sp, sp, #0xa0
+  stp x19, x20, [sp, #0x00]
+  stp x21, x22, [sp, #0x10]
+  stp x23, x24, [sp, #0x20]
+  stp x25, x26, [sp, #0x30]
+  stp x27, x28, [sp, #0x40]
+  stp x29, x30, [sp, #0x50]
+  stp d8, d9, [sp, #0x60]
+  stp d10, d11, [sp, #0x70]
+  stp d12, d13, [sp, #0x80]
+  stp d14, d15, [sp, #0x90]
+  mov x9, sp
+  str x9, [x0]
+  mov sp, x1
+  ldp x19, x20, [sp, #0x00]
+  ldp x21, x22, [sp, #0x10]
+  ldp x23, x24, [sp, #0x20]
+  ldp x25, x26, [sp, #0x30]
+  ldp x27, x28, [sp, #0x40]
+  ldp x29, x30, [sp, #0x50]
+  ldp d8, d9, [sp, #0x60]
+  ldp d10, d11, [sp, #0x70]
+  ldp d12, d13, [sp, #0x80]
+  ldp d14, d15, [sp, #0x90]
+  add sp, sp, #0xa0
+  ret
+.size myspace_context_switch,.-myspace_context_switch
+.popsection
+
+.pushsection .text.myspace_context_entry,"axG",%progbits,myspace_context_entry,comdat
+.globl myspace_context_entry
+.hidden myspace_context_entry
+.type myspace_context_entry,%function
+.p2align 4
+myspace_context_entry:
+  .cfi_startproc
+  .cfi_undefined x30
+  mov x0, x19
+  blr x20
+  brk #0
+  .cfi_endproc
+.size myspace_context_entry,.-myspace_context_entry
+.popsection
+)");
+#endif
+
+// the frame myspace_context_switch restores into a fresh stack, so the
+// first switch there returns into myspace_context_entry
+inline void *prepare(char *stack, size_t size, void (*fn)(void *),
+                     void *arg) {
+  auto top = (uintptr_t)(stack + size) & ~(uintptr_t)15;
+#if defined(__x86_64__)
+  // mxcsr/x87 control word, r15, r14, r13, r12, rbx, rbp and the return
+  // address, which leaves the stack 16 byte aligned for the entry's call
+  auto frame = (uint64_t *)(top - 8 * 8);
+  uint32_t csr[2] = { 0x1f80, 0x037f };
+  ::memcpy(&frame[0], csr, sizeof(csr));
+  frame[1] = 0;
+  frame[2] = 0;
+  frame[3] = (uint64_t)fn;
+  frame[4] = (uint64_t)arg;
+  frame[5] = 0;
+  frame[6] = 0;
+  frame[7] = (uint64_t)&myspace_context_entry;
+#else
+  // x19 to x28, x29, x30, d8 to d15
+  auto frame = (uint64_t *)(top - 0xa0);
+  ::memset(frame, 0, 0xa0);
+  frame[0] = (uint64_t)arg;
+  frame[1] = (uint64_t)fn;
+  frame[11] = (uint64_t)&myspace_context_entry;
+#endif
+  return frame;
+}
+} // namespace contextimpl
+
+// Ucontext without glibc: a switch saves only the callee saved registers
+// and the stack pointer, a few instructions and no rt_sigprocmask syscall,
+// the signal mask stays the thread's. the interface of Ucontext without the
+// moves, picked as Coroutine when MYSPACE_ASM_CONTEXT is defined
+class Context {
+public:
+  // the callee's stack, Stack(size) maps a guarded one, StackPool::get
+  // recycles them
+  typedef CoroutineStack Stack;
+
+  template <class Function, class... Arguments>
+  Context(Function &&func, Arguments &&... args);
+
+  template <class Function, class... Arguments>
+  Context(Stack stack, Function &&func, Arguments &&... args);
+
+  ~Context();
+
+  Context(const Context &) = delete;
+
+  Context &operator=(const Context &) = delete;
+
+  operator bool() const;
+
+  void resume();
+
+private:
+  static void proc(void *arg);
+
+  bool i_am_caller_ = true;
+
+  bool caller_is_quit_ = false;
+
+  bool callee_is_quit_ = false;
+
+  std::function<void(Context &)> func_;
+
+  void *caller_ = nullptr;
+
+  void *callee_ = nullptr;
+
+  Stack stack_;
+};
+
+template <class Function, class... Arguments>
+inline Context::Context(Function &&func, Arguments &&... args)
+    : Context(Stack(8196), std::forward<Function>(func),
+              std::forward<Arguments>(args)...) {}
+
+template <class Function, class... Arguments>
+inline Context::Context(Stack stack, Function &&func, Arguments &&... args)
+    : stack_(std::move(stack)) {
+  callee_ = contextimpl::prepare(stack_.base(), stack_.size(),
+                                 &Context::proc, this);
+
+  auto f =
+      std::bind(std::forward<Function>(func), std::forward<Arguments>(args)...);
+
+  func_ = [f](Context &x) { f(x); };
+}
+
+inline Context::~Context() {
+  caller_is_quit_ = true;
+
+  while (!callee_is_quit_) {
+    resume();
+  }
+}
+
+inline Context::operator bool() const {
+  if (i_am_caller_)
+    return !callee_is_quit_;
+  return !caller_is_quit_;
+}
+
+inline void Context::resume() {
+  if (i_am_caller_ && !callee_is_quit_) {
+    i_am_caller_ = false;
+    contextimpl::myspace_context_switch(&caller_, callee_);
+  } else if (!i_am_caller_) {
+    i_am_caller_ = true;
+    contextimpl::myspace_context_switch(&callee_, caller_);
+  }
+}
+
+inline void Context::proc(void *arg) {
+  auto caller = (Context *)arg;
+
+  try {
+    if (caller && caller->func_) {
+      (caller->func_)(*caller);
+    }
+  }
+  catch (...) {
+  }
+
+  caller->callee_is_quit_ = true;
+
+  // never comes back, the stack is dropped with the object
+  caller->resume();
+}
+
+MYSPACE_END
+
+#endif
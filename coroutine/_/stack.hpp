@@ -0,0 +1,270 @@
+#pragma once
+
+#include "myspace/_/stdafx.hpp"
+
+#if defined(MYSPACE_LINUX)
+
+#include "myspace/exception/exception.hpp"
+#include "myspace/mutex/mutex.hpp"
+
+MYSPACE_BEGIN
+
+MYSPACE_EXCEPTION_DEFINE(StackError, myspace::Exception)
+
+namespace stackimpl {
+
+inline size_t pageSize() {
+  static const size_t page = (size_t)::sysconf(_SC_PAGESIZE);
+  return page;
+}
+
+inline size_t roundUp(size_t n, size_t page) {
+  return (std::max<size_t>(n, 1) + page - 1) / page * page;
+}
+
+class Pool;
+
+} // namespace stackimpl
+
+// the stack of one coroutine, mapped with mmap apart from the heap, a
+// PROT_NONE guard page below it turns an overflow into a SIGSEGV instead of
+// silent corruption. pages are committed when first touched, so a stack
+// costs RSS only as deep as it was used. one from a StackPool goes back to
+// the pool, a standalone one is unmapped
+class CoroutineStack {
+public:
+  CoroutineStack() {}
+
+  // a standalone guarded stack of at least size bytes
+  explicit CoroutineStack(size_t size) noexcept(false);
+
+  CoroutineStack(CoroutineStack &&s);
+
+  CoroutineStack &operator=(CoroutineStack &&s);
+
+  CoroutineStack(const CoroutineStack &) = delete;
+  CoroutineStack &operator=(const CoroutineStack &) = delete;
+
+  ~CoroutineStack();
+
+  // lowest usable byte, the stack grows down from base() + size()
+  char *base() const;
+
+  size_t size() const;
+
+private:
+  CoroutineStack(char *base, size_t size,
+                 std::shared_ptr<stackimpl::Pool> pool);
+
+  void release();
+
+  char *base_ = nullptr;
+  size_t size_ = 0;
+  std::shared_ptr<stackimpl::Pool> pool_;
+
+  friend class StackPool;
+};
+
+// recycles stacks of one size. they are carved out of slabs of a few
+// stacks per mmap, so most gets take the free list under a mutex with no
+// syscall, and a returned stack keeps its committed pages for the next
+// coroutine unless trimmed. the slabs are unmapped when the pool and every
+// stack from it are gone.
+// a guard page splits the slab mapping, so a guarded stack costs 2 of the
+// vm.max_map_count mappings (65530 by default), past some 30k stacks turn
+// guard_ off or raise the limit
+class StackPool {
+public:
+  struct Options {
+    // usable bytes per stack, rounded up to pages
+    size_t size_ = 64 * 1024;
+
+    bool guard_ = true;
+
+    // stacks per mmap
+    size_t slab_ = 16;
+
+    // on return, pages below the top keep_ bytes are given back to the
+    // kernel with MADV_DONTNEED, so a deep call once does not pin RSS,
+    // at a syscall per return
+    bool trim_ = false;
+
+    size_t keep_ = 16 * 1024;
+  };
+
+  StackPool();
+
+  explicit StackPool(const Options &options);
+
+  StackPool(const StackPool &) = delete;
+  StackPool &operator=(const StackPool &) = delete;
+
+  // thread safe
+  CoroutineStack get() noexcept(false);
+
+  // stacks waiting in the free list
+  size_t idle() const;
+
+  // stacks mapped so far
+  size_t mapped() const;
+
+  size_t size() const;
+
+private:
+  std::shared_ptr<stackimpl::Pool> pool_;
+};
+
+namespace stackimpl {
+
+class Pool {
+public:
+  explicit Pool(const StackPool::Options &options)
+      : options_(options), page_(pageSize()) {
+    size_ = roundUp(options_.size_, page_);
+    stride_ = size_ + (options_.guard_ ? page_ : 0);
+    options_.slab_ = std::max<size_t>(options_.slab_, 1);
+    keep_ = std::min(roundUp(options_.keep_, page_), size_);
+  }
+
+  ~Pool() {
+    for (auto slab : slabs_)
+      ::munmap(slab, stride_ * options_.slab_);
+  }
+
+  char *get() noexcept(false) {
+    MYSPACE_IF_LOCK(mtx_) {
+      if (free_.empty())
+        grow();
+      auto base = free_.back();
+      free_.pop_back();
+      return base;
+    }
+    return nullptr;
+  }
+
+  void put(char *base) {
+    if (options_.trim_ && keep_ < size_)
+      ::madvise(base, size_ - keep_, MADV_DONTNEED);
+    MYSPACE_IF_LOCK(mtx_) { free_.push_back(base); }
+  }
+
+  // one more slab, under mtx_
+  void grow() noexcept(false) {
+    auto len = stride_ * options_.slab_;
+    auto slab = (char *)::mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE |
+                                   MAP_STACK,
+                               -1, 0);
+    MYSPACE_THROW_IF_EX(StackError, slab == MAP_FAILED);
+    if (options_.guard_) {
+      for (size_t i = 0; i < options_.slab_; ++i) {
+        if (0 != ::mprotect(slab + i * stride_, page_, PROT_NONE)) {
+          ::munmap(slab, len);
+          MYSPACE_THROW_EX(StackError, "guard page, vm.max_map_count?");
+        }
+      }
+    }
+    slabs_.push_back(slab);
+    auto guard = options_.guard_ ? page_ : 0;
+    // the first one handed out is the lowest
+    for (auto i = options_.slab_; i > 0; --i)
+      free_.push_back(slab + (i - 1) * stride_ + guard);
+  }
+
+  StackPool::Options options_;
+  size_t page_;
+  size_t size_;
+  size_t stride_;
+  size_t keep_;
+
+  mutable std::mutex mtx_;
+  std::vector<char *> free_;
+  std::vector<char *> slabs_;
+};
+
+} // namespace stackimpl
+
+inline CoroutineStack::CoroutineStack(size_t size) noexcept(false) {
+  auto page = stackimpl::pageSize();
+  size = stackimpl::roundUp(size, page);
+  auto map = (char *)::mmap(nullptr, size + page, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE |
+                                MAP_STACK,
+                            -1, 0);
+  MYSPACE_THROW_IF_EX(StackError, map == MAP_FAILED);
+  if (0 != ::mprotect(map, page, PROT_NONE)) {
+    ::munmap(map, size + page);
+    MYSPACE_THROW_EX(StackError, "guard page, vm.max_map_count?");
+  }
+  base_ = map + page;
+  size_ = size;
+}
+
+inline CoroutineStack::CoroutineStack(char *base, size_t size,
+                                      std::shared_ptr<stackimpl::Pool> pool)
+    : base_(base), size_(size), pool_(std::move(pool)) {}
+
+inline CoroutineStack::CoroutineStack(CoroutineStack &&s)
+    : base_(s.base_), size_(s.size_), pool_(std::move(s.pool_)) {
+  s.base_ = nullptr;
+  s.size_ = 0;
+}
+
+inline CoroutineStack &CoroutineStack::operator=(CoroutineStack &&s) {
+  if (&s != this) {
+    release();
+    base_ = s.base_;
+    size_ = s.size_;
+    pool_ = std::move(s.pool_);
+    s.base_ = nullptr;
+    s.size_ = 0;
+  }
+  return *this;
+}
+
+inline CoroutineStack::~CoroutineStack() { release(); }
+
+inline void CoroutineStack::release() {
+  if (!base_)
+    return;
+  if (pool_) {
+    pool_->put(base_);
+    pool_.reset();
+  } else {
+    auto page = stackimpl::pageSize();
+    ::munmap(base_ - page, size_ + page);
+  }
+  base_ = nullptr;
+  size_ = 0;
+}
+
+inline char *CoroutineStack::base() const { return base_; }
+
+inline size_t CoroutineStack::size() const { return size_; }
+
+inline StackPool::StackPool() : StackPool(Options()) {}
+
+inline StackPool::StackPool(const Options &options)
+    : pool_(std::make_shared<stackimpl::Pool>(options)) {}
+
+inline CoroutineStack StackPool::get() noexcept(false) {
+  return CoroutineStack(pool_->get(), pool_->size_, pool_);
+}
+
+inline size_t StackPool::idle() const {
+  MYSPACE_IF_LOCK(pool_->mtx_) { return pool_->free_.size(); }
+  return 0;
+}
+
+inline size_t StackPool::mapped() const {
+  MYSPACE_IF_LOCK(pool_->mtx_) {
+    return pool_->slabs_.size() * pool_->options_.slab_;
+  }
+  return 0;
+}
+
+inline size_t StackPool::size() const { return pool_->size_; }
+
+MYSPACE_END
+
+#endif
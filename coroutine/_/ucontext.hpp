@@ -5,6 +5,7 @@
 
 #if defined(MYSPACE_LINUX)
 
+#include "myspace/coroutine/_/stack.hpp"
 #include "myspace/exception/exception.hpp"
 #include "myspace/logger/logger.hpp"
 
@@ -12,9 +13,16 @@ MYSPACE_BEGIN
 
 class Ucontext {
 public:
+  // the callee's stack, Stack(size) maps a guarded one, StackPool::get
+  // recycles them
+  typedef CoroutineStack Stack;
+
   template <class Function, class... Arguments>
   Ucontext(Function &&func, Arguments &&... args);
 
+  template <class Function, class... Arguments>
+  Ucontext(Stack stack, Function &&func, Arguments &&... args);
+
   ~Ucontext();
 
   Ucontext(Ucontext &&u);
@@ -50,17 +58,22 @@ private:
   std::unique_ptr<ucontext_t> callee_ =
       std::unique_ptr<ucontext_t>(new ucontext_t);
 
-  std::unique_ptr<char[]> stack_buffer_;
+  Stack stack_;
 };
 
 template <class Function, class... Arguments>
 inline Ucontext::Ucontext(Function &&func, Arguments &&... args)
-    : stack_buffer_(new char[8196]) {
+    : Ucontext(Stack(8196), std::forward<Function>(func),
+               std::forward<Arguments>(args)...) {}
+
+template <class Function, class... Arguments>
+inline Ucontext::Ucontext(Stack stack, Function &&func, Arguments &&... args)
+    : stack_(std::move(stack)) {
   MYSPACE_THROW_IF(::getcontext(callee_.get()) < 0);
 
-  callee_->uc_stack.ss_sp = stack_buffer_.get();
+  callee_->uc_stack.ss_sp = stack_.base();
 
-  callee_->uc_stack.ss_size = 8196;
+  callee_->uc_stack.ss_size = stack_.size();
 
   callee_->uc_link = caller_.get();
 
@@ -95,7 +108,7 @@ inline void Ucontext::swap(Ucontext &&f) {
 
     callee_.swap(f.callee_);
 
-    stack_buffer_.swap(f.stack_buffer_);
+    std::swap(stack_, f.stack_);
 
     i_am_caller_ = f.i_am_caller_;
   }
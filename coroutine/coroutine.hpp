@@ -5,6 +5,7 @@
 #if defined(MYSPACE_WINDOWS)
 #include "myspace/coroutine/_/fiber.hpp"
 #elif defined(MYSPACE_LINUX)
+#include "myspace/coroutine/_/context.hpp"
 #include "myspace/coroutine/_/ucontext.hpp"
 #endif
 
@@ -12,6 +13,8 @@ MYSPACE_BEGIN
 
 #if defined(MYSPACE_WINDOWS)
 typedef Fiber
+#elif defined(MYSPACE_ASM_CONTEXT) && defined(MYSPACE_HAS_ASM_CONTEXT)
+typedef Context
 #elif defined(MYSPACE_LINUX)
 typedef Ucontext
 #endif
@@ -0,0 +1,406 @@
+#pragma once
+
+#include "myspace/_/stdafx.hpp"
+
+#if defined(MYSPACE_LINUX)
+
+#include "myspace/coroutine/coroutine.hpp"
+#include "myspace/detector/reactor.hpp"
+#include "myspace/exception/exception.hpp"
+#include "myspace/logger/logger.hpp"
+#include "myspace/mutex/mutex.hpp"
+#include "myspace/net/socketopt.hpp"
+
+MYSPACE_BEGIN
+
+namespace schedulerimpl {
+class Task;
+class Worker;
+} // namespace schedulerimpl
+
+// M:N coroutines. go() queues a function, worker threads take it from a
+// shared run queue and run it as a stackful Coroutine. a coroutine that
+// blocks on a socket, through tcp::Socket, Acceptor, SocketStream or
+// anything else waiting in SocketOpt::wait, is parked with its fd in the
+// worker's Reactor while the worker runs the others, so blocking style code
+// serves many sessions on a few threads.
+// a started coroutine stays on its worker, the compiler may keep a
+// thread_local address across a switch, so moving it would not be safe
+class Scheduler {
+public:
+  MYSPACE_EXCEPTION_DEFINE(SchedulerError, myspace::Exception)
+  // thrown where a coroutine parks once stop() is called, to unwind it
+  MYSPACE_EXCEPTION_DEFINE(Stopped, SchedulerError)
+
+  struct Options {
+    size_t workers_ = std::thread::hardware_concurrency();
+
+    // stacks of the coroutines, each worker recycles its own
+    StackPool::Options stack_;
+
+    // most new coroutines a worker takes from the run queue at once
+    size_t batch_ = 64;
+  };
+
+  Scheduler();
+
+  // starts the worker threads
+  explicit Scheduler(const Options &options);
+
+  Scheduler(const Scheduler &) = delete;
+  Scheduler &operator=(const Scheduler &) = delete;
+
+  ~Scheduler();
+
+  // thread safe, f runs in a new coroutine
+  void go(std::function<void()> f);
+
+  // blocks until every coroutine has returned, not from a coroutine
+  void join();
+
+  // unwinds the coroutines left with Stopped, drops the queued ones and
+  // joins the workers
+  void stop();
+
+  // coroutines queued or not returned yet
+  size_t size() const;
+
+  // in a coroutine, lets the others on its worker run first,
+  // elsewhere std::this_thread::yield
+  static void yield() noexcept(false);
+
+  // in a coroutine, parks it for d, elsewhere sleeps the thread
+  static void sleep(std::chrono::milliseconds d) noexcept(false);
+
+  // whether the caller runs in a coroutine
+  static bool inCoroutine();
+
+private:
+  // a coroutine returned
+  void done();
+
+  Options options_;
+  std::vector<std::unique_ptr<schedulerimpl::Worker> > workers_;
+
+  std::mutex mtx_;
+  std::deque<std::function<void()> > queue_;
+
+  // round robin of the worker woken by go()
+  std::atomic<size_t> next_{ 0 };
+  std::atomic<bool> stopped_{ false };
+  std::atomic<size_t> size_{ 0 };
+
+  std::mutex join_mtx_;
+  std::condition_variable join_cv_;
+
+  friend class schedulerimpl::Task;
+  friend class schedulerimpl::Worker;
+};
+
+namespace schedulerimpl {
+
+class Task : public Reactor::Handler {
+public:
+  Task(Worker *worker, std::function<void()> f, CoroutineStack stack)
+      : worker_(worker), f_(std::move(f)),
+        co_(std::move(stack), [this]() { run(); }) {}
+
+  // the parked fd is ready
+  void onEvents(uint32_t) override;
+
+  void run();
+
+  Worker *worker_;
+  std::function<void()> f_;
+  Coroutine co_;
+  // the fd parked on, -1 if none
+  int fd_ = -1;
+  TimerWheel::Id timer_ = 0;
+  bool timed_out_ = false;
+};
+
+// a thread with a Reactor, its coroutines and the ready ones among them
+class Worker : public socketoptimpl::Parker {
+public:
+  explicit Worker(Scheduler *scheduler)
+      : scheduler_(scheduler), stacks_(scheduler->options_.stack_) {}
+
+  ~Worker();
+
+  bool park(int fd, bool write, int ms) override;
+
+  void loop();
+
+  // moves new coroutines from the run queue
+  void take();
+
+  // one round of the ready coroutines, those made ready meanwhile wait
+  // for the next round
+  void runReady();
+
+  void resume(Task *task);
+
+  // from a coroutine back to loop(), throws Stopped after stop()
+  void suspend();
+
+  // resumes every coroutine left so its park point throws Stopped
+  void shutdown();
+
+  void ready(Task *task) { ready_.push_back(task); }
+
+  static Worker *&current() {
+    static thread_local Worker *w = nullptr;
+    return w;
+  }
+
+  Scheduler *scheduler_;
+  Reactor reactor_;
+  std::thread thread_;
+  // a task comes and goes on its worker, so the pool sees no contention
+  StackPool stacks_;
+
+  std::deque<Task *> ready_;
+  std::unordered_set<Task *> tasks_;
+  Task *running_ = nullptr;
+
+  // reused by take()
+  std::vector<std::function<void()> > taken_;
+};
+
+inline void Task::onEvents(uint32_t) {
+  if (timer_) {
+    worker_->reactor_.timers().cancel(timer_);
+    timer_ = 0;
+  }
+  worker_->ready(this);
+}
+
+inline void Task::run() {
+  try {
+    if (!worker_->scheduler_->stopped_.load())
+      f_();
+  }
+  catch (const Scheduler::Stopped &) {
+  }
+  catch (...) {
+    MYSPACE_WARN_EXCEPTION();
+  }
+  f_ = nullptr;
+}
+
+inline Worker::~Worker() {
+  for (auto task : tasks_)
+    delete task;
+}
+
+inline bool Worker::park(int fd, bool write, int ms) {
+  auto task = running_;
+  MYSPACE_THROW_IF_EX(Scheduler::Stopped, scheduler_->stopped_.load());
+  uint32_t events = (write ? Reactor::WRITABLE : Reactor::READABLE) |
+                    Reactor::ONESHOT;
+  // a one shot fd stays in epoll disarmed, a later park only rearms it
+  if (!reactor_.mod(fd, task, events) && !reactor_.add(fd, task, events))
+    // not pollable, like a regular file, which never blocks
+    return true;
+  task->fd_ = fd;
+  if (ms >= 0) {
+    task->timer_ = reactor_.timers().after(
+        std::chrono::milliseconds(ms), [this, task]() {
+          task->timer_ = 0;
+          task->timed_out_ = true;
+          // no event may reach the task once it moves on
+          reactor_.del(task->fd_, task);
+          ready(task);
+        });
+  }
+  suspend();
+  task->fd_ = -1;
+  auto timed_out = task->timed_out_;
+  task->timed_out_ = false;
+  return !timed_out;
+}
+
+inline void Worker::loop() {
+  while (!scheduler_->stopped_.load()) {
+    runReady();
+    take();
+    try {
+      reactor_.poll(ready_.empty() ? -1 : 0);
+    }
+    catch (...) {
+      MYSPACE_WARN_EXCEPTION();
+    }
+  }
+  shutdown();
+}
+
+inline void Worker::take() {
+  bool left = false;
+  MYSPACE_IF_LOCK(scheduler_->mtx_) {
+    auto &queue = scheduler_->queue_;
+    while (!queue.empty() && taken_.size() < scheduler_->options_.batch_) {
+      taken_.push_back(std::move(queue.front()));
+      queue.pop_front();
+    }
+    left = !queue.empty();
+  }
+  // passes the rest on, so an idle worker gets some
+  if (left) {
+    auto &workers = scheduler_->workers_;
+    workers[scheduler_->next_++ % workers.size()]->reactor_.wake();
+  }
+  for (auto &f : taken_) {
+    Task *task = nullptr;
+    try {
+      task = new Task(this, std::move(f), stacks_.get());
+    }
+    catch (...) {
+      // out of stacks, the coroutine is dropped
+      MYSPACE_WARN_EXCEPTION();
+      scheduler_->done();
+      continue;
+    }
+    tasks_.insert(task);
+    ready_.push_back(task);
+  }
+  taken_.clear();
+}
+
+inline void Worker::runReady() {
+  for (auto n = ready_.size(); n > 0 && !ready_.empty(); --n) {
+    auto task = ready_.front();
+    ready_.pop_front();
+    resume(task);
+  }
+}
+
+inline void Worker::resume(Task *task) {
+  running_ = task;
+  current() = this;
+  socketoptimpl::parker() = this;
+  task->co_.resume();
+  socketoptimpl::parker() = nullptr;
+  current() = nullptr;
+  running_ = nullptr;
+  if (!task->co_) {
+    tasks_.erase(task);
+    delete task;
+    scheduler_->done();
+  }
+}
+
+inline void Worker::suspend() {
+  running_->co_.resume();
+  MYSPACE_THROW_IF_EX(Scheduler::Stopped, scheduler_->stopped_.load());
+}
+
+inline void Worker::shutdown() {
+  ready_.clear();
+  while (!tasks_.empty()) {
+    auto task = *tasks_.begin();
+    if (task->timer_) {
+      reactor_.timers().cancel(task->timer_);
+      task->timer_ = 0;
+    }
+    if (task->fd_ >= 0) {
+      reactor_.del(task->fd_, task);
+      task->fd_ = -1;
+    }
+    resume(task);
+    // it caught Stopped and parked again, it cannot be resumed
+    if (tasks_.count(task)) {
+      tasks_.erase(task);
+      delete task;
+      scheduler_->done();
+    }
+  }
+}
+
+} // namespace schedulerimpl
+
+inline Scheduler::Scheduler() : Scheduler(Options()) {}
+
+inline Scheduler::Scheduler(const Options &options) : options_(options) {
+  options_.workers_ = std::max<size_t>(options_.workers_, 1);
+  options_.batch_ = std::max<size_t>(options_.batch_, 1);
+  for (size_t i = 0; i < options_.workers_; ++i)
+    workers_.emplace_back(new schedulerimpl::Worker(this));
+  for (auto &worker : workers_) {
+    auto w = worker.get();
+    w->thread_ = std::thread([w]() { w->loop(); });
+  }
+}
+
+inline Scheduler::~Scheduler() { stop(); }
+
+inline void Scheduler::go(std::function<void()> f) {
+  MYSPACE_THROW_IF_EX(SchedulerError, stopped_.load());
+  size_.fetch_add(1);
+  MYSPACE_IF_LOCK(mtx_) { queue_.push_back(std::move(f)); }
+  workers_[next_++ % workers_.size()]->reactor_.wake();
+}
+
+inline void Scheduler::join() {
+  std::unique_lock<std::mutex> ul(join_mtx_);
+  join_cv_.wait(ul, [this]() { return size_.load() == 0; });
+}
+
+inline void Scheduler::stop() {
+  if (stopped_.exchange(true))
+    return;
+  for (auto &worker : workers_)
+    worker->reactor_.wake();
+  for (auto &worker : workers_)
+    if (worker->thread_.joinable())
+      worker->thread_.join();
+  size_t dropped = 0;
+  MYSPACE_IF_LOCK(mtx_) {
+    dropped = queue_.size();
+    queue_.clear();
+  }
+  for (; dropped > 0; --dropped)
+    done();
+}
+
+inline size_t Scheduler::size() const { return size_.load(); }
+
+inline void Scheduler::done() {
+  if (size_.fetch_sub(1) == 1) {
+    MYSPACE_IF_LOCK(join_mtx_) {}
+    join_cv_.notify_all();
+  }
+}
+
+inline void Scheduler::yield() noexcept(false) {
+  auto worker = schedulerimpl::Worker::current();
+  if (!worker) {
+    std::this_thread::yield();
+    return;
+  }
+  MYSPACE_THROW_IF_EX(Stopped, worker->scheduler_->stopped_.load());
+  worker->ready(worker->running_);
+  worker->suspend();
+}
+
+inline void Scheduler::sleep(std::chrono::milliseconds d) noexcept(false) {
+  auto worker = schedulerimpl::Worker::current();
+  if (!worker) {
+    std::this_thread::sleep_for(d);
+    return;
+  }
+  MYSPACE_THROW_IF_EX(Stopped, worker->scheduler_->stopped_.load());
+  auto task = worker->running_;
+  task->timer_ = worker->reactor_.timers().after(d, [worker, task]() {
+    task->timer_ = 0;
+    worker->ready(task);
+  });
+  worker->suspend();
+}
+
+inline bool Scheduler::inCoroutine() {
+  return schedulerimpl::Worker::current() != nullptr;
+}
+
+MYSPACE_END
+
+#endif
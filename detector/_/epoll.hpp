@@ -36,6 +36,9 @@ private:
 
   int epoll_ = -1;
 
+  // reused by every wait
+  std::vector<epoll_event> events_;
+
   std::unordered_map<int, DetectorImpl::Candidate> candidates_;
 };
 inline Epoll::Epoll() : epoll_(epoll_create1(0)) {}
@@ -128,14 +131,14 @@ Epoll::wait(std::chrono::high_resolution_clock::duration duration) {
 inline std::map<uint32_t, std::deque<Any> > Epoll::wait_ms(int ms) {
   std::map<uint32_t, std::deque<Any> > result;
 
-  auto events = newUnique<epoll_event[]>(candidates_.size());
+  events_.resize(candidates_.size());
 
-  auto n = ::epoll_wait(epoll_, events.get(), candidates_.size(), ms);
+  auto n = ::epoll_wait(epoll_, events_.data(), events_.size(), ms);
 
   for (auto i = 0; i < n; ++i) {
-    auto ev = events[i].events;
+    auto ev = events_[i].events;
 
-    auto fd = events[i].data.fd;
+    auto fd = events_[i].data.fd;
 
     result[ev].push_back(candidates_[fd]._x);
   }
@@ -0,0 +1,440 @@
+#pragma once
+
+#include "myspace/_/stdafx.hpp"
+
+#if defined(MYSPACE_LINUX)
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+// the timed wait of 5.11 is the oldest io_uring used here, headers older
+// than that build Uring and Proactor on their Epoll and Reactor fallbacks
+#if defined(IORING_FEAT_EXT_ARG) && defined(__NR_io_uring_setup)
+#define MYSPACE_HAS_URING
+#endif
+
+#if defined(MYSPACE_HAS_URING)
+// newer than the timed wait, a kernel without them fails the setup with
+// EINVAL and Ring::open retries without
+#if !defined(IORING_SETUP_SUBMIT_ALL)
+#define IORING_SETUP_SUBMIT_ALL (1U << 7)
+#endif
+#if !defined(IORING_SETUP_COOP_TASKRUN)
+#define IORING_SETUP_COOP_TASKRUN (1U << 8)
+#endif
+#endif
+
+#include "myspace/any/any.hpp"
+#include "myspace/detector/_/epoll.hpp"
+#include "myspace/detector/_/include.hpp"
+#include "myspace/memory/memory.hpp"
+#include "myspace/net/socketopt.hpp"
+
+MYSPACE_BEGIN
+
+namespace uringimpl {
+
+#if defined(MYSPACE_HAS_URING)
+
+inline int setup(unsigned entries, io_uring_params *params) {
+  return (int)::syscall(__NR_io_uring_setup, entries, params);
+}
+
+inline int enter(int fd, unsigned submit, unsigned wait, unsigned flags,
+                 const void *arg, size_t argsz) {
+  return (int)::syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg,
+                        argsz);
+}
+
+inline int registers(int fd, unsigned op, const void *arg, unsigned n) {
+  return (int)::syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+// one io_uring by raw syscalls, both rings mapped, for one thread.
+// sqe() hands out entries that go to the kernel with the next enter(),
+// so any number of operations cost one syscall together with the wait
+class Ring {
+public:
+  Ring() {}
+
+  Ring(const Ring &) = delete;
+  Ring &operator=(const Ring &) = delete;
+
+  ~Ring();
+
+  // false when the kernel has no io_uring, it is disabled, or it lacks
+  // the single mmap and timed wait of 5.11
+  bool open(unsigned entries);
+
+  bool opened() const;
+
+  // a zeroed entry, submits what is queued when the ring is full,
+  // nullptr only if that did not help
+  io_uring_sqe *sqe();
+
+  // submits the queued entries and waits for wait completions, up to
+  // timeout_ms, < 0 forever, returns false on an error other than a
+  // timeout or a signal
+  bool enter(unsigned wait, int timeout_ms);
+
+  // f(const io_uring_cqe &) for each completion, which is consumed before
+  // the call, so f may queue more, returns how many
+  template <class F> size_t reap(F &&f);
+
+  int registerFiles(const int *fds, unsigned n);
+
+  int updateFile(unsigned slot, int fd);
+
+  int registerBuffers(const iovec *iov, unsigned n);
+
+private:
+  int fd_ = -1;
+  void *map_ = MAP_FAILED;
+  size_t map_len_ = 0;
+  io_uring_sqe *sqes_ = (io_uring_sqe *)MAP_FAILED;
+  size_t sqes_len_ = 0;
+
+  unsigned *sq_head_ = nullptr;
+  unsigned *sq_tail_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned sq_entries_ = 0;
+  // entries handed out, the kernel sees them after enter()
+  unsigned sq_local_ = 0;
+
+  unsigned *cq_head_ = nullptr;
+  unsigned *cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe *cqes_ = nullptr;
+};
+
+inline Ring::~Ring() {
+  if (sqes_ != MAP_FAILED)
+    ::munmap(sqes_, sqes_len_);
+  if (map_ != MAP_FAILED)
+    ::munmap(map_, map_len_);
+  if (fd_ >= 0)
+    ::close(fd_);
+}
+
+inline bool Ring::opened() const { return fd_ >= 0; }
+
+inline bool Ring::open(unsigned entries) {
+  io_uring_params p;
+  ::memset(&p, 0, sizeof(p));
+  // completions wait for the next enter instead of interrupting the
+  // thread, since 5.19
+  p.flags = IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SUBMIT_ALL;
+  auto fd = setup(entries, &p);
+  if (fd < 0 && errno == EINVAL) {
+    ::memset(&p, 0, sizeof(p));
+    fd = setup(entries, &p);
+  }
+  if (fd < 0)
+    return false;
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(p.features & IORING_FEAT_EXT_ARG) ||
+      !(p.features & IORING_FEAT_NODROP)) {
+    ::close(fd);
+    return false;
+  }
+  map_len_ = std::max(p.sq_off.array + p.sq_entries * sizeof(unsigned),
+                      p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+  map_ = ::mmap(nullptr, map_len_, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  sqes_len_ = p.sq_entries * sizeof(io_uring_sqe);
+  if (map_ != MAP_FAILED)
+    sqes_ = (io_uring_sqe *)::mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, fd,
+                                   IORING_OFF_SQES);
+  if (map_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+    ::close(fd);
+    return false;
+  }
+  fd_ = fd;
+  auto base = (char *)map_;
+  sq_head_ = (unsigned *)(base + p.sq_off.head);
+  sq_tail_ = (unsigned *)(base + p.sq_off.tail);
+  sq_mask_ = *(unsigned *)(base + p.sq_off.ring_mask);
+  sq_entries_ = p.sq_entries;
+  sq_local_ = *sq_tail_;
+  // entry i of the array always names sqe i
+  auto array = (unsigned *)(base + p.sq_off.array);
+  for (unsigned i = 0; i < sq_entries_; ++i)
+    array[i] = i;
+  cq_head_ = (unsigned *)(base + p.cq_off.head);
+  cq_tail_ = (unsigned *)(base + p.cq_off.tail);
+  cq_mask_ = *(unsigned *)(base + p.cq_off.ring_mask);
+  cqes_ = (io_uring_cqe *)(base + p.cq_off.cqes);
+  return true;
+}
+
+inline io_uring_sqe *Ring::sqe() {
+  if (sq_local_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+    enter(0, 0);
+    if (sq_local_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_)
+      return nullptr;
+  }
+  auto e = &sqes_[sq_local_ & sq_mask_];
+  ::memset(e, 0, sizeof(*e));
+  ++sq_local_;
+  return e;
+}
+
+inline bool Ring::enter(unsigned wait, int timeout_ms) {
+  auto submit = sq_local_ - *sq_tail_;
+  __atomic_store_n(sq_tail_, sq_local_, __ATOMIC_RELEASE);
+  if (submit == 0 && wait == 0)
+    return true;
+  unsigned flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+  io_uring_getevents_arg arg;
+  __kernel_timespec ts;
+  ::memset(&arg, 0, sizeof(arg));
+  if (wait > 0 && timeout_ms >= 0) {
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    flags |= IORING_ENTER_EXT_ARG;
+  }
+  auto r = uringimpl::enter(fd_, submit, wait, flags,
+                            (flags & IORING_ENTER_EXT_ARG) ? &arg : nullptr,
+                            sizeof(arg));
+  return r >= 0 || errno == ETIME || errno == EINTR || errno == EBUSY;
+}
+
+template <class F> inline size_t Ring::reap(F &&f) {
+  size_t n = 0;
+  for (;;) {
+    auto head = *cq_head_;
+    if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+      return n;
+    auto cqe = cqes_[head & cq_mask_];
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+    f(cqe);
+    ++n;
+  }
+}
+
+inline int Ring::registerFiles(const int *fds, unsigned n) {
+  return registers(fd_, IORING_REGISTER_FILES, fds, n);
+}
+
+inline int Ring::updateFile(unsigned slot, int fd) {
+  io_uring_files_update up;
+  ::memset(&up, 0, sizeof(up));
+  up.offset = slot;
+  up.fds = (uint64_t)(uintptr_t)&fd;
+  return registers(fd_, IORING_REGISTER_FILES_UPDATE, &up, 1);
+}
+
+inline int Ring::registerBuffers(const iovec *iov, unsigned n) {
+  return registers(fd_, IORING_REGISTER_BUFFERS, iov, n);
+}
+
+#else
+
+// the headers have no usable io_uring, it never opens
+class Ring {
+public:
+  bool open(unsigned) { return false; }
+
+  bool opened() const { return false; }
+
+  bool enter(unsigned, int) { return false; }
+
+  int registerFiles(const int *, unsigned) { return -1; }
+
+  int updateFile(unsigned, int) { return -1; }
+
+  int registerBuffers(const iovec *, unsigned) { return -1; }
+};
+
+#endif
+
+} // namespace uringimpl
+
+// Detector backend on io_uring, the Epoll interface with level triggered
+// results: every fd has a one shot poll in the ring, and the ones that
+// fired are armed again with the next wait, so arming costs no syscall of
+// its own. falls back to Epoll when the kernel has no usable io_uring
+class Uring {
+public:
+  explicit Uring(unsigned entries = 256);
+
+  Uring(const Uring &) = delete;
+  Uring &operator=(const Uring &) = delete;
+
+  // false when it runs on the Epoll fallback
+  bool uring() const;
+
+  template <class X> bool add(X &&x, DetectType dt = READ);
+
+  template <class X> bool mod(X &&x, DetectType dt);
+
+  template <class X> bool aod(X &&x, DetectType dt = READ);
+
+  template <class X> void del(X &&x);
+
+  std::map<uint32_t, std::deque<Any> > wait();
+
+  std::map<uint32_t, std::deque<Any> >
+  wait(std::chrono::high_resolution_clock::duration duration);
+
+private:
+  struct Candidate {
+    Any x_;
+    DetectType ev_;
+    // bumped on every change, completions of an older poll are dropped
+    uint32_t gen_;
+  };
+
+  std::map<uint32_t, std::deque<Any> > wait_ms(int ms);
+
+  void arm(int fd, const Candidate &c);
+
+  void disarm(int fd, const Candidate &c);
+
+  static uint64_t key(int fd, uint32_t gen);
+
+  uringimpl::Ring ring_;
+  std::unique_ptr<Epoll> epoll_;
+  uint32_t gen_ = 0;
+  std::unordered_map<int, Candidate> candidates_;
+  // reused by every wait
+  std::vector<int> fired_;
+};
+
+inline Uring::Uring(unsigned entries) {
+  if (!ring_.open(entries))
+    epoll_.reset(new Epoll);
+}
+
+inline bool Uring::uring() const { return !epoll_; }
+
+inline uint64_t Uring::key(int fd, uint32_t gen) {
+  // 0 is left for the removals, whose completions carry nothing
+  return ((uint64_t)gen << 32) | (uint32_t)fd;
+}
+
+inline void Uring::arm(int fd, const Candidate &c) {
+#if defined(MYSPACE_HAS_URING)
+  auto e = ring_.sqe();
+  if (!e)
+    return;
+  e->opcode = IORING_OP_POLL_ADD;
+  e->fd = fd;
+  // the poll bits are the epoll ones
+  e->poll32_events = c.ev_ | EPOLLERR | EPOLLHUP;
+  e->user_data = key(fd, c.gen_);
+#endif
+}
+
+inline void Uring::disarm(int fd, const Candidate &c) {
+#if defined(MYSPACE_HAS_URING)
+  auto e = ring_.sqe();
+  if (!e)
+    return;
+  e->opcode = IORING_OP_POLL_REMOVE;
+  e->fd = -1;
+  e->addr = key(fd, c.gen_);
+  e->user_data = 0;
+#endif
+}
+
+template <class X> inline bool Uring::add(X &&x, DetectType dt) {
+  if (epoll_)
+    return epoll_->add(std::forward<X>(x), dt);
+  if (!x)
+    return false;
+  int fd = x->operator int();
+  if (candidates_.find(fd) != candidates_.end())
+    return false;
+  SocketOpt::setBlock(fd, false);
+  auto &c = candidates_[fd];
+  c = { Any(x), dt, ++gen_ };
+  arm(fd, c);
+  return true;
+}
+
+template <class X> inline bool Uring::mod(X &&x, DetectType dt) {
+  if (epoll_)
+    return epoll_->mod(std::forward<X>(x), dt);
+  if (!x)
+    return false;
+  int fd = x->operator int();
+  auto itr = candidates_.find(fd);
+  if (itr == candidates_.end())
+    return false;
+  if (itr->second.ev_ == dt)
+    return true;
+  disarm(fd, itr->second);
+  itr->second = { Any(x), dt, ++gen_ };
+  arm(fd, itr->second);
+  return true;
+}
+
+template <class X> inline bool Uring::aod(X &&x, DetectType dt) {
+  return add(x, dt) || mod(x, dt);
+}
+
+template <class X> inline void Uring::del(X &&x) {
+  if (epoll_)
+    return epoll_->del(std::forward<X>(x));
+  if (!x)
+    return;
+  int fd = x->operator int();
+  auto itr = candidates_.find(fd);
+  if (itr == candidates_.end())
+    return;
+  disarm(fd, itr->second);
+  candidates_.erase(itr);
+}
+
+inline std::map<uint32_t, std::deque<Any> > Uring::wait() {
+  if (epoll_)
+    return epoll_->wait();
+  return wait_ms(-1);
+}
+
+inline std::map<uint32_t, std::deque<Any> >
+Uring::wait(std::chrono::high_resolution_clock::duration duration) {
+  if (epoll_)
+    return epoll_->wait(duration);
+  auto ms =
+      std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+  if (ms < 0)
+    ms = 0;
+  if (ms > std::numeric_limits<int>::max())
+    ms = std::numeric_limits<int>::max();
+  return wait_ms((int)ms);
+}
+
+inline std::map<uint32_t, std::deque<Any> > Uring::wait_ms(int ms) {
+  std::map<uint32_t, std::deque<Any> > result;
+#if defined(MYSPACE_HAS_URING)
+  // waits out the timeout even with nothing armed, as epoll_wait does
+  ring_.enter(1, ms);
+  fired_.clear();
+  ring_.reap([&](const io_uring_cqe &cqe) {
+    if (cqe.user_data == 0 || cqe.res < 0)
+      return;
+    auto fd = (int)(uint32_t)cqe.user_data;
+    auto itr = candidates_.find(fd);
+    if (itr == candidates_.end() ||
+        itr->second.gen_ != (uint32_t)(cqe.user_data >> 32))
+      return;
+    result[(uint32_t)cqe.res].push_back(itr->second.x_);
+    fired_.push_back(fd);
+  });
+  // fired one shot polls go back with the next enter
+  for (auto fd : fired_)
+    arm(fd, candidates_[fd]);
+#endif
+  return result;
+}
+
+MYSPACE_END
+
+#endif
@@ -4,6 +4,7 @@
 #include "myspace/_/stdafx.hpp"
 #if defined(MYSPACE_LINUX)
 #include "myspace/detector/_/epoll.hpp"
+#include "myspace/detector/_/uring.hpp"
 #endif
 #include "myspace/detector/_/select.hpp"
 
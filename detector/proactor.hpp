@@ -0,0 +1,474 @@
+#pragma once
+
+#include "myspace/_/stdafx.hpp"
+
+#if defined(MYSPACE_LINUX)
+
+#include "myspace/defer/defer.hpp"
+#include "myspace/detector/_/uring.hpp"
+#include "myspace/detector/reactor.hpp"
+#include "myspace/exception/exception.hpp"
+#include "myspace/logger/logger.hpp"
+
+MYSPACE_BEGIN
+
+MYSPACE_EXCEPTION_DEFINE(ProactorError, myspace::Exception)
+
+// completion based event loop. accept, recv and send are queued in an
+// io_uring and reach the kernel together with the wait for completions,
+// so one loop iteration is one syscall however many operations it carries.
+// an fd given to registerFile() is named by a slot of the ring's file
+// table, and a recv into a buffer given to registerBuffers() uses the
+// fixed variant, which saves the kernel the fd lookup and page pinning of
+// every operation.
+// where io_uring is missing or disabled the same operations run on a
+// Reactor as their fds become ready, callers see no difference.
+// everything but stop() belongs to the loop thread
+class Proactor {
+public:
+  // one operation in flight at a time, owned by the caller, who keeps it
+  // alive until it completes
+  class Op {
+  public:
+    virtual ~Op() {}
+
+    // what the syscall would return, -errno on failure
+    virtual void onComplete(int result) = 0;
+  };
+
+  // entries, operations queued per iteration before a submit of its own,
+  // files, slots in the fixed file table,
+  // use_uring false runs the Reactor path anyway
+  explicit Proactor(unsigned entries = 256, unsigned files = 1024,
+                    bool use_uring = true);
+
+  Proactor(const Proactor &) = delete;
+  Proactor &operator=(const Proactor &) = delete;
+
+  ~Proactor();
+
+  // false on the Reactor fallback
+  bool uring() const;
+
+  // completes with the accepted fd, close on exec
+  void accept(int fd, Op *op);
+
+  void recv(int fd, char *buf, size_t len, Op *op);
+
+  // MSG_NOSIGNAL, may complete with fewer bytes than len
+  void send(int fd, const char *buf, size_t len, Op *op);
+
+  // op completes with -ECANCELED if it was still pending
+  void cancel(Op *op);
+
+  // closes an fd used here, with no operation pending on it, and lets go
+  // of its file slot and its reactor registration
+  void close(int fd);
+
+  // until unregisterFile(), which must come before ::close(fd),
+  // false when the table is full, the fd still works unregistered
+  bool registerFile(int fd);
+
+  void unregisterFile(int fd);
+
+  // once, the memory must outlive the proactor
+  bool registerBuffers(const iovec *iov, size_t count);
+
+  // submits what is queued, waits for completions up to timeout,
+  // < 0 forever, and runs their ops, returns how many ran
+  size_t poll(int timeout_ms = -1);
+
+  size_t poll(std::chrono::milliseconds timeout);
+
+  // poll() until stop()
+  void run();
+
+  // thread safe
+  void stop();
+
+  bool stopped() const;
+
+private:
+  // READ only for the waker, recv would fail on an eventfd
+  enum Type : uint8_t { ACCEPT, RECV, SEND, READ };
+
+  // reads the eventfd stop() writes
+  class Waker : public Op {
+  public:
+    void onComplete(int result) override;
+
+    Proactor *owner_ = nullptr;
+    int fd_ = -1;
+    uint64_t count_ = 0;
+  };
+
+  // an operation waiting for its fd on the Reactor path
+  struct Pending {
+    Type type_;
+    char *buf_;
+    size_t len_;
+    Op *op_;
+  };
+
+  class Waiter : public Reactor::Handler {
+  public:
+    void onEvents(uint32_t events) override;
+
+    // runs queue's operations until one would block
+    void run(std::deque<Pending> &queue);
+
+    Proactor *owner_ = nullptr;
+    int fd_ = -1;
+    bool armed_ = false;
+    std::deque<Pending> reads_;
+    std::deque<Pending> writes_;
+  };
+
+  void submit(Type type, int fd, char *buf, size_t len, Op *op);
+
+  // the registered buffer holding [buf, buf + len), -1 for none
+  int bufferOf(const char *buf, size_t len) const;
+
+  // makes sure the reactor watches w's fd
+  void arm(Waiter &w);
+
+  size_t deliver();
+
+  uringimpl::Ring ring_;
+  // fd to its slot in the ring's file table, -1 for none
+  std::vector<int> slots_;
+  std::vector<unsigned> free_slots_;
+  unsigned files_;
+  bool files_registered_ = false;
+  std::vector<iovec> buffers_;
+  Waker waker_;
+
+  std::unique_ptr<Reactor> reactor_;
+  std::unordered_map<int, std::unique_ptr<Waiter> > waiters_;
+
+  // completions known without the kernel, run by the next poll
+  std::vector<std::pair<Op *, int> > done_;
+  std::vector<std::pair<Op *, int> > delivering_;
+
+  std::atomic<bool> stopped_{ false };
+};
+
+inline Proactor::Proactor(unsigned entries, unsigned files, bool use_uring)
+    : files_(files) {
+  if (!use_uring || !ring_.open(entries)) {
+    reactor_.reset(new Reactor);
+    return;
+  }
+  waker_.owner_ = this;
+  waker_.fd_ = ::eventfd(0, EFD_CLOEXEC);
+  MYSPACE_THROW_IF_EX(ProactorError, waker_.fd_ < 0);
+  submit(READ, waker_.fd_, (char *)&waker_.count_, sizeof(waker_.count_),
+         &waker_);
+}
+
+inline Proactor::~Proactor() {
+  if (waker_.fd_ >= 0)
+    ::close(waker_.fd_);
+}
+
+inline bool Proactor::uring() const { return !reactor_; }
+
+inline void Proactor::accept(int fd, Op *op) {
+  submit(ACCEPT, fd, nullptr, 0, op);
+}
+
+inline void Proactor::recv(int fd, char *buf, size_t len, Op *op) {
+  submit(RECV, fd, buf, len, op);
+}
+
+inline void Proactor::send(int fd, const char *buf, size_t len, Op *op) {
+  submit(SEND, fd, (char *)buf, len, op);
+}
+
+inline void Proactor::submit(Type type, int fd, char *buf, size_t len,
+                             Op *op) {
+  if (reactor_) {
+    auto &w = waiters_[fd];
+    if (!w) {
+      w.reset(new Waiter);
+      w->owner_ = this;
+      w->fd_ = fd;
+    }
+    // accept4 must not block when another process took the connection
+    if (type == ACCEPT)
+      SocketOpt::setBlock(fd, false);
+    auto &queue = type == SEND ? w->writes_ : w->reads_;
+    queue.push_back({ type, buf, len, op });
+    // tried right away, only what would block waits for the fd
+    if (queue.size() == 1) {
+      w->run(queue);
+      if (!queue.empty())
+        arm(*w);
+    }
+    return;
+  }
+#if defined(MYSPACE_HAS_URING)
+  auto e = ring_.sqe();
+  if (!e) {
+    done_.emplace_back(op, -EBUSY);
+    return;
+  }
+  e->fd = fd;
+  if ((size_t)fd < slots_.size() && slots_[fd] >= 0) {
+    e->fd = slots_[fd];
+    e->flags |= IOSQE_FIXED_FILE;
+  }
+  e->user_data = (uint64_t)(uintptr_t)op;
+  e->addr = (uint64_t)(uintptr_t)buf;
+  e->len = (uint32_t)len;
+  switch (type) {
+  case ACCEPT:
+    e->opcode = IORING_OP_ACCEPT;
+    e->accept_flags = SOCK_CLOEXEC;
+    break;
+  case RECV: {
+    auto index = bufferOf(buf, len);
+    if (index >= 0) {
+      // a socket has no position, -1 reads like read(2)
+      e->opcode = IORING_OP_READ_FIXED;
+      e->off = (uint64_t)-1;
+      e->buf_index = (uint16_t)index;
+    } else {
+      e->opcode = IORING_OP_RECV;
+    }
+    break;
+  }
+  case SEND:
+    // not WRITE_FIXED, a write(2) to a closed peer raises SIGPIPE
+    e->opcode = IORING_OP_SEND;
+    e->msg_flags = MSG_NOSIGNAL;
+    break;
+  case READ:
+    e->opcode = IORING_OP_READ;
+    e->off = (uint64_t)-1;
+    break;
+  }
+#endif
+}
+
+inline int Proactor::bufferOf(const char *buf, size_t len) const {
+  for (size_t i = 0; i < buffers_.size(); ++i) {
+    auto begin = (const char *)buffers_[i].iov_base;
+    if (buf >= begin && buf + len <= begin + buffers_[i].iov_len)
+      return (int)i;
+  }
+  return -1;
+}
+
+inline void Proactor::cancel(Op *op) {
+  if (reactor_) {
+    for (auto &kv : waiters_) {
+      auto &w = *kv.second;
+      for (auto queue : { &w.reads_, &w.writes_ }) {
+        for (auto itr = queue->begin(); itr != queue->end(); ++itr) {
+          if (itr->op_ == op) {
+            queue->erase(itr);
+            done_.emplace_back(op, -ECANCELED);
+            return;
+          }
+        }
+      }
+    }
+    return;
+  }
+#if defined(MYSPACE_HAS_URING)
+  auto e = ring_.sqe();
+  if (!e)
+    return;
+  e->opcode = IORING_OP_ASYNC_CANCEL;
+  e->fd = -1;
+  e->addr = (uint64_t)(uintptr_t)op;
+  e->user_data = 0;
+#endif
+}
+
+inline void Proactor::close(int fd) {
+  unregisterFile(fd);
+  if (reactor_) {
+    auto itr = waiters_.find(fd);
+    if (itr != waiters_.end()) {
+      reactor_->del(fd, itr->second.get());
+      waiters_.erase(itr);
+    }
+  }
+  ::close(fd);
+}
+
+inline bool Proactor::registerFile(int fd) {
+  if (reactor_ || fd < 0)
+    return !!reactor_;
+  if (!files_registered_) {
+    std::vector<int> table(files_, -1);
+    if (files_ == 0 || ring_.registerFiles(table.data(), files_) < 0)
+      return false;
+    files_registered_ = true;
+    for (auto i = files_; i > 0; --i)
+      free_slots_.push_back(i - 1);
+  }
+  if ((size_t)fd < slots_.size() && slots_[fd] >= 0)
+    return true;
+  if (free_slots_.empty())
+    return false;
+  auto slot = free_slots_.back();
+  if (ring_.updateFile(slot, fd) < 0)
+    return false;
+  free_slots_.pop_back();
+  if ((size_t)fd >= slots_.size())
+    slots_.resize(fd + 1, -1);
+  slots_[fd] = (int)slot;
+  return true;
+}
+
+inline void Proactor::unregisterFile(int fd) {
+  if (reactor_ || fd < 0 || (size_t)fd >= slots_.size() || slots_[fd] < 0)
+    return;
+  auto slot = (unsigned)slots_[fd];
+  ring_.updateFile(slot, -1);
+  slots_[fd] = -1;
+  free_slots_.push_back(slot);
+}
+
+inline bool Proactor::registerBuffers(const iovec *iov, size_t count) {
+  if (reactor_)
+    return true;
+  if (!buffers_.empty() || count == 0 ||
+      ring_.registerBuffers(iov, (unsigned)count) < 0)
+    return false;
+  buffers_.assign(iov, iov + count);
+  return true;
+}
+
+inline size_t Proactor::poll(std::chrono::milliseconds timeout) {
+  auto ms = timeout.count();
+  if (ms > std::numeric_limits<int>::max())
+    ms = std::numeric_limits<int>::max();
+  return poll(ms < 0 ? -1 : (int)ms);
+}
+
+inline size_t Proactor::poll(int timeout_ms) {
+  if (!done_.empty())
+    timeout_ms = 0;
+  size_t handled = 0;
+  if (reactor_) {
+    reactor_->poll(timeout_ms);
+    return deliver();
+  }
+  MYSPACE_THROW_IF_EX(ProactorError, !ring_.enter(1, timeout_ms));
+  handled += deliver();
+#if defined(MYSPACE_HAS_URING)
+  ring_.reap([&](const io_uring_cqe &cqe) {
+    // cancels and the like complete nothing of their own
+    if (cqe.user_data == 0)
+      return;
+    auto op = (Op *)(uintptr_t)cqe.user_data;
+    if (op != &waker_)
+      ++handled;
+    try {
+      op->onComplete(cqe.res);
+    }
+    catch (...) {
+      MYSPACE_WARN_EXCEPTION();
+    }
+  });
+#endif
+  return handled;
+}
+
+inline size_t Proactor::deliver() {
+  if (done_.empty())
+    return 0;
+  delivering_.swap(done_);
+  for (auto &d : delivering_) {
+    try {
+      d.first->onComplete(d.second);
+    }
+    catch (...) {
+      MYSPACE_WARN_EXCEPTION();
+    }
+  }
+  auto n = delivering_.size();
+  delivering_.clear();
+  return n;
+}
+
+inline void Proactor::run() {
+  while (!stopped())
+    poll(-1);
+}
+
+inline void Proactor::stop() {
+  stopped_.store(true);
+  if (reactor_) {
+    reactor_->stop();
+    return;
+  }
+  uint64_t one = 1;
+  while (::write(waker_.fd_, &one, sizeof(one)) < 0 && errno == EINTR)
+    ;
+}
+
+inline bool Proactor::stopped() const { return stopped_.load(); }
+
+inline void Proactor::Waker::onComplete(int) {
+  owner_->submit(READ, fd_, (char *)&count_, sizeof(count_), this);
+}
+
+inline void Proactor::arm(Waiter &w) {
+  // edge triggered, so the fd stays registered until close() and an
+  // operation costs no epoll_ctl
+  if (w.armed_)
+    return;
+  w.armed_ = reactor_->add(w.fd_, &w,
+                           Reactor::READABLE | Reactor::WRITABLE |
+                               Reactor::HANGUP | Reactor::EDGE);
+  if (w.armed_)
+    return;
+  auto e = -errno;
+  for (auto queue : { &w.reads_, &w.writes_ }) {
+    for (auto &p : *queue)
+      done_.emplace_back(p.op_, e);
+    queue->clear();
+  }
+}
+
+inline void Proactor::Waiter::onEvents(uint32_t events) {
+  auto failed = events & (Reactor::HANGUP | Reactor::ERROR);
+  if (failed || (events & Reactor::READABLE))
+    run(reads_);
+  if (failed || (events & Reactor::WRITABLE))
+    run(writes_);
+}
+
+inline void Proactor::Waiter::run(std::deque<Pending> &queue) {
+  while (!queue.empty()) {
+    auto &p = queue.front();
+    ssize_t n = 0;
+    switch (p.type_) {
+    case ACCEPT:
+      n = ::accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      break;
+    case RECV:
+      n = ::recv(fd_, p.buf_, p.len_, MSG_DONTWAIT);
+      break;
+    case SEND:
+      n = ::send(fd_, p.buf_, p.len_, MSG_DONTWAIT | MSG_NOSIGNAL);
+      break;
+    case READ:
+      n = ::read(fd_, p.buf_, p.len_);
+      break;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+      return;
+    owner_->done_.emplace_back(p.op_, n < 0 ? -errno : (int)n);
+    queue.pop_front();
+  }
+}
+
+MYSPACE_END
+
+#endif
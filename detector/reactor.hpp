@@ -0,0 +1,256 @@
+#pragma once
+
+#include "myspace/_/stdafx.hpp"
+
+#if defined(MYSPACE_LINUX)
+
+#include "myspace/defer/defer.hpp"
+#include "myspace/exception/exception.hpp"
+#include "myspace/logger/logger.hpp"
+#include "myspace/mutex/mutex.hpp"
+#include "myspace/time/wheel.hpp"
+
+MYSPACE_BEGIN
+
+MYSPACE_EXCEPTION_DEFINE(ReactorError, myspace::Exception)
+
+// epoll event loop that calls handlers directly.
+// each fd is registered with a Handler, which goes into epoll_event.data.ptr,
+// so a ready event costs no lookup, and the event buffer is reused across
+// waits, so a loop iteration allocates nothing.
+// timers live in a TimerWheel whose next expiry bounds the epoll_wait
+// timeout, so idle and retransmit timeouts cost no fd or syscall of their own.
+// add/mod/del/poll/run/timers belong to the loop thread,
+// post() and stop() may be called from anywhere
+class Reactor {
+public:
+  enum Event : uint32_t {
+    READABLE = EPOLLIN,
+    WRITABLE = EPOLLOUT,
+    // peer closed its write side
+    HANGUP = EPOLLRDHUP | EPOLLHUP,
+    ERROR = EPOLLERR,
+    // report only changes in readiness, the handler must drain to EAGAIN
+    EDGE = EPOLLET,
+    // disarm after one report, mod() arms it again
+    ONESHOT = EPOLLONESHOT,
+  };
+
+  class Handler {
+  public:
+    virtual ~Handler() {}
+
+    // events is a mask of Event
+    virtual void onEvents(uint32_t events) = 0;
+  };
+
+  // batch, most events handled per epoll_wait
+  explicit Reactor(size_t batch = 256);
+
+  Reactor(const Reactor &) = delete;
+  Reactor &operator=(const Reactor &) = delete;
+
+  ~Reactor();
+
+  // the handler must stay alive until del(),
+  // the fd is left in the blocking mode it is in
+  bool add(int fd, Handler *handler, uint32_t events = READABLE);
+
+  bool mod(int fd, Handler *handler, uint32_t events);
+
+  // safe from within a handler, events of this batch still pending for the
+  // handler are dropped, so it may be deleted right after
+  void del(int fd, Handler *handler);
+
+  // one epoll_wait and its handlers, then due timers, then posted
+  // functions, the wait ends early for a timer, timeout < 0 waits forever,
+  // returns the events and timers handled
+  size_t poll(std::chrono::milliseconds timeout);
+
+  size_t poll(int timeout_ms = -1);
+
+  // poll() until stop()
+  void run();
+
+  // thread safe, run() returns after its current iteration
+  void stop();
+
+  // thread safe, f runs on the loop thread after the current iteration
+  void post(std::function<void()> f);
+
+  // thread safe, a poll() in progress or the next one returns at once
+  void wake();
+
+  bool stopped() const;
+
+  // timers run by poll(), from another thread schedule them through post()
+  TimerWheel &timers();
+
+  // the epoll descriptor, readable when events are ready, for nesting
+  // in another loop
+  int fd() const;
+
+private:
+  // reads the eventfd, posted functions run after dispatch
+  class Waker : public Handler {
+  public:
+    void onEvents(uint32_t) override;
+
+    int fd_ = -1;
+  };
+
+  void runPosted();
+
+  int epoll_ = -1;
+
+  std::vector<epoll_event> events_;
+  // events_[next_, ready_) are waiting for dispatch
+  size_t next_ = 0;
+  size_t ready_ = 0;
+
+  Waker waker_;
+  // whether the eventfd was written since the loop last read it
+  std::atomic<bool> woken_{ false };
+  std::atomic<bool> stopped_{ false };
+
+  TimerWheel timers_;
+
+  std::mutex post_mtx_;
+  std::vector<std::function<void()> > posted_;
+  // swapped with posted_, keeps its capacity
+  std::vector<std::function<void()> > running_;
+};
+
+inline Reactor::Reactor(size_t batch)
+    : epoll_(::epoll_create1(EPOLL_CLOEXEC)),
+      events_(std::max<size_t>(batch, 1)) {
+  MYSPACE_THROW_IF_EX(ReactorError, epoll_ < 0);
+  waker_.fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (waker_.fd_ < 0 || !add(waker_.fd_, &waker_)) {
+    if (waker_.fd_ >= 0)
+      ::close(waker_.fd_);
+    ::close(epoll_);
+    MYSPACE_THROW_EX(ReactorError);
+  }
+}
+
+inline Reactor::~Reactor() {
+  ::close(waker_.fd_);
+  ::close(epoll_);
+}
+
+inline bool Reactor::add(int fd, Handler *handler, uint32_t events) {
+  epoll_event ev;
+  ev.events = events;
+  ev.data.ptr = handler;
+  return 0 == ::epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev);
+}
+
+inline bool Reactor::mod(int fd, Handler *handler, uint32_t events) {
+  epoll_event ev;
+  ev.events = events;
+  ev.data.ptr = handler;
+  return 0 == ::epoll_ctl(epoll_, EPOLL_CTL_MOD, fd, &ev);
+}
+
+inline void Reactor::del(int fd, Handler *handler) {
+  epoll_event ev;
+  ::epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, &ev);
+  for (auto i = next_; i < ready_; ++i)
+    if (events_[i].data.ptr == handler)
+      events_[i].data.ptr = nullptr;
+}
+
+inline size_t Reactor::poll(std::chrono::milliseconds timeout) {
+  auto ms = timeout.count();
+  if (ms > std::numeric_limits<int>::max())
+    ms = std::numeric_limits<int>::max();
+  return poll(ms < 0 ? -1 : (int)ms);
+}
+
+inline size_t Reactor::poll(int timeout_ms) {
+  if (!timers_.empty()) {
+    auto due = timers_.timeout();
+    if (timeout_ms < 0 || due < timeout_ms)
+      timeout_ms = due;
+  }
+  auto n = ::epoll_wait(epoll_, events_.data(), (int)events_.size(),
+                        timeout_ms);
+  if (n < 0) {
+    MYSPACE_THROW_IF_EX(ReactorError, errno != EINTR);
+    n = 0;
+  }
+  size_t handled = 0;
+  ready_ = n;
+  for (next_ = 0; next_ < ready_;) {
+    auto &ev = events_[next_++];
+    if (auto handler = static_cast<Handler *>(ev.data.ptr)) {
+      handler->onEvents(ev.events);
+      ++handled;
+    }
+  }
+  next_ = ready_ = 0;
+  if (!timers_.empty())
+    handled += timers_.expire();
+  runPosted();
+  // a full buffer means more may be ready, grow for the next round
+  if ((size_t)n == events_.size() && events_.size() < 4096)
+    events_.resize(events_.size() * 2);
+  return handled;
+}
+
+inline void Reactor::run() {
+  while (!stopped())
+    poll(-1);
+}
+
+inline void Reactor::stop() {
+  stopped_.store(true);
+  wake();
+}
+
+inline bool Reactor::stopped() const { return stopped_.load(); }
+
+inline TimerWheel &Reactor::timers() { return timers_; }
+
+inline int Reactor::fd() const { return epoll_; }
+
+inline void Reactor::post(std::function<void()> f) {
+  MYSPACE_IF_LOCK(post_mtx_) { posted_.push_back(std::move(f)); }
+  wake();
+}
+
+inline void Reactor::wake() {
+  if (woken_.exchange(true))
+    return;
+  uint64_t one = 1;
+  while (::write(waker_.fd_, &one, sizeof(one)) < 0 && errno == EINTR)
+    ;
+}
+
+inline void Reactor::Waker::onEvents(uint32_t) {
+  uint64_t count;
+  while (::read(fd_, &count, sizeof(count)) < 0 && errno == EINTR)
+    ;
+}
+
+inline void Reactor::runPosted() {
+  if (!woken_.load(std::memory_order_relaxed))
+    return;
+  // cleared before taking the queue, a later post() writes the eventfd again
+  woken_.store(false);
+  MYSPACE_IF_LOCK(post_mtx_) { running_.swap(posted_); }
+  for (auto &f : running_) {
+    try {
+      f();
+    }
+    catch (...) {
+      MYSPACE_WARN_EXCEPTION();
+    }
+  }
+  running_.clear();
+}
+
+MYSPACE_END
+
+#endif
@@ -277,7 +277,12 @@ public:
   double &numberValue() override { return value_; }
   std::string dump() const override {
     std::stringstream ss;
-    ss << value_;
+    // integers print exactly, counters beyond 1e6 would lose digits
+    if (value_ < 9007199254740992.0 && value_ > -9007199254740992.0 &&
+        value_ == (double)(int64_t)value_)
+      ss << (int64_t)value_;
+    else
+      ss << value_;
     return ss.str();
   }
   std::shared_ptr<JsonValue> clone() const override {
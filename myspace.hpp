@@ -9,8 +9,11 @@
 #include "myspace/concurrency/factory.hpp"
 #include "myspace/config/config.hpp"
 #include "myspace/coroutine/coroutine.hpp"
+#include "myspace/coroutine/scheduler.hpp"
 #include "myspace/defer/defer.hpp"
 #include "myspace/detector/detector.hpp"
+#include "myspace/detector/proactor.hpp"
+#include "myspace/detector/reactor.hpp"
 #include "myspace/dns/query.hpp"
 #include "myspace/error/error.hpp"
 #include "myspace/exception/exception.hpp"
@@ -21,14 +24,19 @@
 #include "myspace/net/netstream.hpp"
 #include "myspace/net/socketopt.hpp"
 #include "myspace/net/tcp/accepter.hpp"
+#include "myspace/net/tcp/server.hpp"
 #include "myspace/net/tcp/socket.hpp"
+#include "myspace/net/udp/batch.hpp"
+#include "myspace/net/udp/server.hpp"
 #include "myspace/net/udp/socket.hpp"
 #include "myspace/os/os.hpp"
 #include "myspace/pool/pool.hpp"
 #include "myspace/process/process.hpp"
 #include "myspace/strings/sstream.hpp"
 #include "myspace/strings/strings.hpp"
+#include "myspace/threadpool/taskgroup.hpp"
 #include "myspace/threadpool/threadpool.hpp"
+#include "myspace/time/wheel.hpp"
 #include "myspace/uuid/uuid.hpp"
 #include "myspace/vad/energyvad.hpp"
 #include "myspace/wav/file.hpp"
@@ -0,0 +1,190 @@
+#pragma once
+
+#include "myspace/_/stdafx.hpp"
+
+MYSPACE_BEGIN
+
+// read only view of bytes owned by someone else, valid until the owner
+// changes them
+class Slice {
+public:
+  Slice() {}
+
+  Slice(const char *data, size_t size) : data_(data), size_(size) {}
+
+  const char *data() const { return data_; }
+
+  size_t size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  char operator[](size_t i) const { return data_[i]; }
+
+  std::string toString() const { return std::string(data_, size_); }
+
+private:
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+namespace netimpl {
+
+// input buffer of a stream socket, bytes live in [head_, tail_) of one
+// block, which is compacted or grown only when the tail runs out of room.
+// a read goes with readv into the caller's memory first, then into the
+// spare room, then into a block of the thread, so it takes big chunks
+// without the buffer holding big blocks up front
+class Buffer {
+public:
+  enum { MIN_SPARE = 4096, EXTRA = 64 * 1024 };
+
+  const char *data() const { return block_.get() + head_; }
+
+  size_t size() const { return tail_ - head_; }
+
+  bool empty() const { return head_ == tail_; }
+
+  Slice slice() const { return Slice(data(), size()); }
+
+  void consume(size_t n) {
+    head_ += std::min(n, size());
+    if (head_ == tail_)
+      head_ = tail_ = 0;
+  }
+
+  void clear() { head_ = tail_ = 0; }
+
+  // moves up to len bytes out, returns how many
+  size_t take(char *out, size_t len) {
+    len = std::min(len, size());
+    if (len > 0)
+      ::memcpy(out, data(), len);
+    consume(len);
+    return len;
+  }
+
+  // moves everything out
+  void takeAll(std::string &out) {
+    out.append(data(), size());
+    consume(size());
+  }
+
+  // offset of the first n bytes equal to p at or after from, or npos.
+  // memchr skips to candidates of the first byte, which libc does with
+  // wide loads, so a scan costs far less than a byte loop
+  size_t find(const char *p, size_t n, size_t from = 0) const;
+
+  // one read of fd, the first direct_len bytes land in direct, the rest
+  // here, returns what ::readv returned, direct_n gets the bytes in direct
+  int64_t readFrom(int fd, char *direct, size_t direct_len, size_t &direct_n);
+
+private:
+  // room for n more at the tail
+  void reserve(size_t n);
+
+  // EXTRA bytes per thread, kept off the stack, which a coroutine has
+  // little of, the bytes are copied out before anything else reads
+  static char *extra();
+
+  void append(const char *p, size_t n) {
+    reserve(n);
+    ::memcpy(block_.get() + tail_, p, n);
+    tail_ += n;
+  }
+
+  std::unique_ptr<char[]> block_;
+  size_t capacity_ = 0;
+  size_t head_ = 0;
+  size_t tail_ = 0;
+};
+
+inline void Buffer::reserve(size_t n) {
+  if (capacity_ - tail_ >= n)
+    return;
+  auto used = size();
+  if (capacity_ >= used + n) {
+    ::memmove(block_.get(), data(), used);
+  } else {
+    auto capacity = std::max<size_t>(capacity_ * 2, MIN_SPARE);
+    while (capacity < used + n)
+      capacity *= 2;
+    std::unique_ptr<char[]> block(new char[capacity]);
+    if (used > 0)
+      ::memcpy(block.get(), data(), used);
+    block_.swap(block);
+    capacity_ = capacity;
+  }
+  head_ = 0;
+  tail_ = used;
+}
+
+inline char *Buffer::extra() {
+  static thread_local std::unique_ptr<char[]> block;
+  if (!block)
+    block.reset(new char[EXTRA]);
+  return block.get();
+}
+
+inline size_t Buffer::find(const char *p, size_t n, size_t from) const {
+  if (n == 0)
+    return from <= size() ? from : std::string::npos;
+  auto begin = data();
+  auto end = begin + size();
+  auto cur = begin + std::min(from, size());
+  while ((size_t)(end - cur) >= n) {
+    auto hit = (const char *)::memchr(cur, p[0], end - cur - n + 1);
+    if (!hit)
+      break;
+    if (::memcmp(hit + 1, p + 1, n - 1) == 0)
+      return hit - begin;
+    cur = hit + 1;
+  }
+  return std::string::npos;
+}
+
+inline int64_t Buffer::readFrom(int fd, char *direct, size_t direct_len,
+                                size_t &direct_n) {
+  direct_n = 0;
+#if defined(MYSPACE_WINDOWS)
+  if (direct_len > 0) {
+    auto n = ::recv(fd, direct, (int)direct_len, 0);
+    if (n > 0)
+      direct_n = n;
+    return n;
+  }
+  reserve(MIN_SPARE);
+  auto n = ::recv(fd, block_.get() + tail_, (int)(capacity_ - tail_), 0);
+  if (n > 0)
+    tail_ += n;
+  return n;
+#else
+  // a read straight into the caller's memory needs no block of its own
+  if (direct_len == 0 || !empty())
+    reserve(MIN_SPARE);
+  auto extra = Buffer::extra();
+  iovec iov[3];
+  int count = 0;
+  if (direct_len > 0)
+    iov[count++] = { direct, direct_len };
+  auto spare = capacity_ - tail_;
+  if (spare > 0)
+    iov[count++] = { block_.get() + tail_, spare };
+  iov[count++] = { extra, EXTRA };
+  auto n = ::readv(fd, iov, count);
+  if (n <= 0)
+    return n;
+  size_t rest = n;
+  direct_n = std::min(rest, direct_len);
+  rest -= direct_n;
+  auto into_spare = std::min(rest, spare);
+  tail_ += into_spare;
+  rest -= into_spare;
+  if (rest > 0)
+    append(extra, rest);
+  return n;
+#endif
+}
+
+} // namespace netimpl
+
+MYSPACE_END
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "myspace/_/stdafx.hpp"
+#include "myspace/net/_/buffer.hpp"
 #include "myspace/net/socketopt.hpp"
 MYSPACE_BEGIN
 
@@ -44,8 +45,15 @@ protected:
 
   int getSockError();
 
+  // fcntl only when the mode changes
+  void setBlock(bool f);
+
 protected:
   int sock_ = -1;
+  // the mode last set, -1 unknown
+  int block_ = -1;
+  // stream sockets read ahead into it
+  netimpl::Buffer in_;
   int family_;
   int type_;
   int protocal_;
@@ -75,7 +83,7 @@ inline void Socketbase::connect(
   peer_ = addr;
   this->close();
   sock_ = (int)::socket(family_, type_, protocal_);
-  SocketOpt::setBlock(sock_, false);
+  setBlock(false);
   for (auto this_time = std::chrono::high_resolution_clock::now(),
             begin_time = this_time;
        this_time - begin_time <= timeout;
@@ -94,9 +102,7 @@ inline void Socketbase::connect(
              e == std::errc::operation_in_progress ||
              e == std::errc::operation_would_block ||
              e == std::errc::interrupted) {
-      auto sel = newShared<Detector>();
-      sel->add(this, DetectType::WRITE);
-      sel->wait(timeout - (this_time - begin_time));
+      SocketOpt::wait(sock_, true, timeout - (this_time - begin_time));
     } else {
       MYSPACE_THROW_EX(SocketError);
     }
@@ -107,7 +113,7 @@ inline void Socketbase::connect(const Addr &addr) noexcept(false) {
   peer_ = addr;
   this->close();
   sock_ = (int)::socket(family_, type_, protocal_);
-  SocketOpt::setBlock(sock_, true);
+  setBlock(true);
   for (;;) {
     auto n =
         ::connect(sock_, (const sockaddr *)&peer_.addr(), sizeof(peer_.addr()));
@@ -117,15 +123,16 @@ inline void Socketbase::connect(const Addr &addr) noexcept(false) {
       return;
     }
     auto e = Error::lastError();
-    if (e == std::errc::already_connected)
+    // a nonblocking connect, as in a coroutine, ends here
+    if (e == std::errc::already_connected) {
+      local_ = Addr::local(sock_);
+      peer_ = Addr::peer(sock_);
       return;
-    else if (e == std::errc::connection_already_in_progress ||
-             e == std::errc::operation_in_progress ||
-             e == std::errc::operation_would_block ||
-             e == std::errc::interrupted) {
-      auto sel = newShared<Detector>();
-      sel->add(this, DetectType::WRITE);
-      sel->wait();
+    } else if (e == std::errc::connection_already_in_progress ||
+               e == std::errc::operation_in_progress ||
+               e == std::errc::operation_would_block ||
+               e == std::errc::interrupted) {
+      SocketOpt::wait(sock_, true);
     } else {
       MYSPACE_THROW_EX(SocketError);
     }
@@ -159,6 +166,17 @@ inline int Socketbase::getFd() const { return sock_; }
 inline void Socketbase::close() {
   Socketbase::close(sock_);
   sock_ = -1;
+  block_ = -1;
+  in_.clear();
+}
+
+inline void Socketbase::setBlock(bool f) {
+  // the mode SocketOpt::setBlock really sets
+  f = f && !socketoptimpl::parker();
+  if (block_ == (int)f)
+    return;
+  SocketOpt::setBlock(sock_, f);
+  block_ = (int)f;
 }
 
 inline void Socketbase::close(int sock) {
@@ -5,14 +5,46 @@
 
 MYSPACE_BEGIN
 
+namespace socketoptimpl {
+// set on a thread while it runs a coroutine, which then parks on the fd
+// instead of blocking the thread, see Scheduler
+class Parker {
+public:
+  virtual ~Parker() {}
+
+  // false on timeout, ms < 0 waits forever
+  virtual bool park(int fd, bool write, int ms) = 0;
+};
+
+inline Parker *&parker() {
+  static thread_local Parker *p = nullptr;
+  return p;
+}
+} // namespace socketoptimpl
+
 class SocketOpt {
 public:
+  // within a coroutine the fd stays nonblocking, a blocking call parks the
+  // coroutine in wait() on EAGAIN
   static void setBlock(int fd, bool f);
 
+  // waits on the single fd until it is readable, or writable if write,
+  // false on timeout
+  static bool wait(int fd, bool write);
+
+  static bool wait(int fd, bool write,
+                   std::chrono::high_resolution_clock::duration timeout);
+
   static void reuseAddr(int sock, bool f);
+
+  // several sockets may bind the same port, the kernel spreads connections
+  // over them
+  static void reusePort(int sock, bool f);
 };
 
 inline void SocketOpt::setBlock(int fd, bool f) {
+  if (socketoptimpl::parker())
+    f = false;
 #if defined(MYSPACE_LINUX)
   auto flags = ::fcntl(fd, F_GETFL, 0);
   if (!f)
@@ -26,9 +58,54 @@ inline void SocketOpt::setBlock(int fd, bool f) {
 #endif
 }
 
+namespace socketoptimpl {
+inline bool poll(int fd, bool write, int ms) {
+  // a zero timeout only checks, which needs no parking
+  auto p = parker();
+  if (p && ms != 0)
+    return p->park(fd, write, ms);
+#if defined(MYSPACE_WINDOWS)
+  WSAPOLLFD pfd;
+  pfd.fd = fd;
+  pfd.events = (write ? POLLOUT : POLLIN);
+  pfd.revents = 0;
+  return ::WSAPoll(&pfd, 1, ms) > 0;
+#else
+  pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = (write ? POLLOUT : POLLIN);
+  pfd.revents = 0;
+  return ::poll(&pfd, 1, ms) > 0;
+#endif
+}
+} // namespace socketoptimpl
+
+inline bool SocketOpt::wait(int fd, bool write) {
+  return socketoptimpl::poll(fd, write, -1);
+}
+
+inline bool
+SocketOpt::wait(int fd, bool write,
+                std::chrono::high_resolution_clock::duration timeout) {
+  // rounded up, so a sub millisecond rest does not spin
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout)
+                .count();
+  auto ms = ns <= 0 ? 0 : (ns + 999999) / 1000000;
+  if (ms > std::numeric_limits<int>::max())
+    ms = std::numeric_limits<int>::max();
+  return socketoptimpl::poll(fd, write, (int)ms);
+}
+
 inline void SocketOpt::reuseAddr(int sock, bool f) {
   int on = (f ? 1 : 0);
   ::setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *)&on, sizeof(on));
 }
 
+inline void SocketOpt::reusePort(int sock, bool f) {
+#if defined(SO_REUSEPORT)
+  int on = (f ? 1 : 0);
+  ::setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (char *)&on, sizeof(on));
+#endif
+}
+
 MYSPACE_END
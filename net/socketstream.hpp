@@ -4,6 +4,7 @@
 #include "myspace/_/stdafx.hpp"
 #include "myspace/codec/codec.hpp"
 #include "myspace/exception/exception.hpp"
+#include "myspace/net/tcp/socket.hpp"
 #include "myspace/net/udp/socket.hpp"
 #include "myspace/time/time.hpp"
 
@@ -50,6 +51,10 @@ public:
   // hold : append to send buffer , but no write, until next call send, or
   //        flush, or destructor
   // send : append to send buffer, and send the buffer
+  // the buffer is a queue of pieces written with one gathering send,
+  // small holds are copied together, large moved strings and holdRef()
+  // keep their own memory, so a header and its body go out in one write
+  // without the body being copied
   template <class X> SocketStream &operator<<(const X &x) noexcept(false);
   template <class X> void send(const X &x) noexcept(false);
   template <class X> void hold(const X &x) noexcept(false);
@@ -58,6 +63,10 @@ public:
   // unsizeable
   template <class X> void send(const X &x, size_t len) noexcept(false);
   template <class X> void hold(const X &x, size_t len) noexcept(false);
+  void hold(std::string &&x) noexcept(false);
+  // by reference, x must stay untouched until it is flushed
+  void holdRef(const char *data, size_t len) noexcept(false);
+  void holdRef(const std::string &x) noexcept(false);
   void flush();
   size_t holdSize() const;
 
@@ -66,14 +75,42 @@ private:
   template <class X> X &toX(X &x, size_t len);
   template <class X> size_t getLen(size_t len);
   void purchase(size_t len);
+  // the queued piece at the back, open for small copies
+  std::string &tail();
+  // n bytes from the front of the queue went out
+  void drop(size_t n);
+  // nothing left to send, keeps one open piece for its capacity
+  void reset();
+  // copies a still queued reference to data, whose owner goes away
+  void own(const char *data);
 
 private:
+  // pieces shorter than this are copied, a separate iovec costs more
+  enum { COPY_MAX = 256 };
+
+  // bytes of the send queue, in own_, or in ref_ [0, size_) of the caller
+  struct Piece {
+    std::string own_;
+    const char *ref_ = nullptr;
+    size_t size_ = 0;
+    // small holds may be appended, never so for moved in strings
+    bool open_ = false;
+
+    const char *data() const { return ref_ ? ref_ : own_.data(); }
+    size_t size() const { return ref_ ? size_ : own_.size(); }
+  };
+
   bool big_endian_ = true;
   bool use_timeout_ = false;
   std::chrono::high_resolution_clock::duration timeout_;
   std::shared_ptr<SockType> sock_;
   std::string recvstr_;
-  std::string sendstr_;
+  std::deque<Piece> sendq_;
+  // bytes of the front piece already sent
+  size_t sendoff_ = 0;
+  size_t holdn_ = 0;
+  // reused by flush
+  std::vector<Slice> slices_;
 };
 
 namespace socketstreamimpl {
@@ -256,30 +293,123 @@ inline X &SocketStream<SockType>::toX(X &x, size_t len) {
 template <class SockType>
 template <class X>
 inline void SocketStream<SockType>::send(const X &x) noexcept(false) {
-  if (!use_timeout_)
-    sock_->send(socketstreamimpl::toString(x, big_endian_));
-  else {
-    timeout_ -= Time::costs([&]() {
-      sock_->send(socketstreamimpl::toString(x, big_endian_), timeout_);
-    });
+  const auto &str = socketstreamimpl::toString(x, big_endian_);
+  holdRef(str);
+  try {
+    flush();
   }
+  catch (...) {
+    own(str.data());
+    throw;
+  }
+  own(str.data());
 }
 
 template <class SockType> inline void SocketStream<SockType>::flush() {
+  if (holdn_ == 0) {
+    reset();
+    return;
+  }
+  slices_.clear();
+  for (auto &p : sendq_) {
+    auto skip = slices_.empty() ? sendoff_ : 0;
+    slices_.push_back(Slice(p.data() + skip, p.size() - skip));
+  }
   size_t sendn = 0;
   if (use_timeout_) {
-    timeout_ -= Time::costs([&]() { sendn = sock_->send(sendstr_, timeout_); });
-    MYSPACE_THROW_IF_EX(TimeOut, sendn != sendstr_.size());
+    timeout_ -= Time::costs([&]() {
+      sendn = sock_->send(slices_.data(), slices_.size(), timeout_);
+    });
+    drop(sendn);
+    MYSPACE_THROW_IF_EX(TimeOut, holdn_ != 0);
   } else {
-    sendn = sock_->send(sendstr_);
+    sendn = sock_->send(slices_.data(), slices_.size());
+    drop(sendn);
+  }
+}
+
+template <class SockType>
+inline void SocketStream<SockType>::drop(size_t n) {
+  holdn_ -= n;
+  if (holdn_ == 0) {
+    reset();
+    return;
+  }
+  while (n > 0) {
+    auto left = sendq_.front().size() - sendoff_;
+    if (n < left) {
+      sendoff_ += n;
+      return;
+    }
+    n -= left;
+    sendq_.pop_front();
+    sendoff_ = 0;
+  }
+}
+
+template <class SockType> inline void SocketStream<SockType>::reset() {
+  while (!sendq_.empty() && !sendq_.front().open_)
+    sendq_.pop_front();
+  sendq_.resize(std::min<size_t>(sendq_.size(), 1));
+  if (!sendq_.empty())
+    sendq_.front().own_.clear();
+  sendoff_ = 0;
+}
+
+template <class SockType>
+inline void SocketStream<SockType>::own(const char *data) {
+  if (sendq_.empty() || sendq_.back().ref_ != data)
+    return;
+  auto &p = sendq_.back();
+  p.own_.assign(p.ref_, p.size_);
+  p.ref_ = nullptr;
+}
+
+template <class SockType>
+inline std::string &SocketStream<SockType>::tail() {
+  if (sendq_.empty() || !sendq_.back().open_) {
+    sendq_.emplace_back();
+    sendq_.back().open_ = true;
   }
-  sendstr_.erase(0, sendn);
+  return sendq_.back().own_;
 }
 
 template <class SockType>
 template <class X>
 inline void SocketStream<SockType>::hold(const X &x) noexcept(false) {
-  sendstr_.append(socketstreamimpl::toString(x, big_endian_));
+  const auto &str = socketstreamimpl::toString(x, big_endian_);
+  tail().append(str);
+  holdn_ += str.size();
+}
+
+template <class SockType>
+inline void SocketStream<SockType>::hold(std::string &&x) noexcept(false) {
+  if (x.size() < COPY_MAX) {
+    hold(x);
+    return;
+  }
+  holdn_ += x.size();
+  sendq_.emplace_back();
+  sendq_.back().own_.swap(x);
+}
+
+template <class SockType>
+inline void SocketStream<SockType>::holdRef(const char *data,
+                                            size_t len) noexcept(false) {
+  if (len < COPY_MAX) {
+    tail().append(data, len);
+  } else {
+    sendq_.emplace_back();
+    sendq_.back().ref_ = data;
+    sendq_.back().size_ = len;
+  }
+  holdn_ += len;
+}
+
+template <class SockType>
+inline void
+SocketStream<SockType>::holdRef(const std::string &x) noexcept(false) {
+  holdRef(x.data(), x.size());
 }
 
 template <class SockType>
@@ -289,7 +419,7 @@ inline size_t SocketStream<SockType>::recvSize() const {
 
 template <class SockType>
 inline size_t SocketStream<SockType>::holdSize() const {
-  return sendstr_.size();
+  return holdn_;
 }
 template <class SockType> inline SocketStream<SockType>::~SocketStream() {
   try {
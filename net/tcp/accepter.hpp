@@ -15,7 +15,8 @@ public:
 public:
   Acceptor();
 
-  Acceptor(uint16_t port) noexcept(false);
+  // reuse_port lets other acceptors listen on the same port
+  Acceptor(uint16_t port, bool reuse_port = false) noexcept(false);
 
   ~Acceptor();
 
@@ -26,17 +27,27 @@ public:
 
   operator int() const;
 
+  // the bound port, the one picked by the os if 0 was asked for
+  uint16_t port() const;
+
 private:
+  // fcntl only when the mode changes
+  void setBlock(bool f);
+
   int sock_ = -1;
+  // the mode last set, -1 unknown
+  int block_ = -1;
 };
 
 inline Acceptor::Acceptor() {}
 
-inline Acceptor::Acceptor(uint16_t port) noexcept(false) {
+inline Acceptor::Acceptor(uint16_t port, bool reuse_port) noexcept(false) {
   auto sock = (int)::socket(AF_INET, SOCK_STREAM, 0);
   Defer xs([&sock]() { Socket::close(sock); });
 
   SocketOpt::reuseAddr(sock, true);
+  if (reuse_port)
+    SocketOpt::reusePort(sock, true);
 
   sockaddr_in addr;
   addr.sin_family = AF_INET;
@@ -54,7 +65,7 @@ inline Acceptor::Acceptor(uint16_t port) noexcept(false) {
 inline std::shared_ptr<tcp::Socket> Acceptor::accept(
     std::chrono::high_resolution_clock::duration timeout) noexcept(false) {
 
-  SocketOpt::setBlock(sock_, false);
+  setBlock(false);
 
   for (auto this_time = std::chrono::high_resolution_clock::now(),
             begin_time = this_time;
@@ -74,9 +85,7 @@ inline std::shared_ptr<tcp::Socket> Acceptor::accept(
       if (e == std::errc::not_a_socket || e == std::errc::invalid_argument) {
         MYSPACE_THROW_EX(AcceptorError);
       }
-      auto sel = newShared<Detector>();
-      sel->add(this);
-      sel->wait(timeout - (this_time - begin_time));
+      SocketOpt::wait(sock_, false, timeout - (this_time - begin_time));
     }
   }
   return nullptr;
@@ -84,7 +93,7 @@ inline std::shared_ptr<tcp::Socket> Acceptor::accept(
 
 inline std::shared_ptr<tcp::Socket> Acceptor::accept() noexcept(false) {
 
-  SocketOpt::setBlock(sock_, true);
+  setBlock(true);
 
   for (;;) {
     sockaddr_in addr;
@@ -101,16 +110,27 @@ inline std::shared_ptr<tcp::Socket> Acceptor::accept() noexcept(false) {
     if (e == std::errc::not_a_socket || e == std::errc::invalid_argument) {
       MYSPACE_THROW_EX(AcceptorError);
     }
-    auto sel = newShared<Detector>();
-    sel->add(this);
-    sel->wait();
+    SocketOpt::wait(sock_, false);
   }
   return nullptr;
 }
 
 inline Acceptor::~Acceptor() { Socket::close(sock_); }
 
+inline void Acceptor::setBlock(bool f) {
+  // the mode SocketOpt::setBlock really sets
+  f = f && !socketoptimpl::parker();
+  if (block_ == (int)f)
+    return;
+  SocketOpt::setBlock(sock_, f);
+  block_ = (int)f;
+}
+
 inline Acceptor::operator int() const { return sock_; }
+
+inline uint16_t Acceptor::port() const {
+  return ntohs(Addr::local(sock_).addr().sin_port);
+}
 } // namespace tcp
 
 MYSPACE_END
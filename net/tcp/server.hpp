@@ -0,0 +1,538 @@
+#pragma once
+
+#include "myspace/_/stdafx.hpp"
+
+#if defined(MYSPACE_LINUX)
+
+#include "myspace/defer/defer.hpp"
+#include "myspace/detector/reactor.hpp"
+#include "myspace/exception/exception.hpp"
+#include "myspace/logger/logger.hpp"
+#include "myspace/net/addr.hpp"
+#include "myspace/net/tcp/accepter.hpp"
+
+MYSPACE_BEGIN
+
+namespace tcp {
+
+namespace serverimpl {
+struct Loop;
+class Listener;
+} // namespace serverimpl
+
+// event driven tcp server, N reactor threads each own a Reactor and the
+// connections dealt to it, a connection is a few hundred bytes and no
+// thread, so 100k idle ones are cheap.
+// handlers run on the connection's reactor thread, one at a time per
+// reactor, they must not block
+class Server {
+public:
+  MYSPACE_EXCEPTION_DEFINE(ServerError, myspace::Exception)
+
+  enum Balance {
+    // one listening socket, reactor 0 accepts and deals the connections
+    // round robin
+    ROUND_ROBIN,
+    // a SO_REUSEPORT listening socket per reactor, the kernel spreads
+    // connections by address hash
+    REUSE_PORT,
+  };
+
+  struct Options {
+    // 0 picks a free port, see port()
+    uint16_t port_ = 0;
+
+    size_t reactors_ = std::thread::hardware_concurrency();
+
+    Balance balance_ = ROUND_ROBIN;
+
+    // bytes asked for by each recv
+    size_t read_chunk_ = 16 * 1024;
+  };
+
+  class Connection;
+
+  typedef std::function<void(Connection &)> ConnectHandler;
+
+  // input is everything received and not yet consumed, the handler erases
+  // what it used, the rest is handed in again with the next data
+  typedef std::function<void(Connection &, std::string &input)> ReadHandler;
+
+  typedef std::function<void(Connection &)> CloseHandler;
+
+  // the queued output has all been written, pending() is 0 again
+  typedef std::function<void(Connection &)> DrainHandler;
+
+  explicit Server(const Options &options) noexcept(false);
+
+  Server(const Server &) = delete;
+  Server &operator=(const Server &) = delete;
+
+  ~Server();
+
+  // set before start()
+  void onConnect(ConnectHandler handler);
+
+  void onRead(ReadHandler handler);
+
+  void onClose(CloseHandler handler);
+
+  // for backpressure, a handler holds back output while pending() is high
+  // and sends the rest from here
+  void onDrain(DrainHandler handler);
+
+  // starts the reactor threads and returns
+  void start();
+
+  // stops accepting, closes every connection, calling onClose for it on
+  // this thread, and joins the reactor threads
+  void stop();
+
+  uint16_t port() const;
+
+  size_t connections() const;
+
+private:
+  void adopt(serverimpl::Loop &loop, int fd, const sockaddr_in &peer);
+
+  void release(Connection *conn);
+
+  size_t read_chunk_;
+  Balance balance_;
+  uint16_t port_ = 0;
+  bool started_ = false;
+  std::vector<std::unique_ptr<serverimpl::Loop> > loops_;
+  // next loop for ROUND_ROBIN
+  size_t next_ = 0;
+  std::atomic<size_t> connections_{ 0 };
+
+  ConnectHandler on_connect_;
+  ReadHandler on_read_;
+  CloseHandler on_close_;
+  DrainHandler on_drain_;
+
+  friend class Connection;
+  friend class serverimpl::Listener;
+};
+
+// one accepted socket, owned by its reactor thread, which is the only one
+// that may touch it, other threads post() to reactor()
+class Server::Connection : public Reactor::Handler {
+public:
+  // writes what the socket takes now, queues the rest
+  void send(const char *data, size_t len);
+
+  void send(const std::string &data);
+
+  // after the queued output is written, then onClose. outside a handler
+  // the connection may be gone when this returns
+  void close();
+
+  // bytes queued, not yet taken by the socket
+  size_t pending() const;
+
+  int fd() const;
+
+  const Addr &peer() const;
+
+  Reactor &reactor();
+
+  // free for the user, such as protocol state
+  std::shared_ptr<void> context_;
+
+private:
+  Connection(Server *server, serverimpl::Loop *loop, int fd,
+             const sockaddr_in &peer);
+
+  ~Connection();
+
+  void onEvents(uint32_t events) override;
+
+  // false on eof or error. a short read ends it unless drain, which reads
+  // on to EAGAIN, as a hangup sent with the last data fires no more edges
+  bool readable(bool drain);
+
+  // false on error
+  bool writable();
+
+  // releases this if it is done and no onEvents is running
+  void settle();
+
+  Server *server_;
+  serverimpl::Loop *loop_;
+  int fd_;
+  Addr peer_;
+  std::string in_;
+  std::string out_;
+  // out_[0, sent_) is written
+  size_t sent_ = 0;
+  bool closing_ = false;
+  bool dead_ = false;
+  bool dispatching_ = false;
+  // the loop's list of connections
+  Connection *prev_ = nullptr;
+  Connection *next_ = nullptr;
+
+  friend class Server;
+  friend struct serverimpl::Loop;
+};
+
+namespace serverimpl {
+
+// accepts until EAGAIN. out of descriptors or memory the pending
+// connection stays queued and the level triggered listener would fire
+// again at once, so it is disarmed and re-armed from a timer instead,
+// backing off from MIN_PAUSE to MAX_PAUSE while accept keeps failing
+class Listener : public Reactor::Handler {
+public:
+  enum { MIN_PAUSE = 10, MAX_PAUSE = 1000 };
+
+  Listener(Server *server, Loop *loop, std::unique_ptr<Acceptor> acceptor)
+      : server_(server), loop_(loop), acceptor_(std::move(acceptor)) {}
+
+  // the re-arm timer must not outlive it
+  ~Listener();
+
+  void onEvents(uint32_t) override;
+
+  void pause();
+
+  Server *server_;
+  Loop *loop_;
+  std::unique_ptr<Acceptor> acceptor_;
+  // ms, 0 while accepting
+  int pause_ = 0;
+  TimerWheel::Id rearm_ = 0;
+};
+
+struct Loop {
+  void link(Server::Connection *conn) {
+    conn->next_ = head_;
+    if (head_)
+      head_->prev_ = conn;
+    head_ = conn;
+  }
+
+  void unlink(Server::Connection *conn) {
+    if (conn->prev_)
+      conn->prev_->next_ = conn->next_;
+    else
+      head_ = conn->next_;
+    if (conn->next_)
+      conn->next_->prev_ = conn->prev_;
+    conn->prev_ = conn->next_ = nullptr;
+  }
+
+  Reactor reactor_;
+  // every recv of this loop lands here first, so a connection only holds
+  // what it has not consumed
+  std::vector<char> buffer_;
+  std::unique_ptr<Listener> listener_;
+  Server::Connection *head_ = nullptr;
+  std::thread thread_;
+};
+} // namespace serverimpl
+
+inline Server::Server(const Options &options) noexcept(false)
+    : read_chunk_(std::max<size_t>(options.read_chunk_, 512)),
+      balance_(options.balance_) {
+  auto n = std::max<size_t>(options.reactors_, 1);
+  uint16_t port = options.port_;
+  for (size_t i = 0; i < n; ++i) {
+    loops_.emplace_back(new serverimpl::Loop);
+    auto &loop = *loops_.back();
+    loop.buffer_.resize(read_chunk_);
+    if (i > 0 && balance_ == ROUND_ROBIN)
+      continue;
+    std::unique_ptr<Acceptor> acceptor(
+        new Acceptor(port, balance_ == REUSE_PORT));
+    // the rest bind the port the first one got
+    port = acceptor->port();
+    SocketOpt::setBlock(*acceptor, false);
+    loop.listener_.reset(
+        new serverimpl::Listener(this, &loop, std::move(acceptor)));
+    MYSPACE_THROW_IF_EX(ServerError,
+                        !loop.reactor_.add(*loop.listener_->acceptor_,
+                                           loop.listener_.get()));
+  }
+  port_ = port;
+}
+
+inline Server::~Server() { stop(); }
+
+inline void Server::onConnect(ConnectHandler handler) {
+  on_connect_ = std::move(handler);
+}
+
+inline void Server::onRead(ReadHandler handler) {
+  on_read_ = std::move(handler);
+}
+
+inline void Server::onClose(CloseHandler handler) {
+  on_close_ = std::move(handler);
+}
+
+inline void Server::onDrain(DrainHandler handler) {
+  on_drain_ = std::move(handler);
+}
+
+inline void Server::start() {
+  if (started_)
+    return;
+  started_ = true;
+  for (auto &loop : loops_) {
+    auto reactor = &loop->reactor_;
+    loop->thread_ = std::thread([reactor]() { reactor->run(); });
+  }
+}
+
+inline void Server::stop() {
+  for (auto &loop : loops_) {
+    loop->reactor_.stop();
+    if (loop->thread_.joinable())
+      loop->thread_.join();
+  }
+  for (auto &loop : loops_) {
+    if (loop->listener_) {
+      loop->reactor_.del(*loop->listener_->acceptor_, loop->listener_.get());
+      loop->listener_.reset();
+    }
+    // adopts connections still posted to it
+    loop->reactor_.poll(0);
+    while (loop->head_)
+      release(loop->head_);
+  }
+}
+
+inline uint16_t Server::port() const { return port_; }
+
+inline size_t Server::connections() const { return connections_.load(); }
+
+inline void Server::adopt(serverimpl::Loop &loop, int fd,
+                          const sockaddr_in &peer) {
+  auto conn = new Connection(this, &loop, fd, peer);
+  if (!loop.reactor_.add(fd, conn,
+                         Reactor::READABLE | Reactor::WRITABLE |
+                             Reactor::HANGUP | Reactor::EDGE)) {
+    delete conn;
+    return;
+  }
+  loop.link(conn);
+  connections_.fetch_add(1);
+  if (on_connect_) {
+    conn->dispatching_ = true;
+    try {
+      on_connect_(*conn);
+    }
+    catch (...) {
+      MYSPACE_WARN_EXCEPTION();
+      conn->dead_ = true;
+    }
+    conn->dispatching_ = false;
+    conn->settle();
+  }
+}
+
+inline void Server::release(Connection *conn) {
+  conn->loop_->reactor_.del(conn->fd_, conn);
+  conn->loop_->unlink(conn);
+  connections_.fetch_sub(1);
+  if (on_close_) {
+    try {
+      on_close_(*conn);
+    }
+    catch (...) {
+      MYSPACE_WARN_EXCEPTION();
+    }
+  }
+  delete conn;
+}
+
+inline void serverimpl::Listener::onEvents(uint32_t) {
+  for (;;) {
+    sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    auto fd = ::accept4(*acceptor_, (sockaddr *)&addr, &addrlen,
+                        SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      auto err = errno;
+      if (err == EINTR || err == ECONNABORTED)
+        continue;
+      if (err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM) {
+        pause();
+        MYSPACE_WARN_SECONDS(10, "accept: ", err, ", paused ", pause_, "ms");
+        return;
+      }
+      MYSPACE_WARN_IF(err != EAGAIN && err != EWOULDBLOCK, "accept: ", err);
+      pause_ = 0;
+      return;
+    }
+    pause_ = 0;
+    auto server = server_;
+    auto &loops = server->loops_;
+    auto target = loop_;
+    if (server->balance_ == Server::ROUND_ROBIN)
+      target = loops[server->next_++ % loops.size()].get();
+    if (target == loop_) {
+      server->adopt(*target, fd, addr);
+    } else {
+      target->reactor_.post([server, target, fd, addr]() {
+        server->adopt(*target, fd, addr);
+      });
+    }
+  }
+}
+
+inline serverimpl::Listener::~Listener() {
+  if (rearm_)
+    loop_->reactor_.timers().cancel(rearm_);
+}
+
+inline void serverimpl::Listener::pause() {
+  pause_ = std::min<int>(std::max<int>(pause_ * 2, MIN_PAUSE), MAX_PAUSE);
+  auto &reactor = loop_->reactor_;
+  reactor.mod(*acceptor_, this, 0);
+  rearm_ = reactor.timers().after(std::chrono::milliseconds(pause_), [this]() {
+    rearm_ = 0;
+    loop_->reactor_.mod(*acceptor_, this, Reactor::READABLE);
+  });
+}
+
+inline Server::Connection::Connection(Server *server, serverimpl::Loop *loop,
+                                      int fd, const sockaddr_in &peer)
+    : server_(server), loop_(loop), fd_(fd), peer_(peer) {}
+
+inline Server::Connection::~Connection() { ::close(fd_); }
+
+inline int Server::Connection::fd() const { return fd_; }
+
+inline const Addr &Server::Connection::peer() const { return peer_; }
+
+inline Reactor &Server::Connection::reactor() { return loop_->reactor_; }
+
+inline size_t Server::Connection::pending() const {
+  return out_.size() - sent_;
+}
+
+inline void Server::Connection::send(const std::string &data) {
+  send(data.data(), data.size());
+}
+
+inline void Server::Connection::send(const char *data, size_t len) {
+  if (closing_ || dead_ || len == 0)
+    return;
+  if (pending() == 0) {
+    auto n = ::send(fd_, data, len, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        // released when the reactor reports it, not under the caller
+        dead_ = true;
+        ::shutdown(fd_, SHUT_RDWR);
+        return;
+      }
+      n = 0;
+    }
+    data += n;
+    len -= n;
+    if (len == 0)
+      return;
+    // nothing queued, start the buffer over
+    out_.clear();
+    sent_ = 0;
+  }
+  out_.append(data, len);
+}
+
+inline void Server::Connection::close() {
+  closing_ = true;
+  settle();
+}
+
+inline bool Server::Connection::readable(bool drain) {
+  auto &buffer = loop_->buffer_;
+  for (;;) {
+    auto n = ::recv(fd_, buffer.data(), buffer.size(), 0);
+    if (n > 0) {
+      in_.append(buffer.data(), n);
+      // a short read drained the socket, the edge fires again for more
+      if ((size_t)n < buffer.size() && !drain)
+        return true;
+      continue;
+    }
+    if (n == 0)
+      return false;
+    if (errno == EINTR)
+      continue;
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+  }
+}
+
+inline bool Server::Connection::writable() {
+  while (pending() > 0) {
+    auto n = ::send(fd_, out_.data() + sent_, pending(), MSG_NOSIGNAL);
+    if (n > 0) {
+      sent_ += n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+  }
+  out_.clear();
+  sent_ = 0;
+  return true;
+}
+
+inline void Server::Connection::onEvents(uint32_t events) {
+  dispatching_ = true;
+  if (events & Reactor::ERROR)
+    dead_ = true;
+  if (!dead_ && (events & Reactor::WRITABLE) && pending() > 0) {
+    if (!writable()) {
+      dead_ = true;
+    } else if (pending() == 0 && server_->on_drain_ && !closing_) {
+      try {
+        server_->on_drain_(*this);
+      }
+      catch (...) {
+        MYSPACE_WARN_EXCEPTION();
+        dead_ = true;
+      }
+    }
+  }
+  if (!dead_ && (events & (Reactor::READABLE | Reactor::HANGUP))) {
+    auto before = in_.size();
+    bool open = readable((events & Reactor::HANGUP) != 0);
+    if (in_.size() > before && server_->on_read_ && !closing_) {
+      try {
+        server_->on_read_(*this, in_);
+      }
+      catch (...) {
+        MYSPACE_WARN_EXCEPTION();
+        dead_ = true;
+      }
+    }
+    // an idle connection keeps no big buffer
+    if (in_.empty() && in_.capacity() > loop_->buffer_.size())
+      std::string().swap(in_);
+    if (!open)
+      dead_ = true;
+  }
+  dispatching_ = false;
+  settle();
+}
+
+inline void Server::Connection::settle() {
+  if (dispatching_)
+    return;
+  if (closing_ && !dead_ && (!writable() || pending() == 0))
+    dead_ = true;
+  if (dead_)
+    server_->release(this);
+}
+
+} // namespace tcp
+
+MYSPACE_END
+
+#endif
@@ -31,6 +31,18 @@ public:
   send(const std::string &data,
        std::chrono::high_resolution_clock::duration timeout) noexcept(false);
 
+  // all parts in order with as few writes as it takes, sendmsg gathers up
+  // to 64 of them per call, returns bytes sent, fewer only on error.
+  // more sets MSG_MORE, so the tail waits in the kernel for the next send
+  // instead of going out as a short segment
+  size_t send(const Slice *parts, size_t count,
+              bool more = false) noexcept(false);
+
+  // fewer also on timeout
+  size_t send(const Slice *parts, size_t count,
+              std::chrono::high_resolution_clock::duration timeout,
+              bool more = false) noexcept(false);
+
   std::string
   recv(std::chrono::high_resolution_clock::duration timeout) noexcept(false);
 
@@ -40,11 +52,65 @@ public:
 
   std::string recv(size_t len) noexcept(false);
 
+  // len bytes straight into buf, fewer only if the peer closes,
+  // returns how many
+  size_t recvInto(char *buf, size_t len) noexcept(false);
+
+  // fewer also on timeout
+  size_t
+  recvInto(char *buf, size_t len,
+           std::chrono::high_resolution_clock::duration timeout) noexcept(false);
+
+  // waits until at least len bytes are buffered, or the peer closes, and
+  // shows all of them without taking any, valid until the next recv call
+  Slice peek(size_t len) noexcept(false);
+
+  Slice
+  peek(size_t len,
+       std::chrono::high_resolution_clock::duration timeout) noexcept(false);
+
+  // drops n bytes of what peek() showed
+  void consume(size_t n);
+
+  // bytes read ahead from the socket, not yet taken, a reader waiting on
+  // the fd alone does not see them
+  size_t buffered() const;
+
   std::string recvUntil(const std::string &delm) noexcept(false);
 
   std::string recvUntil(
       const std::string &delm,
       std::chrono::high_resolution_clock::duration timeout) noexcept(false);
+
+private:
+  enum Fill { FILLED, CLOSED, TIMEDOUT, FAILED };
+
+  size_t send(
+      const Slice *parts, size_t count, bool more,
+      const std::chrono::high_resolution_clock::time_point *deadline) noexcept(
+      false);
+
+  // one read, into direct first, then in_, direct_n gets the bytes that
+  // went to direct, waits for data until deadline, or forever without one
+  Fill fill(char *direct, size_t len, size_t &direct_n,
+            const std::chrono::high_resolution_clock::time_point *deadline);
+
+  size_t recvInto(
+      char *buf, size_t len,
+      const std::chrono::high_resolution_clock::time_point *deadline) noexcept(
+      false);
+
+  Slice
+  peek(size_t len,
+       const std::chrono::high_resolution_clock::time_point *deadline) noexcept(
+      false);
+
+  // reads into in_ in big chunks and scans only what is new, bytes after
+  // delm stay in in_ for the next call
+  std::string recvUntil(
+      const std::string &delm,
+      const std::chrono::high_resolution_clock::time_point *deadline) noexcept(
+      false);
 };
 
 inline Socket::Socket() : Socketbase(AF_INET, SOCK_STREAM, 0) {}
@@ -76,7 +142,7 @@ inline size_t Socket::send(
   if (data.empty())
     return 0;
 
-  SocketOpt::setBlock(sock_, false);
+  setBlock(false);
 
   size_t sendn = 0;
 
@@ -96,9 +162,7 @@ inline size_t Socket::send(
       if (e == std::errc::operation_would_block ||
           e == std::errc::interrupted ||
           e == std::errc::operation_in_progress) {
-        auto sel = newShared<Detector>();
-        sel->add(this, DetectType::WRITE);
-        sel->wait(timeout - (this_time - begin_time));
+        SocketOpt::wait(sock_, true, timeout - (this_time - begin_time));
         continue;
       }
       MYSPACE_THROW_IF_EX(SocketError, sendn == 0);
@@ -115,7 +179,7 @@ inline size_t Socket::send(const std::string &data) noexcept(false) {
 
   size_t sendn = 0;
 
-  SocketOpt::setBlock(sock_, true);
+  setBlock(true);
 
   while (sendn < data.size()) {
     auto n = ::send(sock_, data.c_str() + sendn, int(data.size() - sendn), 0);
@@ -128,9 +192,7 @@ inline size_t Socket::send(const std::string &data) noexcept(false) {
       if (e == std::errc::operation_would_block ||
           e == std::errc::interrupted ||
           e == std::errc::operation_in_progress) {
-        auto sel = newShared<Detector>();
-        sel->add(this, DetectType::WRITE);
-        sel->wait();
+        SocketOpt::wait(sock_, true);
         continue;
       }
       MYSPACE_THROW_IF_EX(SocketError, sendn == 0);
@@ -140,206 +202,270 @@ inline size_t Socket::send(const std::string &data) noexcept(false) {
   return sendn;
 }
 
-inline std::string Socket::recv(
-    std::chrono::high_resolution_clock::duration timeout) noexcept(false) {
-  std::string data;
-
-  size_t buflen = 4096;
-
-  auto buf = newUnique<char[]>(buflen);
+inline size_t Socket::send(
+    const Slice *parts, size_t count, bool more,
+    const std::chrono::high_resolution_clock::time_point *deadline) noexcept(
+    false) {
+  setBlock(!deadline);
+  size_t sendn = 0;
+  // the next byte to go is parts[i].data()[off]
+  size_t i = 0;
+  size_t off = 0;
+  for (;;) {
+    while (i < count && off == parts[i].size()) {
+      ++i;
+      off = 0;
+    }
+    if (i == count)
+      break;
+#if defined(MYSPACE_WINDOWS)
+    auto n = ::send(sock_, parts[i].data() + off, int(parts[i].size() - off),
+                    0);
+#else
+    enum { BATCH = 64 };
+    iovec iov[BATCH];
+    size_t k = 0;
+    auto j = i;
+    for (; j < count && k < BATCH; ++j) {
+      auto skip = j == i ? off : 0;
+      if (parts[j].size() > skip)
+        iov[k++] = { (void *)(parts[j].data() + skip), parts[j].size() - skip };
+    }
+    msghdr msg;
+    ::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = k;
+    int flags = 0;
+#if defined(MSG_MORE)
+    // corked between batches too, the next one follows right away
+    if (more || j < count)
+      flags |= MSG_MORE;
+#endif
+    auto n = k == 1 ? ::send(sock_, iov[0].iov_base, iov[0].iov_len, flags)
+                    : ::sendmsg(sock_, &msg, flags);
+#endif
+    if (n > 0) {
+      sendn += n;
+      // a partial write only moves i and off, the parts stay where they are
+      for (size_t rest = n; rest > 0;) {
+        auto left = parts[i].size() - off;
+        if (rest < left) {
+          off += rest;
+          break;
+        }
+        rest -= left;
+        ++i;
+        off = 0;
+      }
+      continue;
+    }
+    if (n == 0)
+      break;
+    auto e = Error::lastError();
+    if (e == std::errc::operation_would_block ||
+        e == std::errc::interrupted ||
+        e == std::errc::operation_in_progress) {
+      if (!deadline) {
+        SocketOpt::wait(sock_, true);
+        continue;
+      }
+      auto now = std::chrono::high_resolution_clock::now();
+      if (now > *deadline)
+        break;
+      SocketOpt::wait(sock_, true, *deadline - now);
+      continue;
+    }
+    MYSPACE_THROW_IF_EX(SocketError, sendn == 0);
+    break;
+  }
+  return sendn;
+}
 
-  SocketOpt::setBlock(sock_, false);
+inline size_t Socket::send(const Slice *parts, size_t count,
+                           bool more) noexcept(false) {
+  return send(parts, count, more, nullptr);
+}
 
-  for (auto begin_time = std::chrono::high_resolution_clock::now(),
-            this_time = begin_time;
-       this_time - begin_time <= timeout;
-       this_time = std::chrono::high_resolution_clock::now()) {
-    auto n = ::recv(sock_, buf.get(), (int)buflen, 0);
+inline size_t
+Socket::send(const Slice *parts, size_t count,
+             std::chrono::high_resolution_clock::duration timeout,
+             bool more) noexcept(false) {
+  auto deadline = std::chrono::high_resolution_clock::now() + timeout;
+  return send(parts, count, more, &deadline);
+}
 
+inline Socket::Fill
+Socket::fill(char *direct, size_t len, size_t &direct_n,
+             const std::chrono::high_resolution_clock::time_point *deadline) {
+  for (;;) {
+    auto n = in_.readFrom(sock_, direct, len, direct_n);
     if (n > 0)
-      data.append(buf.get(), n);
-
-    else if (n == 0)
-      break;
-
-    else {
-      auto e = Error::lastError();
-
-      if (e == std::errc::operation_would_block ||
-          e == std::errc::interrupted ||
-          e == std::errc::operation_in_progress) {
-        auto sel = newShared<Detector>();
-        sel->add(this);
-        sel->wait(timeout - (this_time - begin_time));
+      return FILLED;
+    if (n == 0)
+      return CLOSED;
+    auto e = Error::lastError();
+    if (e == std::errc::operation_would_block ||
+        e == std::errc::interrupted ||
+        e == std::errc::operation_in_progress) {
+      if (!deadline) {
+        SocketOpt::wait(sock_, false);
         continue;
       }
-      MYSPACE_THROW_IF_EX(SocketError, data.empty());
-      break;
+      auto now = std::chrono::high_resolution_clock::now();
+      if (now > *deadline)
+        return TIMEDOUT;
+      SocketOpt::wait(sock_, false, *deadline - now);
+      continue;
     }
+    MYSPACE_DEV(" errno = ", e);
+    return FAILED;
   }
-  return data;
 }
 
-inline std::string Socket::recv(
-    size_t len,
-    std::chrono::high_resolution_clock::duration timeout) noexcept(false) {
-  if (len == 0)
-    return "";
-
-  size_t recvn = 0;
+inline size_t Socket::recvInto(
+    char *buf, size_t len,
+    const std::chrono::high_resolution_clock::time_point *deadline) noexcept(
+    false) {
+  auto recvn = in_.take(buf, len);
+  setBlock(!deadline);
+  while (recvn < len) {
+    size_t n = 0;
+    auto r = fill(buf + recvn, len - recvn, n, deadline);
+    recvn += n;
+    // a read that overflowed into in_ filled buf
+    if (r == FILLED)
+      continue;
+    MYSPACE_THROW_IF_EX(SocketError, r == FAILED && recvn == 0);
+    break;
+  }
+  return recvn;
+}
 
-  SocketOpt::setBlock(sock_, false);
+inline size_t Socket::recvInto(char *buf, size_t len) noexcept(false) {
+  return recvInto(buf, len, nullptr);
+}
 
-  auto buf = newUnique<char[]>(len);
+inline size_t Socket::recvInto(
+    char *buf, size_t len,
+    std::chrono::high_resolution_clock::duration timeout) noexcept(false) {
+  auto deadline = std::chrono::high_resolution_clock::now() + timeout;
+  return recvInto(buf, len, &deadline);
+}
 
-  for (auto this_time = std::chrono::high_resolution_clock::now(),
-            begin_time = this_time;
-       recvn < len && this_time - begin_time <= timeout;
-       this_time = std::chrono::high_resolution_clock::now()) {
-    auto n = ::recv(sock_, buf.get() + recvn, int(len - recvn), 0);
+inline Slice Socket::peek(
+    size_t len,
+    const std::chrono::high_resolution_clock::time_point *deadline) noexcept(
+    false) {
+  setBlock(!deadline);
+  while (in_.size() < len) {
+    size_t n = 0;
+    auto r = fill(nullptr, 0, n, deadline);
+    if (r == FILLED)
+      continue;
+    MYSPACE_THROW_IF_EX(SocketError, r == FAILED && in_.empty());
+    break;
+  }
+  return in_.slice();
+}
 
-    if (n > 0) {
-      recvn += n;
-    } else if (n == 0)
-      break;
+inline Slice Socket::peek(size_t len) noexcept(false) {
+  return peek(len, nullptr);
+}
 
-    else {
-      auto e = Error::lastError();
-      MYSPACE_DEV(" errno = ", e);
-      if (e == std::errc::operation_would_block ||
-          e == std::errc::interrupted ||
-          e == std::errc::operation_in_progress) {
-        auto sel = newShared<Detector>();
-        sel->add(this);
-        sel->wait(timeout - (this_time - begin_time));
-        continue;
-      }
-      MYSPACE_DEV("throw here");
-      MYSPACE_THROW_IF_EX(SocketError, recvn == 0);
-      break;
-    }
-  }
-  return std::string(buf.get(), recvn);
+inline Slice Socket::peek(
+    size_t len,
+    std::chrono::high_resolution_clock::duration timeout) noexcept(false) {
+  auto deadline = std::chrono::high_resolution_clock::now() + timeout;
+  return peek(len, &deadline);
 }
 
-inline std::string Socket::recv(size_t len) noexcept(false) {
-  if (len == 0)
-    return "";
+inline void Socket::consume(size_t n) { in_.consume(n); }
 
-  size_t recvn = 0;
+inline size_t Socket::buffered() const { return in_.size(); }
 
-  auto buf = newUnique<char[]>(len);
+inline std::string Socket::recv(
+    std::chrono::high_resolution_clock::duration timeout) noexcept(false) {
+  std::string data;
 
-  SocketOpt::setBlock(sock_, true);
+  in_.takeAll(data);
 
-  while (recvn < len) {
-    auto n = ::recv(sock_, buf.get() + recvn, int(len - recvn), 0);
+  setBlock(false);
 
-    if (n > 0) {
-      recvn += n;
-    } else if (n == 0)
-      break;
+  auto deadline = std::chrono::high_resolution_clock::now() + timeout;
 
-    else {
-      auto e = Error::lastError();
-      if (e == std::errc::operation_would_block ||
-          e == std::errc::interrupted ||
-          e == std::errc::operation_in_progress) {
-        continue;
-      }
-      MYSPACE_THROW_IF_EX(SocketError, recvn == 0);
-      break;
-    }
+  for (;;) {
+    size_t n = 0;
+    auto r = fill(nullptr, 0, n, &deadline);
+    in_.takeAll(data);
+    if (r == FILLED)
+      continue;
+    MYSPACE_THROW_IF_EX(SocketError, r == FAILED && data.empty());
+    break;
   }
-  return std::string(buf.get(), recvn);
+  return data;
 }
 
-inline std::string Socket::recvUntil(const std::string &delm) noexcept(false) {
-  if (delm.empty())
-    return "";
-
-  SocketOpt::setBlock(sock_, true);
+inline std::string Socket::recv(
+    size_t len,
+    std::chrono::high_resolution_clock::duration timeout) noexcept(false) {
+  std::string data(len, '\0');
+  if (len > 0)
+    data.resize(recvInto(&data[0], len, timeout));
+  return data;
+}
 
-  size_t recvn = delm.size();
+inline std::string Socket::recv(size_t len) noexcept(false) {
+  std::string data(len, '\0');
+  if (len > 0)
+    data.resize(recvInto(&data[0], len));
+  return data;
+}
 
+inline std::string Socket::recvUntil(
+    const std::string &delm,
+    const std::chrono::high_resolution_clock::time_point *deadline) noexcept(
+    false) {
   std::string ret;
-
-  auto buf = newUnique<char[]>(recvn);
-
-  while (recvn) {
-    auto n = ::recv(sock_, buf.get(), int(recvn), 0);
-    if (n == 0) {
-      break;
+  setBlock(!deadline);
+  // bytes of in_ already searched, a match may still start in their last
+  // delm.size() - 1
+  size_t scanned = 0;
+  Fill r = FILLED;
+  for (;;) {
+    auto from = scanned >= delm.size() ? scanned - delm.size() + 1 : 0;
+    auto found = in_.find(delm.data(), delm.size(), from);
+    if (found != std::string::npos) {
+      auto n = found + delm.size();
+      ret.assign(in_.data(), n);
+      in_.consume(n);
+      return ret;
     }
-    if (n < 0) {
-      auto e = Error::lastError();
-
-      if (e == std::errc::operation_would_block ||
-          e == std::errc::interrupted ||
-          e == std::errc::operation_in_progress) {
-        auto sel = newShared<Detector>();
-        sel->add(this);
-        sel->wait();
-        continue;
-      }
-      break;
-    }
-
-    ret.append(buf.get(), n);
-    recvn = Strings::endWithLess(ret, delm);
-    if (recvn == 0)
+    scanned = in_.size();
+    size_t n = 0;
+    r = fill(nullptr, 0, n, deadline);
+    if (r != FILLED)
       break;
   }
-  MYSPACE_THROW_IF_EX(SocketError, ret.empty());
+  // no delm before eof, error or timeout, hand over what came
+  in_.takeAll(ret);
+  MYSPACE_THROW_IF_EX(SocketError,
+                      ret.empty() && (r == FAILED || !deadline));
   return ret;
 }
 
+inline std::string Socket::recvUntil(const std::string &delm) noexcept(false) {
+  if (delm.empty())
+    return "";
+  return recvUntil(delm, nullptr);
+}
+
 inline std::string Socket::recvUntil(
     const std::string &delm,
     std::chrono::high_resolution_clock::duration timeout) noexcept(false) {
   if (delm.empty())
     return recv(timeout);
-
-  SocketOpt::setBlock(sock_, false);
-
-  size_t recvn = delm.size();
-
-  std::string ret;
-
-  auto buf = newUnique<char[]>(recvn);
-
-  for (auto this_time = std::chrono::system_clock::now(),
-            begin_time = this_time;
-       (ret.size() < delm.size() ||
-        ret.rfind(delm, ret.size() - delm.size()) == ret.npos) &&
-           this_time - begin_time <= timeout;
-       this_time = std::chrono::system_clock::now()) {
-    auto n = ::recv(sock_, buf.get(), int(recvn), 0);
-
-    if (n == 0)
-      break;
-
-    if (n < 0) {
-      auto e = Error::lastError();
-
-      if (e == std::errc::operation_would_block ||
-          e == std::errc::interrupted ||
-          e == std::errc::operation_in_progress) {
-        auto sel = newShared<Detector>();
-        sel->add(this);
-        sel->wait(timeout - (this_time - begin_time));
-        continue;
-      }
-      MYSPACE_THROW_IF_EX(SocketError, ret.empty());
-      break;
-    }
-
-    ret.append(buf.get(), n);
-    recvn = Strings::endWithLess(ret, delm);
-    if (recvn == 0)
-      break;
-  }
-  return ret;
+  auto deadline = std::chrono::high_resolution_clock::now() + timeout;
+  return recvUntil(delm, &deadline);
 }
 
 } // namespace tcp
@@ -0,0 +1,237 @@
+#pragma once
+
+#include "myspace/_/stdafx.hpp"
+#include "myspace/error/error.hpp"
+#include "myspace/net/_/buffer.hpp"
+#include "myspace/net/addr.hpp"
+
+MYSPACE_BEGIN
+namespace udp {
+
+class Socket;
+
+// datagrams in one preallocated slab, a slot of fixed size each, filled by
+// Socket::recvBatch or push() and sent by Socket::sendBatch. the message
+// headers are built once, so a batch moves through recvmmsg/sendmmsg with
+// no allocation, and the same batch may be sent back after a recv
+class Batch {
+public:
+  // count datagrams of up to slot bytes each, a longer one is cut
+  explicit Batch(size_t count = 64, size_t slot = 2048);
+
+  Batch(const Batch &) = delete;
+  Batch &operator=(const Batch &) = delete;
+
+  // datagrams held
+  size_t size() const;
+
+  size_t capacity() const;
+
+  size_t slot() const;
+
+  bool empty() const;
+
+  bool full() const;
+
+  // valid until the batch is refilled
+  Slice operator[](size_t i) const;
+
+  // the sender after a recv, the destination set by push()
+  Addr addr(size_t i) const;
+
+  // the datagram was longer than the slot
+  bool truncated(size_t i) const;
+
+  // copies a datagram in, false if full or longer than a slot,
+  // without an address it goes to the peer of a connected socket
+  bool push(const char *data, size_t len);
+
+  bool push(const Addr &to, const char *data, size_t len);
+
+  bool push(const Addr &to, const std::string &data);
+
+  // the free slot after the last datagram, nullptr when full, to be
+  // written in place, commit(len) makes it a datagram of len bytes,
+  // addressed like push()
+  char *next();
+
+  void commit(size_t len);
+
+  void commit(const Addr &to, size_t len);
+
+  void clear();
+
+private:
+  // one recvmmsg into the whole batch, returns what it returned
+  int readFrom(int fd);
+
+  // one sendmmsg of datagrams [from, size()), returns what it returned
+  int writeTo(int fd, size_t from);
+
+  char *slotAt(size_t i) const;
+
+  size_t count_;
+  size_t slot_;
+  size_t size_ = 0;
+  std::unique_ptr<char[]> slab_;
+  std::vector<sockaddr_in> addrs_;
+  // per datagram, bytes in the slot
+  std::vector<size_t> lens_;
+  // per datagram, whether addrs_ holds an address
+  std::vector<char> named_;
+  std::vector<char> truncated_;
+#if defined(MYSPACE_LINUX)
+  std::vector<mmsghdr> msgs_;
+  std::vector<iovec> iovs_;
+#endif
+
+  friend class Socket;
+};
+
+inline Batch::Batch(size_t count, size_t slot)
+    : count_(std::max<size_t>(count, 1)), slot_(std::max<size_t>(slot, 1)),
+      slab_(new char[count_ * slot_]), addrs_(count_), lens_(count_),
+      named_(count_), truncated_(count_) {
+#if defined(MYSPACE_LINUX)
+  msgs_.resize(count_);
+  iovs_.resize(count_);
+  for (size_t i = 0; i < count_; ++i) {
+    iovs_[i].iov_base = slotAt(i);
+    iovs_[i].iov_len = slot_;
+    ::memset(&msgs_[i], 0, sizeof(msgs_[i]));
+    msgs_[i].msg_hdr.msg_iov = &iovs_[i];
+    msgs_[i].msg_hdr.msg_iovlen = 1;
+  }
+#endif
+}
+
+inline size_t Batch::size() const { return size_; }
+
+inline size_t Batch::capacity() const { return count_; }
+
+inline size_t Batch::slot() const { return slot_; }
+
+inline bool Batch::empty() const { return size_ == 0; }
+
+inline bool Batch::full() const { return size_ == count_; }
+
+inline Slice Batch::operator[](size_t i) const {
+  return Slice(slotAt(i), lens_[i]);
+}
+
+inline Addr Batch::addr(size_t i) const {
+  return named_[i] ? Addr(addrs_[i]) : Addr();
+}
+
+inline bool Batch::truncated(size_t i) const { return truncated_[i] != 0; }
+
+inline char *Batch::slotAt(size_t i) const { return slab_.get() + i * slot_; }
+
+inline bool Batch::push(const char *data, size_t len) {
+  if (full() || len > slot_)
+    return false;
+  ::memcpy(next(), data, len);
+  commit(len);
+  return true;
+}
+
+inline bool Batch::push(const Addr &to, const char *data, size_t len) {
+  if (full() || len > slot_)
+    return false;
+  ::memcpy(next(), data, len);
+  commit(to, len);
+  return true;
+}
+
+inline bool Batch::push(const Addr &to, const std::string &data) {
+  return push(to, data.data(), data.size());
+}
+
+inline char *Batch::next() { return full() ? nullptr : slotAt(size_); }
+
+inline void Batch::commit(size_t len) {
+  lens_[size_] = std::min(len, slot_);
+  named_[size_] = 0;
+  truncated_[size_] = 0;
+  ++size_;
+}
+
+inline void Batch::commit(const Addr &to, size_t len) {
+  addrs_[size_] = to.addr();
+  commit(len);
+  named_[size_ - 1] = 1;
+}
+
+inline void Batch::clear() { size_ = 0; }
+
+inline int Batch::readFrom(int fd) {
+  size_ = 0;
+#if defined(MYSPACE_LINUX)
+  for (size_t i = 0; i < count_; ++i) {
+    auto &hdr = msgs_[i].msg_hdr;
+    iovs_[i].iov_len = slot_;
+    hdr.msg_name = &addrs_[i];
+    hdr.msg_namelen = sizeof(addrs_[i]);
+    hdr.msg_flags = 0;
+  }
+  auto n = ::recvmmsg(fd, msgs_.data(), (unsigned)count_, 0, nullptr);
+  for (int i = 0; i < n; ++i) {
+    lens_[i] = msgs_[i].msg_len;
+    named_[i] = msgs_[i].msg_hdr.msg_namelen > 0;
+    truncated_[i] = (msgs_[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+  }
+#else
+  // one datagram a call, until the socket is drained or the batch full
+  int n = 0;
+  for (; n < (int)count_; ++n) {
+    socklen_t addrlen = sizeof(addrs_[n]);
+    auto r = ::recvfrom(fd, slotAt(n), (int)slot_, 0, (sockaddr *)&addrs_[n],
+                        &addrlen);
+    if (r < 0) {
+      auto e = Error::lastError();
+      if (e == std::errc::message_size) {
+        r = (int)slot_;
+        truncated_[n] = 1;
+      } else if (n == 0) {
+        return -1;
+      } else {
+        break;
+      }
+    } else {
+      truncated_[n] = 0;
+    }
+    lens_[n] = r;
+    named_[n] = 1;
+  }
+#endif
+  if (n > 0)
+    size_ = n;
+  return n;
+}
+
+inline int Batch::writeTo(int fd, size_t from) {
+#if defined(MYSPACE_LINUX)
+  for (auto i = from; i < size_; ++i) {
+    auto &hdr = msgs_[i].msg_hdr;
+    iovs_[i].iov_len = lens_[i];
+    hdr.msg_name = named_[i] ? &addrs_[i] : nullptr;
+    hdr.msg_namelen = named_[i] ? sizeof(addrs_[i]) : 0;
+    hdr.msg_flags = 0;
+  }
+  return ::sendmmsg(fd, msgs_.data() + from, (unsigned)(size_ - from), 0);
+#else
+  int n = 0;
+  for (auto i = from; i < size_; ++i, ++n) {
+    auto r = named_[i] ? ::sendto(fd, slotAt(i), (int)lens_[i], 0,
+                                  (const sockaddr *)&addrs_[i],
+                                  sizeof(addrs_[i]))
+                       : ::send(fd, slotAt(i), (int)lens_[i], 0);
+    if (r < 0)
+      return n == 0 ? -1 : n;
+  }
+  return n;
+#endif
+}
+
+} // namespace udp
+MYSPACE_END
@@ -0,0 +1,169 @@
+#pragma once
+
+#include "myspace/_/stdafx.hpp"
+
+#if defined(MYSPACE_LINUX)
+
+#include "myspace/defer/defer.hpp"
+#include "myspace/detector/reactor.hpp"
+#include "myspace/exception/exception.hpp"
+#include "myspace/logger/logger.hpp"
+#include "myspace/net/udp/socket.hpp"
+
+MYSPACE_BEGIN
+
+namespace udp {
+
+namespace serverimpl {
+struct Worker;
+} // namespace serverimpl
+
+// SO_REUSEPORT fan out of one udp port, a socket, a Reactor and a thread
+// per worker, the kernel spreads datagrams among the sockets by source
+// address. a worker drains its socket with recvmmsg into its own Batch and
+// hands each batch to onBatch on the worker thread, which must not block
+class Server {
+public:
+  MYSPACE_EXCEPTION_DEFINE(ServerError, myspace::Exception)
+
+  struct Options {
+    // 0 picks a free port, see port()
+    uint16_t port_ = 0;
+
+    size_t workers_ = std::thread::hardware_concurrency();
+
+    // datagrams per recvmmsg
+    size_t batch_ = 64;
+
+    // bytes per datagram, longer ones are cut, see Batch::truncated
+    size_t slot_ = 2048;
+  };
+
+  // the socket may reply, through sendBatch or sendto, the batch is the
+  // worker's own and is refilled after the handler returns
+  typedef std::function<void(Socket &, Batch &)> BatchHandler;
+
+  explicit Server(const Options &options) noexcept(false);
+
+  Server(const Server &) = delete;
+  Server &operator=(const Server &) = delete;
+
+  ~Server();
+
+  // set before start()
+  void onBatch(BatchHandler handler);
+
+  // starts the worker threads and returns
+  void start();
+
+  // joins the worker threads, datagrams still queued are dropped
+  void stop();
+
+  uint16_t port() const;
+
+  // datagrams handed to onBatch so far
+  size_t received() const;
+
+private:
+  uint16_t port_ = 0;
+  bool started_ = false;
+  std::vector<std::unique_ptr<serverimpl::Worker> > workers_;
+  std::atomic<size_t> received_{ 0 };
+
+  BatchHandler on_batch_;
+
+  friend struct serverimpl::Worker;
+};
+
+namespace serverimpl {
+
+struct Worker : public Reactor::Handler {
+  Worker(Server *server, uint16_t port, const Server::Options &options)
+      : server_(server), socket_(port, true),
+        batch_(options.batch_, options.slot_) {}
+
+  // drains at most a few batches, the level triggered fd calls again
+  void onEvents(uint32_t) override;
+
+  Server *server_;
+  Socket socket_;
+  Batch batch_;
+  Reactor reactor_;
+  std::thread thread_;
+};
+} // namespace serverimpl
+
+inline Server::Server(const Options &options) noexcept(false) {
+  auto n = std::max<size_t>(options.workers_, 1);
+  uint16_t port = options.port_;
+  for (size_t i = 0; i < n; ++i) {
+    workers_.emplace_back(new serverimpl::Worker(this, port, options));
+    auto &worker = *workers_.back();
+    // the rest bind the port the first one got
+    port = ntohs(worker.socket_.local().addr().sin_port);
+    MYSPACE_THROW_IF_EX(ServerError,
+                        !worker.reactor_.add(worker.socket_, &worker));
+  }
+  port_ = port;
+}
+
+inline Server::~Server() { stop(); }
+
+inline void Server::onBatch(BatchHandler handler) {
+  on_batch_ = std::move(handler);
+}
+
+inline void Server::start() {
+  if (started_)
+    return;
+  started_ = true;
+  for (auto &worker : workers_) {
+    auto reactor = &worker->reactor_;
+    worker->thread_ = std::thread([reactor]() { reactor->run(); });
+  }
+}
+
+inline void Server::stop() {
+  for (auto &worker : workers_) {
+    worker->reactor_.stop();
+    if (worker->thread_.joinable())
+      worker->thread_.join();
+  }
+}
+
+inline uint16_t Server::port() const { return port_; }
+
+inline size_t Server::received() const { return received_.load(); }
+
+inline void serverimpl::Worker::onEvents(uint32_t) {
+  for (int i = 0; i < 16; ++i) {
+    size_t n = 0;
+    try {
+      n = socket_.recvBatch(batch_, std::chrono::milliseconds(0));
+    }
+    catch (...) {
+      MYSPACE_WARN_EXCEPTION();
+      return;
+    }
+    if (n == 0)
+      return;
+    server_->received_.fetch_add(n, std::memory_order_relaxed);
+    if (server_->on_batch_) {
+      try {
+        server_->on_batch_(socket_, batch_);
+      }
+      catch (...) {
+        MYSPACE_WARN_EXCEPTION();
+      }
+    }
+    // a short batch means the socket is drained
+    if (n < batch_.capacity())
+      return;
+  }
+}
+
+} // namespace udp
+
+MYSPACE_END
+
+#endif
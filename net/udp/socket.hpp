@@ -7,6 +7,7 @@
 #include "myspace/net/addr.hpp"
 #include "myspace/net/socketbase.hpp"
 #include "myspace/net/socketopt.hpp"
+#include "myspace/net/udp/batch.hpp"
 #include "myspace/strings/sstream.hpp"
 MYSPACE_BEGIN
 namespace udp {
@@ -20,6 +21,11 @@ public:
   Socket(const Addr &addr,
          std::chrono::high_resolution_clock::duration timeout) noexcept(false);
 
+  // bound to port on every interface, 0 picks a free one, see local().
+  // with reuse_port several sockets share the port and the kernel spreads
+  // datagrams among them by source address
+  explicit Socket(uint16_t port, bool reuse_port = false) noexcept(false);
+
   ~Socket();
 
   size_t send(const std::string &data,
@@ -27,6 +33,12 @@ public:
 
   size_t send(const std::string &data);
 
+  // the parts joined into one datagram
+  size_t send(const Slice *parts, size_t count,
+              std::chrono::high_resolution_clock::duration timeout);
+
+  size_t send(const Slice *parts, size_t count);
+
   std::string recv(std::chrono::high_resolution_clock::duration timeout);
 
   std::string recv();
@@ -38,6 +50,37 @@ public:
 
   std::string recvfrom(Addr &,
                        std::chrono::high_resolution_clock::duration timeout);
+
+  // waits for a datagram, then takes every ready one that fits in the
+  // batch with one recvmmsg, returns how many
+  size_t recvBatch(Batch &batch) noexcept(false);
+
+  // 0 on timeout, a zero timeout takes only what is ready
+  size_t
+  recvBatch(Batch &batch,
+            std::chrono::high_resolution_clock::duration timeout) noexcept(
+      false);
+
+  // every datagram of batch, many per sendmmsg, returns how many went out,
+  // fewer only on error
+  size_t sendBatch(Batch &batch) noexcept(false);
+
+  // fewer also on timeout
+  size_t
+  sendBatch(Batch &batch,
+            std::chrono::high_resolution_clock::duration timeout) noexcept(
+      false);
+
+private:
+  size_t recvBatch(
+      Batch &batch,
+      const std::chrono::high_resolution_clock::time_point *deadline) noexcept(
+      false);
+
+  size_t sendBatch(
+      Batch &batch,
+      const std::chrono::high_resolution_clock::time_point *deadline) noexcept(
+      false);
 };
 
 inline Socket::Socket() : Socketbase(AF_INET, SOCK_DGRAM, 0) {}
@@ -54,6 +97,16 @@ inline Socket::Socket(
   connect(addr, timeout);
 }
 
+inline Socket::Socket(uint16_t port, bool reuse_port) noexcept(false)
+    : Socketbase(AF_INET, SOCK_DGRAM, 0) {
+  sock_ = (int)::socket(family_, type_, protocal_);
+  MYSPACE_THROW_IF_EX(SocketError, sock_ < 0);
+  if (reuse_port)
+    SocketOpt::reusePort(sock_, true);
+  bind(port);
+  local_ = Addr::local(sock_);
+}
+
 inline Socket::~Socket() { close(); }
 
 inline size_t
@@ -61,6 +114,8 @@ Socket::send(const std::string &data,
              std::chrono::high_resolution_clock::duration timeout) {
   size_t sendn = 0;
 
+  setBlock(false);
+
   for (auto this_time = std::chrono::high_resolution_clock::now(),
             begin_time = this_time;
        sendn < data.size() && this_time - begin_time <= timeout;
@@ -79,9 +134,7 @@ Socket::send(const std::string &data,
           e == std::errc::resource_unavailable_try_again ||
           e == std::errc::interrupted ||
           e == std::errc::operation_in_progress) {
-        auto sel = newShared<Detector>();
-        sel->add(this, DetectType::WRITE);
-        sel->wait(timeout - (this_time - begin_time));
+        SocketOpt::wait(sock_, true, timeout - (this_time - begin_time));
         continue;
       }
 
@@ -94,7 +147,7 @@ Socket::send(const std::string &data,
 inline size_t Socket::send(const std::string &data) {
   size_t sendn = 0;
 
-  SocketOpt::setBlock(sock_, true);
+  setBlock(true);
 
   while (sendn < data.size()) {
     auto n = ::send(sock_, data.c_str() + sendn, int(data.size() - sendn), 0);
@@ -111,9 +164,7 @@ inline size_t Socket::send(const std::string &data) {
       if (e == std::errc::operation_would_block ||
           e == std::errc::interrupted ||
           e == std::errc::operation_in_progress) {
-        auto sel = newShared<Detector>();
-        sel->add(this, DetectType::WRITE);
-        sel->wait();
+        SocketOpt::wait(sock_, true);
         continue;
       }
 
@@ -123,10 +174,29 @@ inline size_t Socket::send(const std::string &data) {
   return sendn;
 }
 
+namespace udpimpl {
+inline std::string join(const Slice *parts, size_t count) {
+  std::string data;
+  for (size_t i = 0; i < count; ++i)
+    data.append(parts[i].data(), parts[i].size());
+  return data;
+}
+} // namespace udpimpl
+
+inline size_t
+Socket::send(const Slice *parts, size_t count,
+             std::chrono::high_resolution_clock::duration timeout) {
+  return send(udpimpl::join(parts, count), timeout);
+}
+
+inline size_t Socket::send(const Slice *parts, size_t count) {
+  return send(udpimpl::join(parts, count));
+}
+
 inline size_t Socket::sendto(const Addr &addr, const std::string &data) {
   size_t sendn = 0;
 
-  SocketOpt::setBlock(sock_, true);
+  setBlock(true);
 
   while (sendn < data.size()) {
     auto n = ::sendto(sock_, data.c_str() + sendn, int(data.size() - sendn), 0,
@@ -144,9 +214,7 @@ inline size_t Socket::sendto(const Addr &addr, const std::string &data) {
       if (e == std::errc::operation_would_block ||
           e == std::errc::interrupted ||
           e == std::errc::operation_in_progress) {
-        auto sel = newShared<Detector>();
-        sel->add(this, DetectType::WRITE);
-        sel->wait();
+        SocketOpt::wait(sock_, true);
         continue;
       }
 
@@ -164,7 +232,7 @@ Socket::recv(std::chrono::high_resolution_clock::duration timeout) {
 
   auto buf = newUnique<char[]>(buflen);
 
-  SocketOpt::setBlock(sock_, false);
+  setBlock(false);
 
   for (auto begin_time = std::chrono::high_resolution_clock::now(),
             this_time = begin_time;
@@ -184,9 +252,7 @@ Socket::recv(std::chrono::high_resolution_clock::duration timeout) {
       if (e == std::errc::operation_would_block ||
           e == std::errc::interrupted ||
           e == std::errc::operation_in_progress) {
-        auto sel = newShared<Detector>();
-        sel->add(this);
-        sel->wait(timeout - (this_time - begin_time));
+        SocketOpt::wait(sock_, false, timeout - (this_time - begin_time));
         continue;
       }
 
@@ -203,14 +269,24 @@ inline std::string Socket::recv() {
 
   auto buf = newUnique<char[]>(buflen);
 
-  SocketOpt::setBlock(sock_, true);
+  setBlock(true);
 
-  auto n = ::recv(sock_, buf.get(), (int)buflen, 0);
+  for (;;) {
+    auto n = ::recv(sock_, buf.get(), (int)buflen, 0);
 
-  if (n > 0) {
-    data.append(buf.get(), n);
+    if (n > 0) {
+      data.append(buf.get(), n);
+    } else if (n < 0) {
+      auto e = Error::lastError();
+
+      if (e == std::errc::operation_would_block ||
+          e == std::errc::interrupted) {
+        SocketOpt::wait(sock_, false);
+        continue;
+      }
+    }
+    return data;
   }
-  return data;
 } // namespace udp
 
 inline std::string
@@ -222,7 +298,7 @@ Socket::recvfrom(Addr &dst,
 
   auto buf = newUnique<char[]>(buflen);
 
-  SocketOpt::setBlock(sock_, false);
+  setBlock(false);
 
   sockaddr_in addr = { 0 };
   addr.sin_family = AF_INET;
@@ -250,9 +326,7 @@ Socket::recvfrom(Addr &dst,
       if (e == std::errc::operation_would_block ||
           e == std::errc::interrupted ||
           e == std::errc::operation_in_progress) {
-        auto sel = newShared<Detector>();
-        sel->add(this);
-        sel->wait(timeout - (this_time - begin_time));
+        SocketOpt::wait(sock_, false, timeout - (this_time - begin_time));
         continue;
       }
 
@@ -263,5 +337,88 @@ Socket::recvfrom(Addr &dst,
   return data;
 }
 
+inline size_t Socket::recvBatch(
+    Batch &batch,
+    const std::chrono::high_resolution_clock::time_point *deadline) noexcept(
+    false) {
+  // nonblocking either way, an idle socket waits in poll, a busy one
+  // costs one recvmmsg a batch
+  setBlock(false);
+  for (;;) {
+    auto n = batch.readFrom(sock_);
+    if (n > 0)
+      return n;
+    auto e = Error::lastError();
+    if (n < 0 && e != std::errc::operation_would_block &&
+        e != std::errc::resource_unavailable_try_again &&
+        e != std::errc::interrupted) {
+      MYSPACE_THROW_EX(SocketError);
+    }
+    if (!deadline) {
+      SocketOpt::wait(sock_, false);
+      continue;
+    }
+    auto now = std::chrono::high_resolution_clock::now();
+    if (now >= *deadline)
+      return 0;
+    SocketOpt::wait(sock_, false, *deadline - now);
+  }
+}
+
+inline size_t Socket::recvBatch(Batch &batch) noexcept(false) {
+  return recvBatch(batch, nullptr);
+}
+
+inline size_t Socket::recvBatch(
+    Batch &batch,
+    std::chrono::high_resolution_clock::duration timeout) noexcept(false) {
+  auto deadline = std::chrono::high_resolution_clock::now() + timeout;
+  return recvBatch(batch, &deadline);
+}
+
+inline size_t Socket::sendBatch(
+    Batch &batch,
+    const std::chrono::high_resolution_clock::time_point *deadline) noexcept(
+    false) {
+  setBlock(false);
+  size_t sent = 0;
+  while (sent < batch.size()) {
+    auto n = batch.writeTo(sock_, sent);
+    if (n > 0) {
+      sent += n;
+      continue;
+    }
+    auto e = Error::lastError();
+    if (n < 0 && (e == std::errc::operation_would_block ||
+                  e == std::errc::resource_unavailable_try_again ||
+                  e == std::errc::no_buffer_space ||
+                  e == std::errc::interrupted)) {
+      if (!deadline) {
+        SocketOpt::wait(sock_, true);
+        continue;
+      }
+      auto now = std::chrono::high_resolution_clock::now();
+      if (now >= *deadline)
+        break;
+      SocketOpt::wait(sock_, true, *deadline - now);
+      continue;
+    }
+    MYSPACE_THROW_IF_EX(SocketError, sent == 0);
+    break;
+  }
+  return sent;
+}
+
+inline size_t Socket::sendBatch(Batch &batch) noexcept(false) {
+  return sendBatch(batch, nullptr);
+}
+
+inline size_t Socket::sendBatch(
+    Batch &batch,
+    std::chrono::high_resolution_clock::duration timeout) noexcept(false) {
+  auto deadline = std::chrono::high_resolution_clock::now() + timeout;
+  return sendBatch(batch, &deadline);
+}
+
 } // namespace udp
 MYSPACE_END
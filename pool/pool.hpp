@@ -1,5 +1,12 @@
+#pragma once
+
 #include "myspace/_/stdafx.hpp"
+#include "myspace/concurrency/_/parker.hpp"
+#include "myspace/defer/defer.hpp"
 #include "myspace/exception/exception.hpp"
+#include "myspace/json/json.hpp"
+#include "myspace/logger/logger.hpp"
+#include "myspace/mutex/mutex.hpp"
 
 MYSPACE_BEGIN
 
@@ -8,6 +15,53 @@ MYSPACE_EXCEPTION_DEFINE(PoolError, myspace::Exception)
 template <class X, class Creator, class Deleter, class Popper, class Recycler>
 class Pool;
 
+struct PoolOptions {
+  // (0, SIZE_MAX], 0 means SIZE_MAX
+  size_t max_count_ = 0;
+
+  // idle objects kept ready, created ahead of demand by a background thread
+  size_t min_idle_ = 0;
+
+  // idle objects beyond min_idle_ unused longer than this are deleted,
+  // 0 keeps them forever
+  std::chrono::milliseconds max_idle_time_ = std::chrono::milliseconds(0);
+
+  // run the validator on an idle object before handing it out
+  bool validate_on_borrow_ = false;
+
+  // run the validator on every idle object this often, 0 never
+  std::chrono::milliseconds validate_interval_ = std::chrono::milliseconds(0);
+
+  // how often the background thread looks at the pool, this is also how
+  // exact max_idle_time_ is
+  std::chrono::milliseconds maintain_interval_ = std::chrono::seconds(1);
+};
+
+struct PoolStats {
+  // checkouts served by an idle object
+  uint64_t hits_ = 0;
+  // checkouts that created a new one
+  uint64_t misses_ = 0;
+  // every object created, including those made ahead for min_idle_
+  uint64_t created_ = 0;
+  // deleted for being idle too long
+  uint64_t evicted_ = 0;
+  // deleted because the validator said so
+  uint64_t invalid_ = 0;
+  // checkouts that had to wait, and how long all together
+  uint64_t waits_ = 0;
+  uint64_t wait_ns_ = 0;
+  // checked out now
+  size_t occupied_ = 0;
+  // idle now
+  size_t available_ = 0;
+
+  // hits_ over all checkouts
+  double hitRatio() const;
+
+  Json toJson() const;
+};
+
 class PoolFactory {
 public:
   // max_count (0, SIZE_MAX], 0 means SIZE_MAX
@@ -19,15 +73,38 @@ public:
   static auto create(size_t max_count, Creator &&creator, Deleter &&deleter,
                      Popper &&popper, Recycler &&recycler)
       -> std::shared_ptr<Pool<X, Creator, Deleter, Popper, Recycler> >;
+
+  // the same, plus idle object management. validator says whether an idle
+  // object is still good, it can be null, throwing counts as false
+  template <class X, class Creator, class Deleter, class Popper, class Recycler>
+  static auto create(const PoolOptions &options, Creator &&creator,
+                     Deleter &&deleter, Popper &&popper, Recycler &&recycler,
+                     std::function<bool(X *)> validator = nullptr)
+      -> std::shared_ptr<Pool<X, Creator, Deleter, Popper, Recycler> >;
 };
 
+namespace pool_detail {
+template <class X> struct Idle;
+template <class X> struct Shard;
+} // namespace pool_detail
+
+// idle objects live in shards, one per cpu or so. a thread always goes to
+// the same shard, and there to a small lock free magazine first, so a hot
+// get/put pair takes no lock. a full magazine spills half of it to the
+// shard's free list, an empty one refills from there, only then other
+// shards are searched and new objects created.
+// with PoolOptions a background thread keeps min_idle_ objects ready,
+// deletes those idle too long and validates the rest.
+// Creator and Deleter calls are serialized, Popper and Recycler may run on
+// several threads at once
 template <class X, class Creator, class Deleter, class Popper, class Recycler>
 class Pool : public std::enable_shared_from_this<
                  Pool<X, Creator, Deleter, Popper, Recycler> > {
   using std::enable_shared_from_this<Pool>::shared_from_this;
-  typedef std::unique_ptr<X, Deleter> StorageType;
 
 public:
+  class Handle;
+
   // these function may throw exception, due to lack of resources
   // or user defined creater/deleter,deleter may not to throw exception
   // c type HANDLE(void*) , better to set X to void,
@@ -49,146 +126,700 @@ public:
   std::shared_ptr<X> getFor(const std::chrono::duration<Rep, Period> &timeout,
                             Predicate pred) noexcept(false);
 
+  // the same, but the object comes back in a Handle, which costs no
+  // allocation and no reference counting.
+  // unlike std::shared_ptr a Handle does not keep the pool alive,
+  // it must be gone before the pool is
+  Handle tryGetHandle() noexcept(false);
+  //
+  Handle getHandle() noexcept(false);
+  //
+  template <class Predicate>
+  Handle getHandle(Predicate pred) noexcept(false);
+  //
+  template <class Rep, class Period>
+  Handle
+  getHandleFor(const std::chrono::duration<Rep, Period> &timeout) noexcept(
+      false);
+  //
+  template <class Rep, class Period, class Predicate>
+  Handle getHandleFor(const std::chrono::duration<Rep, Period> &timeout,
+                      Predicate pred) noexcept(false);
+
+  PoolStats stats() const;
+
+  ~Pool();
+
 private:
   Pool(const Pool &) = delete;
   Pool &operator=(const Pool &) = delete;
 
-  Pool(size_t max_count, Creator &&creator, Deleter &&deleter, Popper &&popper,
-       Recycler &&recycler);
+  Pool(const PoolOptions &options, Creator &&creator, Deleter &&deleter,
+       Popper &&popper, Recycler &&recycler,
+       std::function<bool(X *)> validator);
+
+  typedef pool_detail::Idle<X> Idle;
 
   void put(X *x);
-  std::shared_ptr<X> tryGetUnlocked();
+
+  // makes x idle, waking a waiter
+  void stash(Idle idle);
+
+  void wake();
+
+  bool valid(X *x);
+
+  // deletes an idle object, wakes nobody, acquire() runs it under mtx_
+  void discard(X *x);
+
+  std::shared_ptr<X> wrap(X *x);
+
+  // an object, waiting for one unless pred() or the deadline says stop,
+  // throws PoolError if there is none
+  template <class Predicate>
+  X *checkout(Predicate pred,
+              const std::chrono::steady_clock::time_point *deadline);
+
+  // an idle or a new object, nullptr if there is none and max_ is reached
+  X *acquire();
+
+  // from the magazine of this thread's shard
+  X *take();
+
+  // from any shard, waiting for busy magazines
+  X *steal();
+
+  X *create();
+
+  // nullptr if stop() or the deadline comes first
+  template <class Stop>
+  X *wait(Stop stop, const std::chrono::steady_clock::time_point *deadline);
+
+  pool_detail::Shard<X> &local();
+
+  // background thread
+  void maintain();
+
+  // deletes and validates idle objects, then creates up to min_idle_
+  void tick(bool validate);
+
+  uint64_t now() const;
 
 private:
   size_t max_ = 0;
-  size_t occupied_ = 0;
+  // objects alive, idle or not
+  std::atomic<size_t> created_{ 0 };
+  std::atomic<size_t> occupied_{ 0 };
+  size_t mask_ = 0;
+  std::unique_ptr<pool_detail::Shard<X>[]> shards_;
+  // getters sleeping on cond_
+  std::atomic<size_t> waiters_{ 0 };
   std::mutex mtx_;
   std::condition_variable cond_;
-  std::deque<StorageType> avaible_;
+  std::mutex create_mtx_;
   Creator creator_;
   Deleter deleter_;
   Popper popper_;
   Recycler recycler_;
+  std::function<bool(X *)> validator_;
+
+  size_t min_idle_ = 0;
+  uint64_t max_idle_ms_ = 0;
+  bool validate_on_borrow_ = false;
+  std::chrono::milliseconds validate_interval_;
+  std::chrono::milliseconds maintain_interval_;
+  // ms since start_ as of the last tick, idle objects are stamped with it
+  std::chrono::steady_clock::time_point start_;
+  std::atomic<uint64_t> clock_{ 0 };
+
+  std::atomic<uint64_t> misses_{ 0 };
+  std::atomic<uint64_t> creations_{ 0 };
+  std::atomic<uint64_t> evicted_{ 0 };
+  std::atomic<uint64_t> invalid_{ 0 };
+  std::atomic<uint64_t> waits_{ 0 };
+  std::atomic<uint64_t> wait_ns_{ 0 };
+
+  bool stopping_ = false;
+  std::mutex maintain_mtx_;
+  std::condition_variable maintain_cond_;
+  std::thread maintainer_;
 
   friend class PoolFactory;
 };
+
+// move only owner of a checked out object, puts it back when destroyed
+template <class X, class Creator, class Deleter, class Popper, class Recycler>
+class Pool<X, Creator, Deleter, Popper, Recycler>::Handle {
+public:
+  Handle() {}
+
+  Handle(Handle &&other) noexcept : pool_(other.pool_), x_(other.x_) {
+    other.pool_ = nullptr;
+    other.x_ = nullptr;
+  }
+
+  Handle &operator=(Handle &&other) noexcept {
+    if (this != &other) {
+      reset();
+      std::swap(pool_, other.pool_);
+      std::swap(x_, other.x_);
+    }
+    return *this;
+  }
+
+  Handle(const Handle &) = delete;
+  Handle &operator=(const Handle &) = delete;
+
+  ~Handle() { reset(); }
+
+  // puts the object back now
+  void reset() {
+    if (x_) {
+      pool_->put(x_);
+      pool_ = nullptr;
+      x_ = nullptr;
+    }
+  }
+
+  X *get() const { return x_; }
+
+  typename std::add_lvalue_reference<X>::type operator*() const {
+    return *x_;
+  }
+
+  X *operator->() const { return x_; }
+
+  explicit operator bool() const { return x_ != nullptr; }
+
+private:
+  Handle(Pool *pool, X *x) : pool_(pool), x_(x) {}
+
+  Pool *pool_ = nullptr;
+  X *x_ = nullptr;
+
+  friend class Pool;
+};
+
 namespace pool_detail {
 template <class Popper, class X> inline void call(Popper &pop, X *sp) {
   if (pop)
     pop(sp);
 }
 template <class X> inline void call(std::nullptr_t &, X *) {}
+
+template <class Deleter, class X> inline void destroy(Deleter &d, X *x) {
+  d(x);
+}
+template <class X> inline void destroy(std::nullptr_t &, X *) {}
+
+// which shard the calling thread uses
+inline size_t threadIndex() {
+  static std::atomic<size_t> next{ 0 };
+  static thread_local size_t index = next.fetch_add(1);
+  return index;
 }
+
+template <class X> struct Idle {
+  X *x_;
+  // pool clock when it was put back
+  uint64_t since_;
+};
+
+template <class X> struct Shard {
+  enum { MAGAZINE = 32 };
+
+  bool tryLock() {
+    return !busy_.load(std::memory_order_relaxed) &&
+           !busy_.exchange(true, std::memory_order_acquire);
+  }
+
+  void lock() {
+    while (!tryLock())
+      parkerimpl::relax();
+  }
+
+  void unlock() { busy_.store(false, std::memory_order_release); }
+
+  // under busy_, moves half of the free list in
+  void refill() {
+    MYSPACE_IF_LOCK(mtx_) {
+      while (cached_ < MAGAZINE / 2 && !free_.empty()) {
+        cache_[cached_++] = free_.back();
+        free_.pop_back();
+      }
+    }
+  }
+
+  // under busy_, moves half of the magazine out
+  void spill() {
+    MYSPACE_IF_LOCK(mtx_) {
+      while (cached_ > MAGAZINE / 2)
+        free_.push_back(cache_[--cached_]);
+    }
+  }
+
+  char pad0_[64];
+  std::atomic<bool> busy_{ false };
+  size_t cached_ = 0;
+  Idle<X> cache_[MAGAZINE];
+  // overflow of the magazine, and what others return while it is busy
+  std::mutex mtx_;
+  std::vector<Idle<X> > free_;
+  // checkouts by this shard's threads served from idle objects
+  std::atomic<uint64_t> hits_{ 0 };
+  char pad1_[64];
+};
+} // namespace pool_detail
+
 template <class X, class C, class D, class P, class R>
-inline std::shared_ptr<X> Pool<X, C, D, P, R>::tryGetUnlocked() {
-  auto pool = shared_from_this();
-  auto put = [pool](X *x) { pool->put(x); };
-  std::shared_ptr<X> sp;
-  if (!avaible_.empty()) {
-    sp.reset(avaible_.front().release(), put);
-    avaible_.pop_front();
-  }
-  if (!sp) {
-    if (avaible_.size() + occupied_ < max_) {
-      auto x = creator_();
-      if (x)
-        sp.reset(x, put);
+inline pool_detail::Shard<X> &Pool<X, C, D, P, R>::local() {
+  return shards_[pool_detail::threadIndex() & mask_];
+}
+
+template <class X, class C, class D, class P, class R>
+inline X *Pool<X, C, D, P, R>::take() {
+  auto &shard = local();
+  X *x = nullptr;
+  if (shard.tryLock()) {
+    if (shard.cached_ == 0)
+      shard.refill();
+    if (shard.cached_ > 0)
+      x = shard.cache_[--shard.cached_].x_;
+    shard.unlock();
+  }
+  return x;
+}
+
+template <class X, class C, class D, class P, class R>
+inline X *Pool<X, C, D, P, R>::steal() {
+  auto start = pool_detail::threadIndex();
+  for (size_t i = 0; i <= mask_; ++i) {
+    auto &shard = shards_[(start + i) & mask_];
+    MYSPACE_IF_LOCK(shard.mtx_) {
+      if (!shard.free_.empty()) {
+        auto x = shard.free_.back().x_;
+        shard.free_.pop_back();
+        return x;
+      }
     }
+    X *x = nullptr;
+    shard.lock();
+    if (shard.cached_ > 0)
+      x = shard.cache_[--shard.cached_].x_;
+    shard.unlock();
+    if (x)
+      return x;
   }
-  MYSPACE_THROW_IF_EX(PoolError, !sp);
-  ++occupied_;
-  pool_detail::call(popper_, sp.get());
-  return sp;
+  return nullptr;
 }
 
 template <class X, class C, class D, class P, class R>
-inline typename std::shared_ptr<X>
-Pool<X, C, D, P, R>::tryGet() noexcept(false) {
-  auto ul = std::unique_lock<std::mutex>(mtx_);
-  return tryGetUnlocked();
+inline X *Pool<X, C, D, P, R>::create() {
+  auto n = created_.load(std::memory_order_relaxed);
+  do {
+    if (n >= max_)
+      return nullptr;
+  } while (!created_.compare_exchange_weak(n, n + 1));
+  X *x = nullptr;
+  try {
+    MYSPACE_IF_LOCK(create_mtx_) { x = creator_(); }
+  }
+  catch (...) {
+    created_.fetch_sub(1);
+    throw;
+  }
+  if (!x)
+    created_.fetch_sub(1);
+  else
+    creations_.fetch_add(1, std::memory_order_relaxed);
+  return x;
 }
 
 template <class X, class C, class D, class P, class R>
-template <class Predicate>
-inline typename std::shared_ptr<X>
-Pool<X, C, D, P, R>::get(Predicate pred) noexcept(false) {
+inline X *Pool<X, C, D, P, R>::acquire() {
+  X *x = nullptr;
+  for (;;) {
+    x = take();
+    if (!x)
+      x = steal();
+    if (!x || !validate_on_borrow_ || valid(x))
+      break;
+    invalid_.fetch_add(1, std::memory_order_relaxed);
+    discard(x);
+  }
+  if (x) {
+    local().hits_.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    x = create();
+    if (x)
+      misses_.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (x) {
+    occupied_.fetch_add(1, std::memory_order_relaxed);
+    pool_detail::call(popper_, x);
+  }
+  return x;
+}
+
+template <class X, class C, class D, class P, class R>
+template <class Stop>
+inline X *
+Pool<X, C, D, P, R>::wait(Stop stop,
+                          const std::chrono::steady_clock::time_point *deadline) {
   auto ul = std::unique_lock<std::mutex>(mtx_);
-  while (!pred()) {
+  for (;;) {
+    if (stop())
+      return nullptr;
+    waiters_.fetch_add(1);
+    // pairs with the fence in put(), either we see its object,
+    // or it sees us waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    X *x = nullptr;
     try {
-      return tryGetUnlocked();
+      x = acquire();
     }
     catch (...) {
-      cond_.wait(ul);
+      waiters_.fetch_sub(1);
+      throw;
     }
+    if (!x) {
+      if (deadline)
+        cond_.wait_until(ul, *deadline);
+      else
+        cond_.wait(ul);
+    }
+    waiters_.fetch_sub(1);
+    if (x)
+      return x;
+    if (deadline && std::chrono::steady_clock::now() >= *deadline)
+      return nullptr;
   }
-  MYSPACE_THROW_EX(PoolError);
-  return nullptr; // not reached
+}
+
+template <class X, class C, class D, class P, class R>
+inline std::shared_ptr<X> Pool<X, C, D, P, R>::wrap(X *x) {
+  auto pool = shared_from_this();
+  return std::shared_ptr<X>(x, [pool](X *x) { pool->put(x); });
+}
+
+template <class X, class C, class D, class P, class R>
+template <class Predicate>
+inline X *Pool<X, C, D, P, R>::checkout(
+    Predicate pred, const std::chrono::steady_clock::time_point *deadline) {
+  auto x = acquire();
+  if (!x) {
+    auto start = std::chrono::steady_clock::now();
+    x = wait(pred, deadline);
+    waits_.fetch_add(1, std::memory_order_relaxed);
+    wait_ns_.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now() - start)
+                           .count(),
+                       std::memory_order_relaxed);
+  }
+  MYSPACE_THROW_IF_EX(PoolError, !x);
+  return x;
+}
+
+template <class X, class C, class D, class P, class R>
+inline typename std::shared_ptr<X>
+Pool<X, C, D, P, R>::tryGet() noexcept(false) {
+  auto x = acquire();
+  MYSPACE_THROW_IF_EX(PoolError, !x);
+  return wrap(x);
+}
+
+template <class X, class C, class D, class P, class R>
+template <class Predicate>
+inline typename std::shared_ptr<X>
+Pool<X, C, D, P, R>::get(Predicate pred) noexcept(false) {
+  return wrap(checkout(pred, nullptr));
 }
 
 template <class X, class C, class D, class P, class R>
 inline typename std::shared_ptr<X> Pool<X, C, D, P, R>::get() noexcept(false) {
-  auto ul = std::unique_lock<std::mutex>(mtx_);
+  return get([]() { return false; });
+}
+
+template <class X, class C, class D, class P, class R>
+template <class Rep, class Period>
+inline typename std::shared_ptr<X> Pool<X, C, D, P, R>::getFor(
+    const std::chrono::duration<Rep, Period> &timeout) noexcept(false) {
+  return getFor(timeout, []() { return false; });
+}
+
+template <class X, class C, class D, class P, class R>
+template <class Rep, class Period, class Predicate>
+inline typename std::shared_ptr<X>
+Pool<X, C, D, P, R>::getFor(const std::chrono::duration<Rep, Period> &timeout,
+                            Predicate pred) noexcept(false) {
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::duration_cast<
+                      std::chrono::steady_clock::duration>(timeout);
+  return wrap(checkout(pred, &deadline));
+}
+
+template <class X, class C, class D, class P, class R>
+inline typename Pool<X, C, D, P, R>::Handle
+Pool<X, C, D, P, R>::tryGetHandle() noexcept(false) {
+  auto x = acquire();
+  MYSPACE_THROW_IF_EX(PoolError, !x);
+  return Handle(this, x);
+}
+
+template <class X, class C, class D, class P, class R>
+template <class Predicate>
+inline typename Pool<X, C, D, P, R>::Handle
+Pool<X, C, D, P, R>::getHandle(Predicate pred) noexcept(false) {
+  return Handle(this, checkout(pred, nullptr));
+}
+
+template <class X, class C, class D, class P, class R>
+inline typename Pool<X, C, D, P, R>::Handle
+Pool<X, C, D, P, R>::getHandle() noexcept(false) {
+  return getHandle([]() { return false; });
+}
+
+template <class X, class C, class D, class P, class R>
+template <class Rep, class Period>
+inline typename Pool<X, C, D, P, R>::Handle Pool<X, C, D, P, R>::getHandleFor(
+    const std::chrono::duration<Rep, Period> &timeout) noexcept(false) {
+  return getHandleFor(timeout, []() { return false; });
+}
+
+template <class X, class C, class D, class P, class R>
+template <class Rep, class Period, class Predicate>
+inline typename Pool<X, C, D, P, R>::Handle Pool<X, C, D, P, R>::getHandleFor(
+    const std::chrono::duration<Rep, Period> &timeout,
+    Predicate pred) noexcept(false) {
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::duration_cast<
+                      std::chrono::steady_clock::duration>(timeout);
+  return Handle(this, checkout(pred, &deadline));
+}
+
+template <class X, class C, class D, class P, class R>
+inline Pool<X, C, D, P, R>::Pool(const PoolOptions &options, C &&c, D &&d,
+                                 P &&p, R &&r,
+                                 std::function<bool(X *)> validator)
+    : max_(options.max_count_ == 0 ? SIZE_MAX : options.max_count_),
+      creator_(std::forward<C>(c)), deleter_(std::forward<D>(d)),
+      popper_(std::forward<P>(p)), recycler_(std::forward<R>(r)),
+      validator_(std::move(validator)), min_idle_(options.min_idle_),
+      max_idle_ms_(options.max_idle_time_.count()),
+      validate_on_borrow_(options.validate_on_borrow_ && validator_),
+      validate_interval_(validator_ ? options.validate_interval_
+                                    : std::chrono::milliseconds(0)),
+      maintain_interval_(options.maintain_interval_),
+      start_(std::chrono::steady_clock::now()) {
+  size_t n = 1;
+  while (n < std::thread::hardware_concurrency())
+    n <<= 1;
+  mask_ = n - 1;
+  shards_.reset(new pool_detail::Shard<X>[n]);
+  if (min_idle_ > 0 || max_idle_ms_ > 0 || validate_interval_.count() > 0)
+    maintainer_ = std::thread([this]() { maintain(); });
+}
+
+template <class X, class C, class D, class P, class R>
+inline Pool<X, C, D, P, R>::~Pool() {
+  if (maintainer_.joinable()) {
+    MYSPACE_IF_LOCK(maintain_mtx_) { stopping_ = true; }
+    maintain_cond_.notify_all();
+    maintainer_.join();
+  }
+  // a shared_ptr checkout holds the pool, and a Handle must be gone before
+  // it, so all objects are idle here
+  assert(occupied_.load() == 0 && "a Handle outlived its Pool");
+  for (size_t i = 0; i <= mask_; ++i) {
+    auto &shard = shards_[i];
+    while (shard.cached_ > 0)
+      pool_detail::destroy(deleter_, shard.cache_[--shard.cached_].x_);
+    for (auto &idle : shard.free_)
+      pool_detail::destroy(deleter_, idle.x_);
+  }
+}
+
+template <class X, class C, class D, class P, class R>
+inline void Pool<X, C, D, P, R>::put(X *px) {
+  occupied_.fetch_sub(1, std::memory_order_relaxed);
+  pool_detail::call(recycler_, px);
+  stash(Idle{ px, clock_.load(std::memory_order_relaxed) });
+}
+
+template <class X, class C, class D, class P, class R>
+inline void Pool<X, C, D, P, R>::stash(Idle idle) {
+  auto &shard = local();
+  if (shard.tryLock()) {
+    if (shard.cached_ == pool_detail::Shard<X>::MAGAZINE)
+      shard.spill();
+    shard.cache_[shard.cached_++] = idle;
+    shard.unlock();
+  } else {
+    MYSPACE_IF_LOCK(shard.mtx_) { shard.free_.push_back(idle); }
+  }
+  wake();
+}
+
+template <class X, class C, class D, class P, class R>
+inline void Pool<X, C, D, P, R>::wake() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiters_.load(std::memory_order_relaxed) > 0) {
+    MYSPACE_IF_LOCK(mtx_) {}
+    cond_.notify_one();
+  }
+}
+
+template <class X, class C, class D, class P, class R>
+inline bool Pool<X, C, D, P, R>::valid(X *x) {
   try {
-    return tryGetUnlocked();
+    return validator_(x);
   }
   catch (...) {
+    return false;
   }
-  cond_.wait(ul);
-  return tryGetUnlocked();
 }
 
 template <class X, class C, class D, class P, class R>
-template <class Rep, class Period>
-inline typename std::shared_ptr<X> Pool<X, C, D, P, R>::getFor(
-    const std::chrono::duration<Rep, Period> &timeout) noexcept(false) {
-  auto ul = std::unique_lock<std::mutex>(mtx_);
+inline void Pool<X, C, D, P, R>::discard(X *x) {
   try {
-    return tryGetUnlocked();
+    MYSPACE_IF_LOCK(create_mtx_) { pool_detail::destroy(deleter_, x); }
   }
   catch (...) {
+    MYSPACE_WARN_EXCEPTION();
   }
-  cond_.wait_for(ul, timeout);
-  return tryGetUnlocked();
+  created_.fetch_sub(1);
 }
 
 template <class X, class C, class D, class P, class R>
-template <class Rep, class Period, class Predicate>
-inline typename std::shared_ptr<X>
-Pool<X, C, D, P, R>::getFor(const std::chrono::duration<Rep, Period> &timeout,
-                            Predicate pred) noexcept(false) {
-  auto ul = std::unique_lock<std::mutex>(mtx_);
-  auto begin_time = std::chrono::high_resolution_clock::now();
-  while (!pred()) {
+inline uint64_t Pool<X, C, D, P, R>::now() const {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now() - start_)
+      .count();
+}
+
+template <class X, class C, class D, class P, class R>
+inline void Pool<X, C, D, P, R>::maintain() {
+  auto next_validate = start_ + validate_interval_;
+  auto ul = std::unique_lock<std::mutex>(maintain_mtx_);
+  while (!stopping_) {
+    ul.unlock();
+    clock_.store(now(), std::memory_order_relaxed);
+    bool validate = false;
+    if (validate_interval_.count() > 0 &&
+        std::chrono::steady_clock::now() >= next_validate) {
+      validate = true;
+      next_validate = std::chrono::steady_clock::now() + validate_interval_;
+    }
     try {
-      return tryGetUnlocked();
+      tick(validate);
     }
     catch (...) {
+      MYSPACE_WARN_EXCEPTION();
     }
-    auto cost_time = std::chrono::high_resolution_clock::now() - begin_time;
-    if (cost_time >= timeout) {
-      break;
-    }
-    cond_.wait_for(ul, timeout - cost_time);
+    ul.lock();
+    maintain_cond_.wait_for(ul, maintain_interval_,
+                            [this]() { return stopping_; });
   }
-  MYSPACE_THROW_EX(PoolError);
-  return nullptr; // not reached
 }
 
 template <class X, class C, class D, class P, class R>
-inline Pool<X, C, D, P, R>::Pool(size_t max_count, C &&c, D &&d, P &&p, R &&r)
-    : max_(max_count), creator_(std::forward<C>(c)),
-      deleter_(std::forward<D>(d)), popper_(std::forward<P>(p)),
-      recycler_(std::forward<R>(r)) {}
+inline void Pool<X, C, D, P, R>::tick(bool validate) {
+  auto clock = clock_.load(std::memory_order_relaxed);
+  auto created = created_.load();
+  auto occupied = occupied_.load();
+  auto idle = created > occupied ? created - occupied : 0;
+  // how many may go for their age
+  size_t evictable = idle > min_idle_ ? idle - min_idle_ : 0;
+  std::vector<X *> expired;
+  std::vector<Idle> checks;
+  auto sweep = [&](Idle idle) {
+    if (max_idle_ms_ > 0 && evictable > 0 &&
+        clock - idle.since_ >= max_idle_ms_) {
+      --evictable;
+      expired.push_back(idle.x_);
+      return true;
+    }
+    if (validate) {
+      checks.push_back(idle);
+      return true;
+    }
+    return false;
+  };
+  if (max_idle_ms_ > 0 || validate) {
+    for (size_t i = 0; i <= mask_; ++i) {
+      auto &shard = shards_[i];
+      shard.lock();
+      MYSPACE_IF_LOCK(shard.mtx_) {
+        size_t n = 0;
+        for (size_t j = 0; j < shard.cached_; ++j)
+          if (!sweep(shard.cache_[j]))
+            shard.cache_[n++] = shard.cache_[j];
+        shard.cached_ = n;
+        n = 0;
+        for (size_t j = 0; j < shard.free_.size(); ++j)
+          if (!sweep(shard.free_[j]))
+            shard.free_[n++] = shard.free_[j];
+        shard.free_.resize(n);
+      }
+      shard.unlock();
+    }
+  }
+  for (auto x : expired) {
+    evicted_.fetch_add(1, std::memory_order_relaxed);
+    discard(x);
+  }
+  for (auto &check : checks) {
+    if (valid(check.x_)) {
+      stash(check);
+    } else {
+      invalid_.fetch_add(1, std::memory_order_relaxed);
+      discard(check.x_);
+    }
+  }
+  // a waiter at max_ may create one now
+  if (!expired.empty() || !checks.empty())
+    wake();
+  // pre-warm
+  while (min_idle_ > 0) {
+    created = created_.load();
+    occupied = occupied_.load();
+    if (created > occupied && created - occupied >= min_idle_)
+      break;
+    auto x = create();
+    if (!x)
+      break;
+    stash(Idle{ x, clock });
+  }
+}
 
 template <class X, class C, class D, class P, class R>
-inline void Pool<X, C, D, P, R>::put(X *px) {
-  auto ul = std::unique_lock<std::mutex>(mtx_);
-  --occupied_;
-  pool_detail::call(recycler_, px);
-  StorageType x(px, deleter_);
-  avaible_.push_back(std::move(x));
-  ul.unlock();
-  cond_.notify_one();
+inline PoolStats Pool<X, C, D, P, R>::stats() const {
+  PoolStats stats;
+  for (size_t i = 0; i <= mask_; ++i)
+    stats.hits_ += shards_[i].hits_.load(std::memory_order_relaxed);
+  stats.misses_ = misses_.load(std::memory_order_relaxed);
+  stats.created_ = creations_.load(std::memory_order_relaxed);
+  stats.evicted_ = evicted_.load(std::memory_order_relaxed);
+  stats.invalid_ = invalid_.load(std::memory_order_relaxed);
+  stats.waits_ = waits_.load(std::memory_order_relaxed);
+  stats.wait_ns_ = wait_ns_.load(std::memory_order_relaxed);
+  stats.occupied_ = occupied_.load(std::memory_order_relaxed);
+  auto created = created_.load(std::memory_order_relaxed);
+  stats.available_ = created > stats.occupied_ ? created - stats.occupied_ : 0;
+  return stats;
+}
+
+inline double PoolStats::hitRatio() const {
+  auto total = hits_ + misses_;
+  return total == 0 ? 0 : (double)hits_ / total;
+}
+
+inline Json PoolStats::toJson() const {
+  return Json{ { "hits", hits_ },         { "misses", misses_ },
+               { "hit_ratio", hitRatio() }, { "created", created_ },
+               { "evicted", evicted_ },   { "invalid", invalid_ },
+               { "waits", waits_ },       { "wait_ns", wait_ns_ },
+               { "occupied", occupied_ }, { "available", available_ } };
 }
 
 template <class X, class Creator, class Deleter, class Popper, class Recycler>
@@ -196,12 +827,25 @@ inline auto PoolFactory::create(size_t max_count, Creator &&creator,
                                 Deleter &&deleter, Popper &&popper,
                                 Recycler &&recycler)
     -> std::shared_ptr<Pool<X, Creator, Deleter, Popper, Recycler> > {
+  PoolOptions options;
+  options.max_count_ = max_count;
+  return create<X>(options, std::forward<Creator>(creator),
+                   std::forward<Deleter>(deleter), std::forward<Popper>(popper),
+                   std::forward<Recycler>(recycler));
+}
+
+template <class X, class Creator, class Deleter, class Popper, class Recycler>
+inline auto PoolFactory::create(const PoolOptions &options, Creator &&creator,
+                                Deleter &&deleter, Popper &&popper,
+                                Recycler &&recycler,
+                                std::function<bool(X *)> validator)
+    -> std::shared_ptr<Pool<X, Creator, Deleter, Popper, Recycler> > {
   typedef Pool<X, Creator, Deleter, Popper, Recycler> PoolType;
 
   return std::shared_ptr<PoolType>(new PoolType(
-      (max_count == 0 ? SIZE_MAX : max_count), std::forward<Creator>(creator),
-      std::forward<Deleter>(deleter), std::forward<Popper>(popper),
-      std::forward<Recycler>(recycler)));
+      options, std::forward<Creator>(creator), std::forward<Deleter>(deleter),
+      std::forward<Popper>(popper), std::forward<Recycler>(recycler),
+      std::move(validator)));
 }
 
 MYSPACE_END
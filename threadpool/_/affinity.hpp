@@ -0,0 +1,90 @@
+
+#pragma once
+
+#include "myspace/_/stdafx.hpp"
+#include "myspace/strings/strings.hpp"
+
+MYSPACE_BEGIN
+
+namespace threadpoolimpl {
+
+// "0-3,8,10-11" -> 0 1 2 3 8 10 11, as in /sys/devices/system/node/*/cpulist
+inline std::vector<int> parseCpuList(const std::string &list) {
+  std::vector<int> ret;
+  for (auto &range : Strings::splitOf(list, ',')) {
+    auto bounds = Strings::splitOf(Strings::stripOf(range), '-');
+    if (bounds.empty() || bounds.front().empty())
+      continue;
+    auto first = std::atoi(bounds.front().c_str());
+    auto last = bounds.size() > 1 ? std::atoi(bounds.back().c_str()) : first;
+    for (auto cpu = first; cpu <= last; ++cpu)
+      ret.push_back(cpu);
+  }
+  return ret;
+}
+
+// cpus this process may run on
+inline std::vector<int> allowedCpus() {
+  std::vector<int> ret;
+#if defined(MYSPACE_LINUX)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (::sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set))
+        ret.push_back(cpu);
+    }
+  }
+#endif
+  if (ret.empty()) {
+    auto n = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned cpu = 0; cpu < n; ++cpu)
+      ret.push_back((int)cpu);
+  }
+  return ret;
+}
+
+// allowed cpus grouped by numa node, one group if there is no numa info
+inline std::vector<std::vector<int> > numaNodes(const std::vector<int> &cpus) {
+  std::vector<std::vector<int> > ret;
+#if defined(MYSPACE_LINUX)
+  for (int node = 0;; ++node) {
+    std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) +
+                     "/cpulist");
+    if (!in)
+      break;
+    std::string list;
+    std::getline(in, list);
+    std::vector<int> group;
+    for (auto cpu : parseCpuList(list)) {
+      if (std::find(cpus.begin(), cpus.end(), cpu) != cpus.end())
+        group.push_back(cpu);
+    }
+    if (!group.empty())
+      ret.push_back(std::move(group));
+  }
+#endif
+  if (ret.empty())
+    ret.push_back(cpus);
+  return ret;
+}
+
+// bind the calling thread to cpus, false if the os refuses
+inline bool pinTo(const std::vector<int> &cpus) {
+#if defined(MYSPACE_LINUX)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE)
+      CPU_SET(cpu, &set);
+  }
+  return ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void)cpus;
+  return false;
+#endif
+}
+
+} // namespace threadpoolimpl
+
+MYSPACE_END
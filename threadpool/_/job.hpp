@@ -0,0 +1,233 @@
+
+#pragma once
+
+#include "myspace/_/stdafx.hpp"
+#include "myspace/threadpool/_/task.hpp"
+
+MYSPACE_BEGIN
+
+namespace threadpoolimpl {
+
+enum {
+  // number of priority levels, 0 is the highest
+  LEVELS = 4,
+};
+
+typedef std::chrono::steady_clock::time_point Deadline;
+
+struct Job {
+  Task task_;
+
+  // runs instead of task_ when the deadline has passed
+  Task expired_;
+
+  Deadline deadline_ = Deadline::max();
+
+  // when it was pushed, for the queue wait time
+  std::chrono::steady_clock::time_point enqueued_;
+
+  size_t level_ = 0;
+
+  Job *next_ = nullptr;
+};
+
+// singly linked free list of Job nodes, not thread safe
+class JobStack {
+public:
+  JobStack() {}
+
+  JobStack(const JobStack &) = delete;
+  JobStack &operator=(const JobStack &) = delete;
+
+  ~JobStack() {
+    while (auto job = pop())
+      delete job;
+  }
+
+  void push(Job *job) {
+    job->next_ = head_;
+    head_ = job;
+    ++size_;
+  }
+
+  Job *pop() {
+    auto job = head_;
+    if (job) {
+      head_ = job->next_;
+      job->next_ = nullptr;
+      --size_;
+    }
+    return job;
+  }
+
+  // move at most n nodes from other to this
+  void take(JobStack &other, size_t n) {
+    while (n-- > 0) {
+      auto job = other.pop();
+      if (!job)
+        break;
+      push(job);
+    }
+  }
+
+  size_t size() const { return size_; }
+
+  bool empty() const { return head_ == nullptr; }
+
+private:
+  Job *head_ = nullptr;
+
+  size_t size_ = 0;
+};
+
+// intrusive FIFO of pending jobs, not thread safe
+class JobList {
+public:
+  JobList() {}
+
+  JobList(const JobList &) = delete;
+  JobList &operator=(const JobList &) = delete;
+
+  ~JobList() {
+    while (auto job = popFront())
+      delete job;
+  }
+
+  bool empty() const { return head_ == nullptr; }
+
+  size_t size() const { return size_; }
+
+  void pushFront(Job *job) {
+    job->next_ = head_;
+    head_ = job;
+    if (!tail_)
+      tail_ = job;
+    ++size_;
+  }
+
+  void pushBack(Job *job) {
+    job->next_ = nullptr;
+    if (tail_)
+      tail_->next_ = job;
+    else
+      head_ = job;
+    tail_ = job;
+    ++size_;
+  }
+
+  Job *front() const { return head_; }
+
+  Job *popFront() {
+    auto job = head_;
+    if (job) {
+      head_ = job->next_;
+      if (!head_)
+        tail_ = nullptr;
+      job->next_ = nullptr;
+      --size_;
+    }
+    return job;
+  }
+
+private:
+  Job *head_ = nullptr;
+
+  Job *tail_ = nullptr;
+
+  size_t size_ = 0;
+};
+
+// pending jobs by priority level, a higher level always goes first,
+// inside a level jobs with a deadline go first, earliest deadline first,
+// then the rest in FIFO order.
+// also keeps the free nodes shared by every thread that pushes to it,
+// not thread safe, guard it with Critical
+class JobQueue {
+public:
+  JobQueue() {}
+
+  JobQueue(const JobQueue &) = delete;
+  JobQueue &operator=(const JobQueue &) = delete;
+
+  ~JobQueue() {
+    while (auto job = pop())
+      delete job;
+  }
+
+  bool empty() const { return size() == 0; }
+
+  size_t size() const {
+    size_t n = 0;
+    for (size_t i = 0; i < LEVELS; ++i)
+      n += size(i);
+    return n;
+  }
+
+  size_t size(size_t level) const {
+    return fifo_[level].size() + edf_[level].size();
+  }
+
+  void push(Job *job, bool front) {
+    auto level = job->level_;
+    if (job->deadline_ != Deadline::max()) {
+      edf_[level].push_back(job);
+      std::push_heap(edf_[level].begin(), edf_[level].end(), later);
+    } else if (front) {
+      fifo_[level].pushFront(job);
+    } else {
+      fifo_[level].pushBack(job);
+    }
+  }
+
+  Job *pop() {
+    for (size_t i = 0; i < LEVELS; ++i) {
+      if (!edf_[i].empty()) {
+        std::pop_heap(edf_[i].begin(), edf_[i].end(), later);
+        auto job = edf_[i].back();
+        edf_[i].pop_back();
+        return job;
+      }
+      if (auto job = fifo_[i].popFront())
+        return job;
+    }
+    return nullptr;
+  }
+
+  // when the longest waiting job was pushed, roughly, as pushFront and
+  // deadlines reorder the lists. max if empty
+  std::chrono::steady_clock::time_point oldest() const {
+    auto ret = std::chrono::steady_clock::time_point::max();
+    for (size_t i = 0; i < LEVELS; ++i) {
+      if (auto job = fifo_[i].front())
+        ret = std::min(ret, job->enqueued_);
+      if (!edf_[i].empty())
+        ret = std::min(ret, edf_[i].front()->enqueued_);
+    }
+    return ret;
+  }
+
+  Job *alloc() {
+    auto job = free_.pop();
+    return job ? job : new Job;
+  }
+
+  void recycle(Job *job) { free_.push(job); }
+
+  JobStack &freeNodes() { return free_; }
+
+private:
+  static bool later(const Job *a, const Job *b) {
+    return a->deadline_ > b->deadline_;
+  }
+
+  JobList fifo_[LEVELS];
+
+  // min heaps on deadline_
+  std::vector<Job *> edf_[LEVELS];
+
+  JobStack free_;
+};
+
+} // namespace threadpoolimpl
+
+MYSPACE_END
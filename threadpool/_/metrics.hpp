@@ -0,0 +1,106 @@
+
+#pragma once
+
+#include "myspace/_/stdafx.hpp"
+
+MYSPACE_BEGIN
+
+namespace threadpoolimpl {
+
+enum {
+  // execution time buckets, bucket 0 is below 1us, bucket i is
+  // [2^(i-1), 2^i) us, the last one takes everything above
+  HISTOGRAM = 24,
+};
+
+// which execution time bucket ns falls in
+inline size_t bucketOf(uint64_t ns) {
+  auto us = ns / 1000;
+  size_t i = 0;
+  while (us > 0 && i + 1 < HISTOGRAM) {
+    us >>= 1;
+    ++i;
+  }
+  return i;
+}
+
+// counters of one worker, padded to a cache line of its own.
+// a worker writes its own counters with plain load + store, no lock prefix,
+// shared ones (jobs run by threads outside the pool) need the atomic add
+class Counters {
+public:
+  explicit Counters(bool shared = false) : shared_(shared) {
+    for (auto &n : histogram_)
+      n.store(0, std::memory_order_relaxed);
+  }
+
+  Counters(const Counters &) = delete;
+  Counters &operator=(const Counters &) = delete;
+
+  void executed() { add(executed_, 1); }
+
+  void ran(uint64_t ns) {
+    add(busy_ns_, ns);
+    add(histogram_[bucketOf(ns)], 1);
+  }
+
+  void stolen() { add(stolen_, 1); }
+
+  void waited(uint64_t ns) { add(wait_ns_, ns); }
+
+  void idle(uint64_t ns) { add(idle_ns_, ns); }
+
+  void parked(uint64_t ns) { add(parked_ns_, ns); }
+
+  void exception() { add(exceptions_, 1); }
+
+  static uint64_t read(const std::atomic<uint64_t> &n) {
+    return n.load(std::memory_order_relaxed);
+  }
+
+  char pad0_[64];
+
+  std::atomic<uint64_t> executed_{ 0 };
+
+  std::atomic<uint64_t> stolen_{ 0 };
+
+  std::atomic<uint64_t> exceptions_{ 0 };
+
+  // from push to start of execution
+  std::atomic<uint64_t> wait_ns_{ 0 };
+
+  std::atomic<uint64_t> busy_ns_{ 0 };
+
+  // looking for work, not parked
+  std::atomic<uint64_t> idle_ns_{ 0 };
+
+  std::atomic<uint64_t> parked_ns_{ 0 };
+
+  std::atomic<uint64_t> histogram_[HISTOGRAM];
+
+private:
+  void add(std::atomic<uint64_t> &n, uint64_t v) {
+    if (shared_)
+      n.fetch_add(v, std::memory_order_relaxed);
+    else
+      n.store(n.load(std::memory_order_relaxed) + v,
+              std::memory_order_relaxed);
+  }
+
+  bool shared_;
+
+  char pad1_[64];
+};
+
+inline uint64_t nanosSince(std::chrono::steady_clock::time_point from,
+                           std::chrono::steady_clock::time_point to) {
+  if (to <= from)
+    return 0;
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             to - from)
+      .count();
+}
+
+} // namespace threadpoolimpl
+
+MYSPACE_END
@@ -0,0 +1,151 @@
+
+#pragma once
+
+#include "myspace/_/stdafx.hpp"
+
+MYSPACE_BEGIN
+
+namespace threadpoolimpl {
+
+// Chase-Lev work stealing deque
+// (Le, Pop, Cohen, Nardelli: "Correct and Efficient Work-Stealing for Weak
+// Memory Models", PPoPP 2013).
+// the owner thread push/pop at the bottom, any other thread steal at the top.
+// X must be a pointer like type, nullptr means "nothing".
+template <class X> class StealDeque {
+public:
+  StealDeque(size_t capacity = 256);
+
+  StealDeque(const StealDeque &) = delete;
+  StealDeque &operator=(const StealDeque &) = delete;
+
+  // owner only
+  void push(X x);
+
+  // owner only
+  X pop();
+
+  // any thread
+  X steal();
+
+  // any thread, approximate
+  size_t size() const;
+
+  bool empty() const;
+
+private:
+  struct Ring {
+    Ring(int64_t capacity)
+        : capacity_(capacity), mask_(capacity - 1),
+          buffer_(new std::atomic<X>[capacity]) {}
+
+    X get(int64_t i) const {
+      return buffer_[i & mask_].load(std::memory_order_relaxed);
+    }
+
+    void put(int64_t i, X x) {
+      buffer_[i & mask_].store(x, std::memory_order_relaxed);
+    }
+
+    int64_t capacity_;
+    int64_t mask_;
+    std::unique_ptr<std::atomic<X>[]> buffer_;
+  };
+
+  Ring *grow(Ring *ring, int64_t bottom, int64_t top);
+
+  // keep thieves (top_) and the owner (bottom_) on different cache lines,
+  // padding instead of alignas, new only honors extended alignment in c++17
+  char pad0_[64];
+  std::atomic<int64_t> top_;
+  char pad1_[64 - sizeof(std::atomic<int64_t>)];
+  std::atomic<int64_t> bottom_;
+  std::atomic<Ring *> ring_;
+  char pad2_[64 - sizeof(std::atomic<int64_t>) - sizeof(std::atomic<Ring *>)];
+  // thieves may still read an old ring, keep them until destruction
+  std::deque<std::unique_ptr<Ring> > rings_;
+};
+
+template <class X>
+inline StealDeque<X>::StealDeque(size_t capacity)
+    : top_(0), bottom_(0) {
+  size_t n = 1;
+  while (n < capacity)
+    n <<= 1;
+  rings_.emplace_back(new Ring((int64_t)n));
+  ring_.store(rings_.back().get(), std::memory_order_relaxed);
+}
+
+template <class X> inline void StealDeque<X>::push(X x) {
+  auto b = bottom_.load(std::memory_order_relaxed);
+  auto t = top_.load(std::memory_order_acquire);
+  auto ring = ring_.load(std::memory_order_relaxed);
+  if (b - t > ring->capacity_ - 1) {
+    ring = grow(ring, b, t);
+  }
+  ring->put(b, x);
+  bottom_.store(b + 1, std::memory_order_release);
+}
+
+template <class X> inline X StealDeque<X>::pop() {
+  auto b = bottom_.load(std::memory_order_relaxed) - 1;
+  auto ring = ring_.load(std::memory_order_relaxed);
+  bottom_.store(b, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  auto t = top_.load(std::memory_order_relaxed);
+  if (t > b) {
+    bottom_.store(b + 1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  X x = ring->get(b);
+  if (t == b) {
+    // last one, race with thieves
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+      x = nullptr;
+    }
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+  return x;
+}
+
+template <class X> inline X StealDeque<X>::steal() {
+  auto t = top_.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  auto b = bottom_.load(std::memory_order_acquire);
+  if (t >= b)
+    return nullptr;
+  auto ring = ring_.load(std::memory_order_acquire);
+  X x = ring->get(t);
+  if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                    std::memory_order_relaxed)) {
+    return nullptr;
+  }
+  return x;
+}
+
+template <class X> inline size_t StealDeque<X>::size() const {
+  auto b = bottom_.load(std::memory_order_relaxed);
+  auto t = top_.load(std::memory_order_relaxed);
+  return b > t ? size_t(b - t) : 0;
+}
+
+template <class X> inline bool StealDeque<X>::empty() const {
+  return size() == 0;
+}
+
+template <class X>
+inline typename StealDeque<X>::Ring *
+StealDeque<X>::grow(Ring *ring, int64_t bottom, int64_t top) {
+  auto bigger = new Ring(ring->capacity_ << 1);
+  for (auto i = top; i < bottom; ++i) {
+    bigger->put(i, ring->get(i));
+  }
+  rings_.emplace_back(bigger);
+  ring_.store(bigger, std::memory_order_release);
+  return bigger;
+}
+
+} // namespace threadpoolimpl
+
+MYSPACE_END
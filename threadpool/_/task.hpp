@@ -0,0 +1,147 @@
+
+#pragma once
+
+#include "myspace/_/stdafx.hpp"
+
+MYSPACE_BEGIN
+
+// move only void() callable,
+// small callables (lambdas with a few captures, std::bind of a function and
+// a couple of arguments, std::packaged_task) are stored inline without any
+// heap allocation, larger ones fall back to new
+class Task {
+public:
+  enum { INLINE_SIZE = 6 * sizeof(void *) };
+
+  Task() noexcept;
+
+  template <class Function,
+            typename std::enable_if<
+                !std::is_same<typename std::decay<Function>::type, Task>::value,
+                int>::type = 0>
+  Task(Function &&f);
+
+  Task(Task &&t) noexcept;
+
+  Task(const Task &) = delete;
+
+  Task &operator=(const Task &) = delete;
+
+  Task &operator=(Task &&t) noexcept;
+
+  ~Task();
+
+  void operator()();
+
+  explicit operator bool() const;
+
+  void reset();
+
+private:
+  struct Ops {
+    void (*call_)(void *);
+    // move construct into dst, and destroy src
+    void (*move_)(void *dst, void *src);
+    void (*destroy_)(void *);
+  };
+
+  template <class F> struct InlineOps {
+    static void call(void *p) { (*static_cast<F *>(p))(); }
+    static void move(void *dst, void *src) {
+      new (dst) F(std::move(*static_cast<F *>(src)));
+      static_cast<F *>(src)->~F();
+    }
+    static void destroy(void *p) { static_cast<F *>(p)->~F(); }
+    static const Ops *ops() {
+      static const Ops o = { &call, &move, &destroy };
+      return &o;
+    }
+  };
+
+  template <class F> struct HeapOps {
+    static void call(void *p) { (**static_cast<F **>(p))(); }
+    static void move(void *dst, void *src) {
+      *static_cast<F **>(dst) = *static_cast<F **>(src);
+    }
+    static void destroy(void *p) { delete *static_cast<F **>(p); }
+    static const Ops *ops() {
+      static const Ops o = { &call, &move, &destroy };
+      return &o;
+    }
+  };
+
+  template <class F> struct Fits {
+    static const bool value =
+        sizeof(F) <= INLINE_SIZE &&
+        alignof(std::max_align_t) % alignof(F) == 0 &&
+        std::is_nothrow_move_constructible<F>::value;
+  };
+
+  template <class F, class Function>
+  typename std::enable_if<Fits<F>::value>::type store(Function &&f);
+
+  template <class F, class Function>
+  typename std::enable_if<!Fits<F>::value>::type store(Function &&f);
+
+  alignas(std::max_align_t) unsigned char storage_[INLINE_SIZE];
+
+  const Ops *ops_ = nullptr;
+};
+
+inline Task::Task() noexcept {}
+
+template <class Function,
+          typename std::enable_if<
+              !std::is_same<typename std::decay<Function>::type, Task>::value,
+              int>::type>
+inline Task::Task(Function &&f) {
+  store<typename std::decay<Function>::type>(std::forward<Function>(f));
+}
+
+inline Task::Task(Task &&t) noexcept : ops_(t.ops_) {
+  if (ops_) {
+    ops_->move_(storage_, t.storage_);
+    t.ops_ = nullptr;
+  }
+}
+
+inline Task &Task::operator=(Task &&t) noexcept {
+  if (this != &t) {
+    reset();
+    ops_ = t.ops_;
+    if (ops_) {
+      ops_->move_(storage_, t.storage_);
+      t.ops_ = nullptr;
+    }
+  }
+  return *this;
+}
+
+inline Task::~Task() { reset(); }
+
+inline void Task::operator()() { ops_->call_(storage_); }
+
+inline Task::operator bool() const { return ops_ != nullptr; }
+
+inline void Task::reset() {
+  if (ops_) {
+    ops_->destroy_(storage_);
+    ops_ = nullptr;
+  }
+}
+
+template <class F, class Function>
+inline typename std::enable_if<Task::Fits<F>::value>::type
+Task::store(Function &&f) {
+  new (storage_) F(std::forward<Function>(f));
+  ops_ = InlineOps<F>::ops();
+}
+
+template <class F, class Function>
+inline typename std::enable_if<!Task::Fits<F>::value>::type
+Task::store(Function &&f) {
+  *reinterpret_cast<F **>(storage_) = new F(std::forward<Function>(f));
+  ops_ = HeapOps<F>::ops();
+}
+
+MYSPACE_END
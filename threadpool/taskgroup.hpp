@@ -0,0 +1,506 @@
+
+#pragma once
+
+#include "myspace/_/stdafx.hpp"
+#include "myspace/mutex/mutex.hpp"
+#include "myspace/threadpool/threadpool.hpp"
+
+MYSPACE_BEGIN
+
+namespace threadpoolimpl {
+
+// wait until done() turns true, running pending jobs of the pool meanwhile,
+// block(timeout) is called only when there is nothing to help with
+template <class Done, class Block>
+inline void helpUntil(ThreadPool &pool, Done done, Block block) {
+  parkerimpl::Backoff backoff;
+  while (!done()) {
+    if (pool.runPending()) {
+      backoff.reset();
+    } else if (!backoff.completed()) {
+      backoff.snooze();
+    } else {
+      // what we wait for runs somewhere else, or sits in a deque we can not
+      // reach, wake up now and then to look again
+      block(std::chrono::milliseconds(1));
+    }
+  }
+}
+
+} // namespace threadpoolimpl
+
+// fan out jobs to the pool, and join them.
+// wait() runs pending jobs of the pool while waiting, so a job can
+// wait for its own sub jobs without holding up a worker
+class TaskGroup {
+public:
+  TaskGroup(ThreadPool &pool);
+
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup &operator=(const TaskGroup &) = delete;
+
+  // waits, exceptions of the jobs are dropped
+  ~TaskGroup();
+
+  template <class Function, class... Arguments>
+  void run(Function &&f, Arguments &&... args);
+
+  // rethrow the first exception thrown by a job
+  void wait() noexcept(false);
+
+  size_t pending() const;
+
+private:
+  void finish();
+
+  ThreadPool &pool_;
+
+  std::atomic<size_t> pending_{ 0 };
+
+  std::mutex mtx_;
+
+  std::condition_variable cond_;
+
+  std::exception_ptr error_;
+};
+
+template <class T> class Future;
+
+namespace futureimpl {
+
+template <class T> class Value {
+public:
+  ~Value() {
+    if (has_)
+      reinterpret_cast<T *>(&storage_)->~T();
+  }
+
+  template <class Function> void set(Function &f) {
+    new (&storage_) T(f());
+    has_ = true;
+  }
+
+  const T &get() const { return *reinterpret_cast<const T *>(&storage_); }
+
+private:
+  typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_;
+
+  bool has_ = false;
+};
+
+template <> class Value<void> {
+public:
+  template <class Function> void set(Function &f) { f(); }
+
+  void get() const {}
+};
+
+template <class T> class State {
+public:
+  State(ThreadPool &pool) : pool_(pool) {}
+
+  // run f, keep its result or exception, then schedule the continuations
+  template <class Function> void complete(Function &f) {
+    try {
+      value_.set(f);
+    }
+    catch (...) {
+      error_ = std::current_exception();
+    }
+    finish();
+  }
+
+  void fail(std::exception_ptr error) {
+    error_ = error;
+    finish();
+  }
+
+  void onReady(Task &&task) {
+    MYSPACE_IF_LOCK(mtx_) {
+      if (!ready_.load(std::memory_order_relaxed)) {
+        next_.push_back(std::move(task));
+        return;
+      }
+    }
+    pool_.post(std::move(task));
+  }
+
+  bool ready() const { return ready_.load(std::memory_order_acquire); }
+
+  ThreadPool &pool_;
+
+  std::atomic<bool> ready_{ false };
+
+  Value<T> value_;
+
+  std::exception_ptr error_;
+
+  std::mutex mtx_;
+
+  std::condition_variable cond_;
+
+  std::deque<Task> next_;
+
+private:
+  void finish() {
+    std::deque<Task> next;
+    MYSPACE_IF_LOCK(mtx_) {
+      ready_.store(true, std::memory_order_release);
+      next.swap(next_);
+      cond_.notify_all();
+    }
+    for (auto &task : next)
+      pool_.post(std::move(task));
+  }
+};
+
+template <class T, class Function> struct ThenResult {
+  typedef typename std::result_of<Function(const T &)>::type type;
+};
+
+template <class Function> struct ThenResult<void, Function> {
+  typedef typename std::result_of<Function()>::type type;
+};
+
+// call f with the value of prev
+template <class T, class Function> struct Call {
+  Call(const std::shared_ptr<State<T> > &prev, Function &f)
+      : prev_(prev), f_(f) {}
+
+  typename ThenResult<T, Function>::type operator()() {
+    return f_(prev_->value_.get());
+  }
+
+  const std::shared_ptr<State<T> > &prev_;
+
+  Function &f_;
+};
+
+template <class Function> struct Call<void, Function> {
+  Call(const std::shared_ptr<State<void> > &, Function &f) : f_(f) {}
+
+  typename ThenResult<void, Function>::type operator()() { return f_(); }
+
+  Function &f_;
+};
+
+} // namespace futureimpl
+
+// result of a job run by a ThreadPool, shared like std::shared_future.
+// then() chains a job that runs on the pool once this one is done,
+// nobody blocks for it. get() and wait() help the pool while waiting
+template <class T> class Future {
+public:
+  Future() {}
+
+  bool valid() const;
+
+  bool ready() const;
+
+  void wait() const;
+
+  // rethrow the exception thrown by the job
+  typename std::add_lvalue_reference<typename std::add_const<T>::type>::type
+  get() const noexcept(false);
+
+  // f takes const T & (or nothing for Future<void>), if this job failed,
+  // f is skipped and the returned future holds the same exception
+  template <class Function>
+  auto then(Function &&f)
+      -> Future<typename futureimpl::ThenResult<
+          T, typename std::decay<Function>::type>::type>;
+
+private:
+  Future(const std::shared_ptr<futureimpl::State<T> > &state);
+
+  std::shared_ptr<futureimpl::State<T> > state_;
+
+  template <class X> friend class Future;
+
+  template <class Function, class... Arguments>
+  friend auto async(ThreadPool &pool, Function &&f, Arguments &&... args)
+      -> Future<typename std::result_of<Function(Arguments...)>::type>;
+};
+
+// run f(args...) on the pool, like pushBack, but return a Future
+template <class Function, class... Arguments>
+auto async(ThreadPool &pool, Function &&f, Arguments &&... args)
+    -> Future<typename std::result_of<Function(Arguments...)>::type>;
+
+// f(i) for every i in [first, last).
+// the range is cut into chunks that shrink as the work runs out, the
+// caller takes part, and at most pool.size() jobs are queued,
+// grain is the smallest chunk
+template <class Index, class Function>
+void parallelFor(ThreadPool &pool, Index first, Index last, Function &&f,
+                 size_t grain = 1) noexcept(false);
+
+// fold [first, last) into one T,
+// body(begin, end, acc) folds one chunk into acc and returns it,
+// reduce(a, b) merges partial results, it must be associative and
+// commutative, chunks go to participants in no particular order
+template <class Index, class T, class Body, class Reduce>
+T parallelReduce(ThreadPool &pool, Index first, Index last, T identity,
+                 Body &&body, Reduce &&reduce,
+                 size_t grain = 1) noexcept(false);
+
+inline TaskGroup::TaskGroup(ThreadPool &pool) : pool_(pool) {}
+
+inline TaskGroup::~TaskGroup() {
+  try {
+    wait();
+  }
+  catch (...) {
+    MYSPACE_DEV_EXCEPTION();
+  }
+}
+
+template <class Function, class... Arguments>
+inline void TaskGroup::run(Function &&f, Arguments &&... args) {
+  auto job =
+      std::bind(std::forward<Function>(f), std::forward<Arguments>(args)...);
+  pending_.fetch_add(1, std::memory_order_relaxed);
+  pool_.post(Task([this, job]() mutable {
+    try {
+      job();
+    }
+    catch (...) {
+      MYSPACE_IF_LOCK(mtx_) {
+        if (!error_)
+          error_ = std::current_exception();
+      }
+    }
+    finish();
+  }));
+}
+
+inline void TaskGroup::finish() {
+  auto n = pending_.load(std::memory_order_relaxed);
+  while (n > 1) {
+    if (pending_.compare_exchange_weak(n, n - 1, std::memory_order_release,
+                                       std::memory_order_relaxed))
+      return;
+  }
+  // maybe the last one, the waiter may destroy us as soon as it sees 0,
+  // so drop to 0 only while holding the lock it takes before leaving
+  MYSPACE_IF_LOCK(mtx_) {
+    if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      cond_.notify_all();
+  }
+}
+
+inline void TaskGroup::wait() noexcept(false) {
+  threadpoolimpl::helpUntil(
+      pool_,
+      [this]() { return pending_.load(std::memory_order_acquire) == 0; },
+      [this](std::chrono::milliseconds timeout) {
+        auto ul = std::unique_lock<std::mutex>(mtx_);
+        cond_.wait_for(ul, timeout, [this]() {
+          return pending_.load(std::memory_order_acquire) == 0;
+        });
+      });
+  std::exception_ptr error;
+  MYSPACE_IF_LOCK(mtx_) { std::swap(error, error_); }
+  if (error)
+    std::rethrow_exception(error);
+}
+
+inline size_t TaskGroup::pending() const {
+  return pending_.load(std::memory_order_relaxed);
+}
+
+template <class T>
+inline Future<T>::Future(const std::shared_ptr<futureimpl::State<T> > &state)
+    : state_(state) {}
+
+template <class T> inline bool Future<T>::valid() const { return !!state_; }
+
+template <class T> inline bool Future<T>::ready() const {
+  return state_ && state_->ready();
+}
+
+template <class T> inline void Future<T>::wait() const {
+  auto state = state_.get();
+  threadpoolimpl::helpUntil(
+      state->pool_, [state]() { return state->ready(); },
+      [state](std::chrono::milliseconds timeout) {
+        auto ul = std::unique_lock<std::mutex>(state->mtx_);
+        state->cond_.wait_for(ul, timeout,
+                              [state]() { return state->ready(); });
+      });
+}
+
+template <class T>
+inline typename std::add_lvalue_reference<
+    typename std::add_const<T>::type>::type
+Future<T>::get() const noexcept(false) {
+  wait();
+  if (state_->error_)
+    std::rethrow_exception(state_->error_);
+  return state_->value_.get();
+}
+
+template <class T>
+template <class Function>
+inline auto Future<T>::then(Function &&f)
+    -> Future<typename futureimpl::ThenResult<
+        T, typename std::decay<Function>::type>::type> {
+  typedef typename std::decay<Function>::type F;
+  typedef typename futureimpl::ThenResult<T, F>::type R;
+  auto prev = state_;
+  auto next = newShared<futureimpl::State<R> >(prev->pool_);
+  F fn(std::forward<Function>(f));
+  prev->onReady(Task([prev, next, fn]() mutable {
+    if (prev->error_) {
+      next->fail(prev->error_);
+    } else {
+      futureimpl::Call<T, F> call(prev, fn);
+      next->complete(call);
+    }
+  }));
+  return Future<R>(next);
+}
+
+template <class Function, class... Arguments>
+inline auto async(ThreadPool &pool, Function &&f, Arguments &&... args)
+    -> Future<typename std::result_of<Function(Arguments...)>::type> {
+  typedef typename std::result_of<Function(Arguments...)>::type R;
+  auto state = newShared<futureimpl::State<R> >(pool);
+  auto job =
+      std::bind(std::forward<Function>(f), std::forward<Arguments>(args)...);
+  pool.post(Task([state, job]() mutable { state->complete(job); }));
+  return Future<R>(state);
+}
+
+namespace threadpoolimpl {
+
+// hands out chunks of [0, n), big ones first, smaller ones towards the end
+class Chunker {
+public:
+  Chunker(size_t n, size_t participants, size_t grain)
+      : n_(n), participants_(participants), grain_(grain ? grain : 1) {}
+
+  bool next(size_t &begin, size_t &end) {
+    auto taken = next_.load(std::memory_order_relaxed);
+    if (taken >= n_)
+      return false;
+    auto chunk = std::max(grain_, (n_ - taken) / (2 * participants_));
+    begin = next_.fetch_add(chunk, std::memory_order_relaxed);
+    if (begin >= n_)
+      return false;
+    end = std::min(n_, begin + chunk);
+    return true;
+  }
+
+  // stop handing out chunks
+  void cancel() { next_.store(n_, std::memory_order_relaxed); }
+
+private:
+  size_t n_;
+
+  size_t participants_;
+
+  size_t grain_;
+
+  std::atomic<size_t> next_{ 0 };
+};
+
+// how many threads work on n items, the caller included
+inline size_t participants(ThreadPool &pool, size_t n, size_t grain) {
+  auto chunks = (n + grain - 1) / (grain ? grain : 1);
+  return std::max<size_t>(1, std::min(chunks, pool.size() + 1));
+}
+
+} // namespace threadpoolimpl
+
+template <class Index, class Function>
+inline void parallelFor(ThreadPool &pool, Index first, Index last,
+                        Function &&f, size_t grain) noexcept(false) {
+  if (!(first < last))
+    return;
+  size_t n = size_t(last - first);
+  auto participants = threadpoolimpl::participants(pool, n, grain);
+  threadpoolimpl::Chunker chunker(n, participants, grain);
+  auto work = [&]() {
+    try {
+      size_t begin, end;
+      while (chunker.next(begin, end)) {
+        for (auto i = begin; i < end; ++i)
+          f(Index(first + i));
+      }
+    }
+    catch (...) {
+      chunker.cancel();
+      throw;
+    }
+  };
+  TaskGroup group(pool);
+  for (size_t i = 1; i < participants; ++i)
+    group.run(std::ref(work));
+  std::exception_ptr error;
+  try {
+    work();
+  }
+  catch (...) {
+    error = std::current_exception();
+  }
+  try {
+    group.wait();
+  }
+  catch (...) {
+    if (!error)
+      error = std::current_exception();
+  }
+  if (error)
+    std::rethrow_exception(error);
+}
+
+template <class Index, class T, class Body, class Reduce>
+inline T parallelReduce(ThreadPool &pool, Index first, Index last, T identity,
+                        Body &&body, Reduce &&reduce,
+                        size_t grain) noexcept(false) {
+  if (!(first < last))
+    return identity;
+  size_t n = size_t(last - first);
+  auto participants = threadpoolimpl::participants(pool, n, grain);
+  threadpoolimpl::Chunker chunker(n, participants, grain);
+  std::vector<T> partial(participants, identity);
+  auto work = [&](size_t who) {
+    try {
+      size_t begin, end;
+      while (chunker.next(begin, end)) {
+        partial[who] = body(Index(first + begin), Index(first + end),
+                            std::move(partial[who]));
+      }
+    }
+    catch (...) {
+      chunker.cancel();
+      throw;
+    }
+  };
+  TaskGroup group(pool);
+  for (size_t i = 1; i < participants; ++i)
+    group.run([&work, i]() { work(i); });
+  std::exception_ptr error;
+  try {
+    work(0);
+  }
+  catch (...) {
+    error = std::current_exception();
+  }
+  try {
+    group.wait();
+  }
+  catch (...) {
+    if (!error)
+      error = std::current_exception();
+  }
+  if (error)
+    std::rethrow_exception(error);
+  T result = std::move(partial[0]);
+  for (size_t i = 1; i < participants; ++i)
+    result = reduce(std::move(result), std::move(partial[i]));
+  return result;
+}
+
+MYSPACE_END
@@ -2,16 +2,125 @@
 #pragma once
 
 #include "myspace/_/stdafx.hpp"
+#include "myspace/concurrency/_/parker.hpp"
 #include "myspace/critical/critical.hpp"
 #include "myspace/defer/defer.hpp"
+#include "myspace/json/json.hpp"
 #include "myspace/logger/logger.hpp"
 #include "myspace/mutex/mutex.hpp"
+#include "myspace/threadpool/_/affinity.hpp"
+#include "myspace/threadpool/_/job.hpp"
+#include "myspace/threadpool/_/metrics.hpp"
+#include "myspace/threadpool/_/stealdeque.hpp"
+#include "myspace/threadpool/_/task.hpp"
 
 MYSPACE_BEGIN
 
+namespace threadpoolimpl {
+struct Worker;
+}
+
 class ThreadPool {
 public:
-  ThreadPool(size_t max_threads = std::thread::hardware_concurrency());
+  enum Schedule {
+    // one job list shared by all workers
+    SHARED,
+    // every worker owns a deque, post and the front pushes from a worker
+    // stay local and run LIFO there, everything else goes to the shared
+    // list, idle workers steal. pushBack keeps its FIFO order through the
+    // shared list, as do priorities and deadlines. a worker looks at the
+    // shared list first every 61 jobs, so a job posting itself again
+    // cannot starve those pushed from outside
+    STEALING,
+  };
+
+  // a job of a higher class never waits behind one of a lower class,
+  // pushFront/pushBack/post use NORMAL
+  enum Priority {
+    CRITICAL, // heartbeats, dns refresh ...
+    HIGH,
+    NORMAL,
+    BULK,
+  };
+
+  typedef std::chrono::steady_clock::time_point Deadline;
+
+  // what the pool has done so far, every number counts from the start
+  struct Stats {
+    struct Counters {
+      uint64_t executed_ = 0;
+      uint64_t stolen_ = 0;
+      // swallowed by the catch all around a job
+      uint64_t exceptions_ = 0;
+      // from push to the start of execution, summed over all jobs
+      uint64_t wait_ns_ = 0;
+      // running jobs, a worker going from one job straight to the next
+      // charges the dequeue to the next one
+      uint64_t busy_ns_ = 0;
+      // spinning for work
+      uint64_t idle_ns_ = 0;
+      uint64_t parked_ns_ = 0;
+      // jobs by execution time, bucket 0 is below 1us,
+      // bucket i is [2^(i-1), 2^i) us, the last one takes the rest
+      std::vector<uint64_t> histogram_ =
+          std::vector<uint64_t>(threadpoolimpl::HISTOGRAM, 0);
+
+      Counters &operator+=(const Counters &other);
+
+      Json toJson() const;
+    };
+
+    // one per worker thread
+    std::vector<Counters> workers_;
+
+    // jobs run by runPending() on threads outside the pool
+    Counters external_;
+
+    // all of the above
+    Counters total_;
+
+    // waiting jobs by priority
+    std::vector<size_t> queued_;
+
+    Json toJson() const;
+  };
+
+  enum Affinity {
+    // let the os place the workers
+    FLOAT,
+    // worker i runs on the i-th allowed cpu only, wrapping around
+    CORE,
+    // workers are dealt round robin to the numa nodes, and run on any
+    // allowed cpu of their node
+    NUMA,
+  };
+
+  struct Options {
+    // threads kept alive, 0 or above max_threads_ means max_threads_,
+    // the pool is elastic when it is below max_threads_
+    size_t min_threads_ = 0;
+
+    size_t max_threads_ = std::thread::hardware_concurrency();
+
+    Schedule schedule_ = STEALING;
+
+    // add a thread when a job has waited in the queue longer than this,
+    // at most one thread per this period
+    std::chrono::microseconds grow_latency_ = std::chrono::milliseconds(1);
+
+    // a thread above min_threads_ parked longer than this exits
+    std::chrono::microseconds idle_timeout_ = std::chrono::seconds(10);
+
+    Affinity affinity_ = FLOAT;
+
+    // cpus for CORE and NUMA, empty means those the process may run on
+    std::vector<int> cpus_;
+  };
+
+  ThreadPool(size_t max_threads = std::thread::hardware_concurrency(),
+             Schedule schedule = STEALING);
+
+  explicit ThreadPool(const Options &options);
 
   ~ThreadPool();
 
@@ -23,92 +132,763 @@ public:
   auto pushBack(Function &&f, Arguments &&... args)
       -> std::future<typename std::result_of<Function(Arguments...)>::type>;
 
+  // fire and forget, no future, small callables never touch the heap.
+  // with STEALING a worker runs what it posts LIFO, no order is kept
+  template <class Function, class... Arguments>
+  void post(Function &&f, Arguments &&... args);
+
+  template <class Function, class... Arguments>
+  void postFront(Function &&f, Arguments &&... args);
+
+  // an already type erased job, moved in as is
+  void post(Task &&task);
+
+  void postFront(Task &&task);
+
+  template <class Function, class... Arguments>
+  auto pushWith(Priority priority, Function &&f, Arguments &&... args)
+      -> std::future<typename std::result_of<Function(Arguments...)>::type>;
+
+  template <class Function, class... Arguments>
+  void postWith(Priority priority, Function &&f, Arguments &&... args);
+
+  // jobs with a deadline run before the others of the same priority,
+  // earliest deadline first. if the deadline has passed when a worker
+  // picks the job up, it is dropped and the future throws
+  // std::future_error(broken_promise)
+  template <class Function, class... Arguments>
+  auto pushUntil(Priority priority, Deadline deadline, Function &&f,
+                 Arguments &&... args)
+      -> std::future<typename std::result_of<Function(Arguments...)>::type>;
+
+  // like pushUntil, but runs expired instead of job when the deadline has
+  // passed, expired may be empty
+  void postUntil(Priority priority, Deadline deadline, Task &&job,
+                 Task &&expired = Task());
+
+  // jobs of this priority waiting to run
+  size_t queueDepth(Priority priority) const;
+
+  // run one pending job on the calling thread, false if there is none,
+  // workers of this pool also look at their own deque and steal,
+  // other threads only take from the shared list
+  bool runPending();
+
+  // threads running now, between min_threads_ and max_threads_
+  size_t size() const;
+
+  // a snapshot of the counters, lock free and cheap enough to poll,
+  // the counters keep moving while it is taken, so the numbers may be
+  // off by a few jobs from each other
+  Stats stats() const;
+
+  // the times in Stats (wait, busy, idle, parked, histogram) cost a clock
+  // read at push and one per job, on by default, the counts are always kept
+  void setTiming(bool on);
+
 private:
   template <class Function, class... Arguments>
-  auto push(bool putfront, Function &&f, Arguments &&... args)
+  auto push(bool putfront, Priority priority, Deadline deadline, Function &&f,
+            Arguments &&... args)
       -> std::future<typename std::result_of<Function(Arguments...)>::type>;
 
-  void workerProc();
+  // unordered lets a back push take the local deque too
+  void submit(bool putfront, Task &&task, Priority priority = NORMAL,
+              Deadline deadline = Deadline::max(), Task &&expired = Task(),
+              bool unordered = false);
+
+  // something waits in the shared queue above NORMAL
+  bool hasUrgent() const;
+
+  size_t queued() const;
+
+  void workerProc(threadpoolimpl::Worker &self);
+
+  // enqueued is set to when the job was pushed
+  bool findTask(threadpoolimpl::Worker &self, Task &task, Deadline &enqueued);
+
+  bool takeShared(Task &task, Deadline &enqueued);
+
+  bool steal(threadpoolimpl::Worker &self, Task &task, Deadline &enqueued);
+
+  bool hasWork() const;
+
+  // start is when the worker got to the job, read here if not known,
+  // returns when the job finished, or a default Deadline without timing
+  Deadline execute(Task &task, Deadline enqueued,
+                   threadpoolimpl::Counters &counters, Deadline start);
+
+  // park self until a submitter picks it, or stop,
+  // false when an extra thread has been idle for too long and should exit
+  bool park(threadpoolimpl::Worker &self);
+
+  // take self off sleepers_, false if a submitter already did
+  bool unlist(threadpoolimpl::Worker &self);
+
+  bool elastic() const;
 
-  bool stop_ = false;
+  // start one more thread if there is room and it is time
+  void grow();
 
-  Critical<std::list<std::function<void()> > > jobs_;
+  // under resize_
+  void start(threadpoolimpl::Worker &worker);
 
+  // wake a parked worker, unless someone is already looking for work
+  void wakeOne();
+
+  void wakeAll();
+
+  threadpoolimpl::Job *allocLocal(threadpoolimpl::Worker &self);
+
+  void recycleLocal(threadpoolimpl::Worker &self, threadpoolimpl::Job *job);
+
+  static threadpoolimpl::Worker *&currentWorker();
+
+  std::atomic<bool> stop_{ false };
+
+  std::atomic<bool> timing_{ true };
+
+  Schedule schedule_;
+
+  Critical<threadpoolimpl::JobQueue> jobs_;
+
+  // size of jobs_ by priority, readable without the lock
+  std::atomic<size_t> queued_[threadpoolimpl::LEVELS];
+
+  // workers spinning for work, they will pick up new jobs without a wakeup
+  std::atomic<size_t> spinning_{ 0 };
+
+  // parked workers, the last one parked is the first one woken
+  Critical<std::deque<threadpoolimpl::Worker *> > sleepers_;
+
+  // size of sleepers_, readable without the lock
+  std::atomic<size_t> sleeping_{ 0 };
+
+  // max_threads_ slots, a slot without a thread has an empty deque
+  std::deque<std::unique_ptr<threadpoolimpl::Worker> > workers_;
+
+  size_t min_threads_;
+
+  std::chrono::microseconds grow_latency_;
+
+  std::chrono::microseconds idle_timeout_;
+
+  // threads running, not counting those on their way out
+  std::atomic<size_t> active_{ 0 };
+
+  // steady clock ticks of the last grow()
+  std::atomic<int64_t> last_grow_{ 0 };
+
+  // guards starting and joining threads_
+  std::mutex resize_;
+
+  // for jobs run by runPending() on other threads
+  threadpoolimpl::Counters external_{ true };
+
+  // one per slot in workers_
   std::deque<std::thread> threads_;
 };
 
-inline ThreadPool::ThreadPool(size_t max_threads) {
+namespace threadpoolimpl {
+struct Worker {
+  Worker(ThreadPool *pool, size_t index) : pool_(pool), index_(index) {}
+
+  ThreadPool *pool_;
+
+  size_t index_;
+
+  // xorshift state for choosing a victim
+  uint32_t seed_ = 2463534242u;
+
+  // findTask calls, for the FAIR_TICK look at the shared list
+  uint32_t ticks_ = 0;
+
+  StealDeque<Job *> local_;
+
+  // free Job nodes, only touched by this worker
+  JobStack cache_;
+
+  parkerimpl::Parker parker_;
+
+  Counters counters_;
+
+  // the slot has a thread
+  std::atomic<bool> running_{ false };
+
+  // pin the thread to these, if any
+  std::vector<int> cpus_;
+};
+
+enum {
+  // a worker keeps at most this many free nodes,
+  CACHE_MAX = 256,
+  // and moves this many from/to the shared free list at once
+  CACHE_BATCH = 64,
+  // a worker on STEALING takes the shared list first once in this many
+  // jobs, 61 as in the go scheduler
+  FAIR_TICK = 61,
+};
+} // namespace threadpoolimpl
+
+inline ThreadPool::ThreadPool(size_t max_threads, Schedule schedule)
+    : ThreadPool([&]() {
+        Options options;
+        options.max_threads_ = max_threads;
+        options.schedule_ = schedule;
+        return options;
+      }()) {}
+
+inline ThreadPool::ThreadPool(const Options &options)
+    : schedule_(options.schedule_), grow_latency_(options.grow_latency_),
+      idle_timeout_(options.idle_timeout_) {
+  static_assert(BULK + 1 == threadpoolimpl::LEVELS, "one level a priority");
+  for (auto &n : queued_)
+    n.store(0, std::memory_order_relaxed);
+  auto max_threads = options.max_threads_;
   if (max_threads == 0)
     max_threads = std::thread::hardware_concurrency();
   if (max_threads == 0)
     max_threads = 1;
+  min_threads_ = options.min_threads_;
+  if (min_threads_ == 0 || min_threads_ > max_threads)
+    min_threads_ = max_threads;
   for (size_t i = 0; i < max_threads; ++i) {
-    threads_.emplace_back([this]() { this->workerProc(); });
+    workers_.emplace_back(new threadpoolimpl::Worker(this, i));
+    workers_.back()->seed_ += (uint32_t)i * 0x9e3779b9u;
+  }
+  threads_.resize(max_threads);
+  if (options.affinity_ != FLOAT) {
+    auto cpus = options.cpus_.empty() ? threadpoolimpl::allowedCpus()
+                                      : options.cpus_;
+    auto nodes = threadpoolimpl::numaNodes(cpus);
+    for (size_t i = 0; i < max_threads; ++i) {
+      if (options.affinity_ == CORE)
+        workers_[i]->cpus_.push_back(cpus[i % cpus.size()]);
+      else
+        workers_[i]->cpus_ = nodes[i % nodes.size()];
+    }
+  }
+  MYSPACE_IF_LOCK(resize_) {
+    for (size_t i = 0; i < min_threads_; ++i)
+      start(*workers_[i]);
   }
 }
 
 template <class Function, class... Arguments>
 inline auto ThreadPool::pushFront(Function &&f, Arguments &&... args)
     -> std::future<typename std::result_of<Function(Arguments...)>::type> {
-  return std::move(
-      push(true, std::forward<Function>(f), std::forward<Arguments>(args)...));
+  return std::move(push(true, NORMAL, Deadline::max(), std::forward<Function>(f),
+                        std::forward<Arguments>(args)...));
 }
 
 template <class Function, class... Arguments>
 inline auto ThreadPool::pushBack(Function &&f, Arguments &&... args)
     -> std::future<typename std::result_of<Function(Arguments...)>::type> {
-  return std::move(
-      push(false, std::forward<Function>(f), std::forward<Arguments>(args)...));
+  return std::move(push(false, NORMAL, Deadline::max(),
+                        std::forward<Function>(f),
+                        std::forward<Arguments>(args)...));
 }
 
 inline ThreadPool::~ThreadPool() {
-  stop_ = true;
-  jobs_.notify_all();
-  for (auto &thr : threads_)
-    thr.join();
+  stop_.store(true);
+  wakeAll();
+  // joined out of the lock, a worker may be in grow() waiting for it
+  std::deque<std::thread> threads;
+  MYSPACE_IF_LOCK(resize_) { threads.swap(threads_); }
+  for (auto &thr : threads) {
+    if (thr.joinable())
+      thr.join();
+  }
+}
+
+inline threadpoolimpl::Worker *&ThreadPool::currentWorker() {
+  static thread_local threadpoolimpl::Worker *worker = nullptr;
+  return worker;
 }
 
 template <class Function, class... Arguments>
-inline auto ThreadPool::push(bool putfront, Function &&f, Arguments &&... args)
+inline auto ThreadPool::push(bool putfront, Priority priority,
+                             Deadline deadline, Function &&f,
+                             Arguments &&... args)
     -> std::future<typename std::result_of<Function(Arguments...)>::type> {
   using return_t = typename std::result_of<Function(Arguments...)>::type;
-  auto job = newShared<std::packaged_task<return_t()> >(
+  std::packaged_task<return_t()> job(
       std::bind(std::forward<Function>(f), std::forward<Arguments>(args)...));
-  auto ret = job->get_future();
+  auto ret = job.get_future();
+  submit(putfront, Task(std::move(job)), priority, deadline);
+  return std::move(ret);
+}
+
+template <class Function, class... Arguments>
+inline auto ThreadPool::pushWith(Priority priority, Function &&f,
+                                 Arguments &&... args)
+    -> std::future<typename std::result_of<Function(Arguments...)>::type> {
+  return std::move(push(false, priority, Deadline::max(),
+                        std::forward<Function>(f),
+                        std::forward<Arguments>(args)...));
+}
+
+template <class Function, class... Arguments>
+inline auto ThreadPool::pushUntil(Priority priority, Deadline deadline,
+                                  Function &&f, Arguments &&... args)
+    -> std::future<typename std::result_of<Function(Arguments...)>::type> {
+  return std::move(push(false, priority, deadline, std::forward<Function>(f),
+                        std::forward<Arguments>(args)...));
+}
+
+template <class Function, class... Arguments>
+inline void ThreadPool::postWith(Priority priority, Function &&f,
+                                 Arguments &&... args) {
+  submit(false, Task(std::bind(std::forward<Function>(f),
+                               std::forward<Arguments>(args)...)),
+         priority);
+}
+
+inline void ThreadPool::postUntil(Priority priority, Deadline deadline,
+                                  Task &&job, Task &&expired) {
+  submit(false, std::move(job), priority, deadline, std::move(expired));
+}
+
+inline size_t ThreadPool::queueDepth(Priority priority) const {
+  auto n = queued_[priority].load(std::memory_order_relaxed);
+  if (priority == NORMAL) {
+    for (auto &worker : workers_)
+      n += worker->local_.size();
+  }
+  return n;
+}
+
+template <class Function, class... Arguments>
+inline void ThreadPool::post(Function &&f, Arguments &&... args) {
+  submit(false,
+         Task(std::bind(std::forward<Function>(f),
+                        std::forward<Arguments>(args)...)),
+         NORMAL, Deadline::max(), Task(), true);
+}
+
+template <class Function, class... Arguments>
+inline void ThreadPool::postFront(Function &&f, Arguments &&... args) {
+  submit(true, Task(std::bind(std::forward<Function>(f),
+                              std::forward<Arguments>(args)...)));
+}
+
+inline void ThreadPool::post(Task &&task) {
+  submit(false, std::move(task), NORMAL, Deadline::max(), Task(), true);
+}
+
+inline void ThreadPool::postFront(Task &&task) {
+  submit(true, std::move(task));
+}
+
+inline bool ThreadPool::runPending() {
+  Task task;
+  Deadline enqueued;
+  auto self = currentWorker();
+  if (self && self->pool_ == this) {
+    if (!findTask(*self, task, enqueued))
+      return false;
+    execute(task, enqueued, self->counters_, Deadline());
+    return true;
+  }
+  if (!takeShared(task, enqueued))
+    return false;
+  execute(task, enqueued, external_, Deadline());
+  return true;
+}
+
+inline size_t ThreadPool::size() const {
+  return active_.load(std::memory_order_relaxed);
+}
+
+inline void ThreadPool::submit(bool putfront, Task &&task, Priority priority,
+                               Deadline deadline, Task &&expired,
+                               bool unordered) {
+  auto now = timing_.load(std::memory_order_relaxed) || elastic()
+                 ? std::chrono::steady_clock::now()
+                 : Deadline();
+  bool late = false;
+  auto self = currentWorker();
+  if (schedule_ == STEALING && self && self->pool_ == this &&
+      (putfront || unordered) && priority == NORMAL &&
+      deadline == Deadline::max()) {
+    // the owner runs its deque LIFO, the job runs next on this worker
+    // unless someone steals it
+    auto job = allocLocal(*self);
+    job->task_ = std::move(task);
+    job->enqueued_ = now;
+    self->local_.push(job);
+  } else {
+    MYSPACE_IF_LOCK(jobs_) {
+      auto job = jobs_.alloc();
+      job->task_ = std::move(task);
+      job->expired_ = std::move(expired);
+      job->deadline_ = deadline;
+      job->enqueued_ = now;
+      job->level_ = priority;
+      jobs_.push(job, putfront);
+      queued_[priority].fetch_add(1);
+      // nobody free to take it, and the queue is not moving
+      late = elastic() && spinning_.load(std::memory_order_relaxed) == 0 &&
+             sleeping_.load(std::memory_order_relaxed) == 0 &&
+             now - jobs_.oldest() > grow_latency_;
+    }
+  }
+  wakeOne();
+  if (late)
+    grow();
+}
+
+inline threadpoolimpl::Job *
+ThreadPool::allocLocal(threadpoolimpl::Worker &self) {
+  if (self.cache_.empty()) {
+    MYSPACE_IF_LOCK(jobs_) {
+      self.cache_.take(jobs_.freeNodes(), threadpoolimpl::CACHE_BATCH);
+    }
+  }
+  auto job = self.cache_.pop();
+  return job ? job : new threadpoolimpl::Job;
+}
+
+inline void ThreadPool::recycleLocal(threadpoolimpl::Worker &self,
+                                     threadpoolimpl::Job *job) {
+  self.cache_.push(job);
+  if (self.cache_.size() > threadpoolimpl::CACHE_MAX) {
+    MYSPACE_IF_LOCK(jobs_) {
+      jobs_.freeNodes().take(self.cache_, threadpoolimpl::CACHE_BATCH);
+    }
+  }
+}
+
+inline bool ThreadPool::findTask(threadpoolimpl::Worker &self, Task &task,
+                                 Deadline &enqueued) {
+  if (schedule_ == STEALING) {
+    if ((hasUrgent() || ++self.ticks_ % threadpoolimpl::FAIR_TICK == 0) &&
+        takeShared(task, enqueued))
+      return true;
+    if (auto job = self.local_.pop()) {
+      task = std::move(job->task_);
+      enqueued = job->enqueued_;
+      recycleLocal(self, job);
+      return true;
+    }
+    return takeShared(task, enqueued) || steal(self, task, enqueued);
+  }
+  return takeShared(task, enqueued);
+}
+
+inline bool ThreadPool::takeShared(Task &task, Deadline &enqueued) {
+  if (queued() == 0)
+    return false;
+  // destroyed out of the lock
+  Task dropped;
   MYSPACE_IF_LOCK(jobs_) {
-    if (putfront) {
-      jobs_.emplace_front([job]() { (*job)(); });
+    auto job = jobs_.pop();
+    if (!job)
+      return false;
+    queued_[job->level_].fetch_sub(1, std::memory_order_relaxed);
+    enqueued = job->enqueued_;
+    if (job->deadline_ != Deadline::max() &&
+        job->deadline_ < std::chrono::steady_clock::now()) {
+      // an empty task still counts as progress
+      dropped = std::move(job->task_);
+      task = std::move(job->expired_);
     } else {
-      jobs_.emplace_back([job]() { (*job)(); });
+      task = std::move(job->task_);
+      dropped = std::move(job->expired_);
     }
+    jobs_.recycle(job);
   }
-  jobs_.notify_one();
-  return std::move(ret);
+  return true;
 }
 
-inline void ThreadPool::workerProc() {
-  for (;;) {
-    std::function<void()> job;
-    MYSPACE_IF_LOCK(jobs_) {
-      if (jobs_.empty()) {
-        if (stop_)
-          break;
-        jobs_.wait_for(__ul, std::chrono::seconds(1),
-                       [this]() { return !jobs_.empty() || stop_; });
-        continue;
+inline bool ThreadPool::hasUrgent() const {
+  return queued_[CRITICAL].load(std::memory_order_relaxed) > 0 ||
+         queued_[HIGH].load(std::memory_order_relaxed) > 0;
+}
+
+inline size_t ThreadPool::queued() const {
+  size_t n = 0;
+  for (auto &level : queued_)
+    n += level.load(std::memory_order_seq_cst);
+  return n;
+}
+
+inline bool ThreadPool::steal(threadpoolimpl::Worker &self, Task &task,
+                              Deadline &enqueued) {
+  auto n = workers_.size();
+  if (n < 2)
+    return false;
+  self.seed_ ^= self.seed_ << 13;
+  self.seed_ ^= self.seed_ >> 17;
+  self.seed_ ^= self.seed_ << 5;
+  auto start = self.seed_ % n;
+  for (size_t i = 0; i < n; ++i) {
+    auto &victim = *workers_[(start + i) % n];
+    if (&victim == &self)
+      continue;
+    if (auto job = victim.local_.steal()) {
+      task = std::move(job->task_);
+      enqueued = job->enqueued_;
+      recycleLocal(self, job);
+      self.counters_.stolen();
+      return true;
+    }
+  }
+  return false;
+}
+
+inline bool ThreadPool::hasWork() const {
+  if (queued() > 0)
+    return true;
+  if (schedule_ == STEALING) {
+    for (auto &worker : workers_) {
+      if (!worker->local_.empty())
+        return true;
+    }
+  }
+  return false;
+}
+
+inline void ThreadPool::wakeOne() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (spinning_.load(std::memory_order_relaxed) > 0 ||
+      sleeping_.load(std::memory_order_relaxed) == 0)
+    return;
+  threadpoolimpl::Worker *worker = nullptr;
+  MYSPACE_IF_LOCK(sleepers_) {
+    if (!sleepers_.empty()) {
+      worker = sleepers_.back();
+      sleepers_.pop_back();
+      sleeping_.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+  if (worker)
+    worker->parker_.unpark();
+}
+
+inline void ThreadPool::wakeAll() {
+  std::deque<threadpoolimpl::Worker *> workers;
+  MYSPACE_IF_LOCK(sleepers_) {
+    workers.swap(sleepers_);
+    sleeping_.store(0, std::memory_order_relaxed);
+  }
+  for (auto worker : workers)
+    worker->parker_.unpark();
+}
+
+inline bool ThreadPool::park(threadpoolimpl::Worker &self) {
+  MYSPACE_IF_LOCK(sleepers_) { sleepers_.push_back(&self); }
+  sleeping_.fetch_add(1, std::memory_order_seq_cst);
+  // pairs with the fence in wakeOne(), either the submitter sees us on the
+  // list, or we see its job here
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (hasWork() || stop_.load()) {
+    if (unlist(self))
+      return true;
+    // a submitter already took us off the list, eat its permit
+    self.parker_.park();
+    return true;
+  }
+  if (!elastic()) {
+    self.parker_.park();
+    return true;
+  }
+  while (!self.parker_.parkFor(idle_timeout_)) {
+    auto n = active_.load(std::memory_order_relaxed);
+    if (n <= min_threads_ || stop_.load() ||
+        !active_.compare_exchange_strong(n, n - 1))
+      continue;
+    if (unlist(self))
+      return false;
+    // picked right at the timeout, stay and take the job
+    active_.fetch_add(1);
+    self.parker_.park();
+    return true;
+  }
+  return true;
+}
+
+inline bool ThreadPool::unlist(threadpoolimpl::Worker &self) {
+  MYSPACE_IF_LOCK(sleepers_) {
+    auto itr = std::find(sleepers_.begin(), sleepers_.end(), &self);
+    if (itr != sleepers_.end()) {
+      sleepers_.erase(itr);
+      sleeping_.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+inline bool ThreadPool::elastic() const {
+  return min_threads_ < workers_.size();
+}
+
+inline void ThreadPool::grow() {
+  if (stop_.load() ||
+      active_.load(std::memory_order_relaxed) >= workers_.size())
+    return;
+  auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+  auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    grow_latency_)
+                    .count();
+  auto last = last_grow_.load(std::memory_order_relaxed);
+  if (now - last < period ||
+      !last_grow_.compare_exchange_strong(last, now))
+    return;
+  MYSPACE_IF_LOCK(resize_) {
+    if (stop_.load())
+      return;
+    for (auto &worker : workers_) {
+      if (!worker->running_.load()) {
+        start(*worker);
+        return;
       }
-      job.swap(jobs_.front());
-      jobs_.pop_front();
     }
-    if (job) {
-      try {
-        job();
+  }
+}
+
+inline void ThreadPool::start(threadpoolimpl::Worker &worker) {
+  auto &thr = threads_[worker.index_];
+  // a retired thread, already past its last touch of worker
+  if (thr.joinable())
+    thr.join();
+  worker.running_.store(true);
+  active_.fetch_add(1);
+  auto w = &worker;
+  thr = std::thread([this, w]() { this->workerProc(*w); });
+}
+
+inline void ThreadPool::workerProc(threadpoolimpl::Worker &self) {
+  currentWorker() = &self;
+  if (!self.cpus_.empty() && !threadpoolimpl::pinTo(self.cpus_))
+    MYSPACE_WARN("cannot pin worker ", self.index_, " to its cpus");
+  Deadline last;
+  for (;;) {
+    Task task;
+    Deadline enqueued;
+    if (!findTask(self, task, enqueued)) {
+      auto since = std::chrono::steady_clock::now();
+      spinning_.fetch_add(1);
+      bool found = false;
+      for (parkerimpl::Backoff backoff; !backoff.completed();) {
+        backoff.snooze();
+        if (findTask(self, task, enqueued)) {
+          found = true;
+          break;
+        }
       }
-      catch (...) {
-        MYSPACE_WARN_EXCEPTION();
+      // the last spinner leaves, hand the rest of the work to a sleeper
+      if (spinning_.fetch_sub(1) == 1 && found &&
+          hasWork())
+        wakeOne();
+      last = std::chrono::steady_clock::now();
+      self.counters_.idle(threadpoolimpl::nanosSince(since, last));
+      if (!found) {
+        if (stop_.load())
+          break;
+        if (!park(self))
+          break;
+        auto now = std::chrono::steady_clock::now();
+        self.counters_.parked(threadpoolimpl::nanosSince(last, now));
+        last = now;
+        continue;
       }
     }
+    last = execute(task, enqueued, self.counters_, last);
+  }
+  currentWorker() = nullptr;
+  self.running_.store(false);
+}
+
+inline ThreadPool::Deadline
+ThreadPool::execute(Task &task, Deadline enqueued,
+                    threadpoolimpl::Counters &counters, Deadline start) {
+  if (!task)
+    return start;
+  bool timing = timing_.load(std::memory_order_relaxed);
+  if (timing && start == Deadline())
+    start = std::chrono::steady_clock::now();
+  try {
+    task();
   }
+  catch (...) {
+    MYSPACE_WARN_EXCEPTION();
+    counters.exception();
+  }
+  counters.executed();
+  if (!timing)
+    return Deadline();
+  auto end = std::chrono::steady_clock::now();
+  // pushed with timing off
+  if (enqueued != Deadline()) {
+    counters.waited(threadpoolimpl::nanosSince(enqueued, start));
+    if (elastic() && start - enqueued > grow_latency_)
+      grow();
+  }
+  counters.ran(threadpoolimpl::nanosSince(start, end));
+  return end;
+}
+
+inline void ThreadPool::setTiming(bool on) {
+  timing_.store(on, std::memory_order_relaxed);
+}
+
+inline ThreadPool::Stats ThreadPool::stats() const {
+  auto read = [](const threadpoolimpl::Counters &from, Stats::Counters &to) {
+    typedef threadpoolimpl::Counters C;
+    to.executed_ = C::read(from.executed_);
+    to.stolen_ = C::read(from.stolen_);
+    to.exceptions_ = C::read(from.exceptions_);
+    to.wait_ns_ = C::read(from.wait_ns_);
+    to.busy_ns_ = C::read(from.busy_ns_);
+    to.idle_ns_ = C::read(from.idle_ns_);
+    to.parked_ns_ = C::read(from.parked_ns_);
+    for (size_t i = 0; i < threadpoolimpl::HISTOGRAM; ++i)
+      to.histogram_[i] = C::read(from.histogram_[i]);
+  };
+  Stats ret;
+  ret.workers_.resize(workers_.size());
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    read(workers_[i]->counters_, ret.workers_[i]);
+    ret.total_ += ret.workers_[i];
+  }
+  read(external_, ret.external_);
+  ret.total_ += ret.external_;
+  for (size_t i = 0; i < threadpoolimpl::LEVELS; ++i)
+    ret.queued_.push_back(queueDepth((Priority)i));
+  return ret;
+}
+
+inline ThreadPool::Stats::Counters &ThreadPool::Stats::Counters::
+operator+=(const Counters &other) {
+  executed_ += other.executed_;
+  stolen_ += other.stolen_;
+  exceptions_ += other.exceptions_;
+  wait_ns_ += other.wait_ns_;
+  busy_ns_ += other.busy_ns_;
+  idle_ns_ += other.idle_ns_;
+  parked_ns_ += other.parked_ns_;
+  for (size_t i = 0; i < histogram_.size(); ++i)
+    histogram_[i] += other.histogram_[i];
+  return *this;
+}
+
+inline Json ThreadPool::Stats::Counters::toJson() const {
+  return Json{ { "executed", executed_ },   { "stolen", stolen_ },
+               { "exceptions", exceptions_ }, { "wait_ns", wait_ns_ },
+               { "busy_ns", busy_ns_ },       { "idle_ns", idle_ns_ },
+               { "parked_ns", parked_ns_ },   { "histogram", histogram_ } };
+}
+
+inline Json ThreadPool::Stats::toJson() const {
+  Json::Array workers;
+  for (auto &worker : workers_)
+    workers.push_back(worker.toJson());
+  return Json{ { "workers", std::move(workers) },
+               { "external", external_.toJson() },
+               { "total", total_.toJson() },
+               { "queued", queued_ } };
 }
 
 MYSPACE_END
@@ -0,0 +1,369 @@
+#pragma once
+
+#include "myspace/_/stdafx.hpp"
+#include "myspace/exception/exception.hpp"
+#include "myspace/logger/logger.hpp"
+
+MYSPACE_BEGIN
+
+namespace wheelimpl {
+// index of the lowest set bit, x != 0
+inline uint32_t lowest(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return (uint32_t)__builtin_ctzll(x);
+#else
+  uint32_t i = 0;
+  while (!(x & 1)) {
+    x >>= 1;
+    ++i;
+  }
+  return i;
+#endif
+}
+} // namespace wheelimpl
+
+// hierarchical timing wheel, 4 levels of 256 slots, so 2^32 ticks ahead.
+// a timer sits in an intrusive list of the slot its expiry falls in, which
+// makes after/restart/cancel O(1), and is moved a level down when the time
+// reaches its slot. bitmaps of the busy slots give the next tick with work,
+// so the loop sleeps until then instead of waking every tick.
+// not thread safe, it belongs to the loop that calls expire(), driven by
+// poll/epoll_wait with timeout() or by a timerfd set with arm()
+class TimerWheel {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  // 0 is never a timer
+  typedef uint64_t Id;
+
+  explicit TimerWheel(
+      std::chrono::milliseconds tick = std::chrono::milliseconds(1));
+
+  TimerWheel(const TimerWheel &) = delete;
+  TimerWheel &operator=(const TimerWheel &) = delete;
+
+  // f runs once from expire() after delay, rounded up to a tick
+  Id after(std::chrono::milliseconds delay, std::function<void()> f);
+
+  // pushes a pending timer to delay from now and keeps its function,
+  // false if it ran or was cancelled
+  bool restart(Id id, std::chrono::milliseconds delay);
+
+  bool cancel(Id id);
+
+  bool pending(Id id) const;
+
+  size_t size() const;
+
+  bool empty() const;
+
+  // runs the timers due by now, in expiry order by tick, returns how many.
+  // a timer may add, restart or cancel timers, its own id is gone by then
+  size_t expire();
+
+  size_t expire(Clock::time_point now);
+
+  // ms until expire() has work, -1 if no timer is pending,
+  // as a poll/epoll_wait timeout
+  int timeout() const;
+
+  int timeout(Clock::time_point now) const;
+
+  // sets a CLOCK_MONOTONIC timerfd to go off when expire() has work,
+  // or disarms it if no timer is pending
+  bool arm(int timerfd) const;
+
+private:
+  enum : uint32_t {
+    BITS = 8,
+    SLOTS = 1 << BITS,
+    MASK = SLOTS - 1,
+    LEVELS = 4,
+    WORDS = SLOTS / 64,
+    NIL = 0xffffffff,
+  };
+
+  struct Node {
+    std::function<void()> f_;
+    // expiry, in ticks since start_
+    uint64_t when_ = 0;
+    uint32_t gen_ = 1;
+    // heads_ index while linked
+    uint32_t list_ = NIL;
+    uint32_t prev_ = NIL;
+    uint32_t next_ = NIL;
+  };
+
+  // ticks from start_ to t, rounded down or up
+  uint64_t ticks(Clock::time_point t, bool up) const;
+
+  Clock::time_point timeAt(uint64_t ticks) const;
+
+  // node index of id, NIL if it is not pending
+  uint32_t find(Id id) const;
+
+  // into the slot of when_, relative to now_
+  void link(uint32_t i);
+
+  void unlink(uint32_t i);
+
+  // relinks the timers of slot (now_ >> level * BITS) of level
+  void cascade(uint32_t level);
+
+  // the next tick after now_ with timers to run or cascade, 0 if none
+  uint64_t next() const;
+
+  // distance from slot c to the next busy slot of level, 1 to SLOTS,
+  // 0 if the level is empty
+  uint32_t scan(uint32_t level, uint32_t c) const;
+
+  std::chrono::nanoseconds tick_;
+  Clock::time_point start_;
+  // ticks handled
+  uint64_t now_ = 0;
+  size_t size_ = 0;
+
+  std::vector<Node> nodes_;
+  std::vector<uint32_t> free_;
+
+  uint32_t heads_[LEVELS * SLOTS];
+  uint64_t busy_[LEVELS * WORDS];
+};
+
+inline TimerWheel::TimerWheel(std::chrono::milliseconds tick)
+    : tick_(std::max(std::chrono::nanoseconds(tick),
+                     std::chrono::nanoseconds(std::chrono::milliseconds(1)))),
+      start_(Clock::now()) {
+  std::fill(std::begin(heads_), std::end(heads_), (uint32_t)NIL);
+  std::fill(std::begin(busy_), std::end(busy_), 0);
+}
+
+inline uint64_t TimerWheel::ticks(Clock::time_point t, bool up) const {
+  if (t <= start_)
+    return 0;
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t - start_);
+  auto n = ns.count() / tick_.count();
+  if (up && ns.count() % tick_.count())
+    ++n;
+  return n;
+}
+
+inline TimerWheel::Clock::time_point TimerWheel::timeAt(uint64_t ticks) const {
+  return start_ +
+         std::chrono::duration_cast<Clock::duration>(tick_ * (int64_t)ticks);
+}
+
+inline TimerWheel::Id TimerWheel::after(std::chrono::milliseconds delay,
+                                        std::function<void()> f) {
+  uint32_t i;
+  if (!free_.empty()) {
+    i = free_.back();
+    free_.pop_back();
+  } else {
+    MYSPACE_THROW_IF(nodes_.size() >= NIL);
+    i = (uint32_t)nodes_.size();
+    nodes_.emplace_back();
+  }
+  auto &node = nodes_[i];
+  node.f_ = std::move(f);
+  node.when_ = ticks(Clock::now() + delay, true);
+  link(i);
+  ++size_;
+  return (Id)node.gen_ << 32 | i;
+}
+
+inline bool TimerWheel::restart(Id id, std::chrono::milliseconds delay) {
+  auto i = find(id);
+  if (i == NIL)
+    return false;
+  unlink(i);
+  nodes_[i].when_ = ticks(Clock::now() + delay, true);
+  link(i);
+  return true;
+}
+
+inline bool TimerWheel::cancel(Id id) {
+  auto i = find(id);
+  if (i == NIL)
+    return false;
+  unlink(i);
+  auto &node = nodes_[i];
+  node.f_ = nullptr;
+  if (++node.gen_ == 0)
+    node.gen_ = 1;
+  free_.push_back(i);
+  --size_;
+  return true;
+}
+
+inline bool TimerWheel::pending(Id id) const { return find(id) != NIL; }
+
+inline size_t TimerWheel::size() const { return size_; }
+
+inline bool TimerWheel::empty() const { return size_ == 0; }
+
+inline uint32_t TimerWheel::find(Id id) const {
+  auto i = (uint32_t)id;
+  if (i >= nodes_.size() || nodes_[i].gen_ != (uint32_t)(id >> 32) ||
+      nodes_[i].list_ == NIL)
+    return NIL;
+  return i;
+}
+
+inline void TimerWheel::link(uint32_t i) {
+  auto &node = nodes_[i];
+  // a timer already due goes to the next tick, never the one being run
+  auto when = std::max(node.when_, now_ + 1);
+  auto delta = when - now_;
+  uint32_t level = 0;
+  while (level + 1 < LEVELS && delta >> (BITS * (level + 1)))
+    ++level;
+  // beyond the top level, parked at its end and relinked when reached
+  auto span = (uint64_t)1 << (BITS * LEVELS);
+  if (delta >= span)
+    when = now_ + span - 1;
+  auto slot = (uint32_t)(when >> (BITS * level)) & MASK;
+  auto list = level * SLOTS + slot;
+  node.list_ = list;
+  node.prev_ = NIL;
+  node.next_ = heads_[list];
+  if (node.next_ != NIL)
+    nodes_[node.next_].prev_ = i;
+  heads_[list] = i;
+  busy_[list / 64] |= (uint64_t)1 << (list % 64);
+}
+
+inline void TimerWheel::unlink(uint32_t i) {
+  auto &node = nodes_[i];
+  if (node.prev_ != NIL)
+    nodes_[node.prev_].next_ = node.next_;
+  else
+    heads_[node.list_] = node.next_;
+  if (node.next_ != NIL)
+    nodes_[node.next_].prev_ = node.prev_;
+  if (heads_[node.list_] == NIL)
+    busy_[node.list_ / 64] &= ~((uint64_t)1 << (node.list_ % 64));
+  node.list_ = node.prev_ = node.next_ = NIL;
+}
+
+inline void TimerWheel::cascade(uint32_t level) {
+  auto list = level * SLOTS + ((uint32_t)(now_ >> (BITS * level)) & MASK);
+  while (heads_[list] != NIL) {
+    auto i = heads_[list];
+    unlink(i);
+    link(i);
+  }
+}
+
+inline uint32_t TimerWheel::scan(uint32_t level, uint32_t c) const {
+  auto busy = busy_ + level * WORDS;
+  for (uint32_t d = 1; d <= SLOTS;) {
+    auto s = (c + d) & MASK;
+    auto word = busy[s / 64] >> (s % 64);
+    if (word)
+      return d + wheelimpl::lowest(word);
+    d += 64 - s % 64;
+  }
+  return 0;
+}
+
+inline uint64_t TimerWheel::next() const {
+  if (size_ == 0)
+    return 0;
+  uint64_t best = 0;
+  for (uint32_t level = 0; level < LEVELS; ++level) {
+    auto shift = BITS * level;
+    auto d = scan(level, (uint32_t)(now_ >> shift) & MASK);
+    if (d == 0)
+      continue;
+    // a level 0 slot runs at its tick, a higher one cascades at its start
+    auto t = ((now_ >> shift) + d) << shift;
+    if (best == 0 || t < best)
+      best = t;
+  }
+  return best;
+}
+
+inline size_t TimerWheel::expire() { return expire(Clock::now()); }
+
+inline size_t TimerWheel::expire(Clock::time_point now) {
+  auto target = ticks(now, false);
+  size_t ran = 0;
+  while (now_ < target) {
+    // ticks with nothing to run or cascade are skipped
+    auto t = next();
+    if (t == 0 || t > target) {
+      now_ = target;
+      break;
+    }
+    now_ = t;
+    for (uint32_t level = 1; level < LEVELS; ++level) {
+      if ((now_ >> (BITS * (level - 1))) & MASK)
+        break;
+      cascade(level);
+    }
+    // timers added by the callbacks land in later slots
+    auto list = (uint32_t)now_ & MASK;
+    while (heads_[list] != NIL) {
+      auto i = heads_[list];
+      unlink(i);
+      auto &node = nodes_[i];
+      auto f = std::move(node.f_);
+      node.f_ = nullptr;
+      if (++node.gen_ == 0)
+        node.gen_ = 1;
+      free_.push_back(i);
+      --size_;
+      ++ran;
+      try {
+        f();
+      }
+      catch (...) {
+        MYSPACE_WARN_EXCEPTION();
+      }
+    }
+  }
+  return ran;
+}
+
+inline int TimerWheel::timeout() const { return timeout(Clock::now()); }
+
+inline int TimerWheel::timeout(Clock::time_point now) const {
+  auto t = next();
+  if (t == 0)
+    return -1;
+  auto at = timeAt(t);
+  if (at <= now)
+    return 0;
+  // rounded up, waking before the tick would find nothing to run
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                at - now + std::chrono::milliseconds(1) -
+                std::chrono::nanoseconds(1))
+                .count();
+  return (int)std::min<int64_t>(ms, std::numeric_limits<int>::max());
+}
+
+inline bool TimerWheel::arm(int timerfd) const {
+#if defined(MYSPACE_LINUX)
+  itimerspec spec;
+  ::memset(&spec, 0, sizeof(spec));
+  auto t = next();
+  if (t != 0) {
+    // steady_clock is CLOCK_MONOTONIC, so the expiry is set absolute
+    auto at = timeAt(t);
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  at.time_since_epoch())
+                  .count();
+    spec.it_value.tv_sec = ns / 1000000000;
+    spec.it_value.tv_nsec = ns % 1000000000;
+    // zero would disarm it
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+      spec.it_value.tv_nsec = 1;
+  }
+  return 0 == ::timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &spec, nullptr);
+#else
+  return false;
+#endif
+}
+
+MYSPACE_END